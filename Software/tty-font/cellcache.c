@@ -0,0 +1,242 @@
+/* cellcache.c
+ *
+ * cache of rendered character cells for the vt emulation.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cellcache.h"
+
+struct cellcache_entry {
+	struct cellcache_entry *next;			/* in the hash bucket */
+	struct cellcache_entry *newer, *older;	/* in the lru list */
+	const unsigned char *glyph;
+	uint8_t fg, bg, attr, format;
+	uint32_t hash;
+	unsigned char pixels[];
+};
+
+/* bit n of a byte set -> byte 7 - n of the spread value set to 0xff, so a
+ * row of the bitmap is expanded to pixels 8 at a time.
+ */
+static uint64_t cellcache_spread[256];
+static int cellcache_spread_done = 0;
+
+static void cellcache_spread_init(void)
+{
+	unsigned int i, bit;
+	if (cellcache_spread_done) { return; }
+	for (i = 0; i < 256; ++i) {
+		unsigned char px[8];
+		for (bit = 0; bit < 8; ++bit) {
+			px[bit] = (i & (0x80 >> bit)) ? 0xff : 0;
+		}
+		memcpy(&cellcache_spread[i], px, 8);
+	}
+	cellcache_spread_done = 1;
+}
+
+struct cellcache *cellcache_new(unsigned int width, unsigned int height, size_t budget, unsigned int flags)
+{
+	if (width == 0 || height == 0) {
+		fprintf(stderr, "%s: invalid cell size\n", __func__);
+		return 0;
+	}
+	cellcache_spread_init();
+	struct cellcache *cache = calloc(1, sizeof(struct cellcache));
+	if (!cache) {
+		perror(__func__);
+		return 0;
+	}
+	cache->width = width;
+	cache->height = height;
+	cache->flags = flags;
+	cache->budget = budget;
+	cache->nbuckets = 64;
+	cache->bucket = calloc(cache->nbuckets, sizeof(struct cellcache_entry*));
+	cache->mask = malloc((size_t) (width + 7) / 8 * height);
+	if (!cache->bucket || !cache->mask) {
+		perror(__func__);
+		cellcache_delete(cache);
+		return 0;
+	}
+	return cache;
+}
+
+void cellcache_clear(struct cellcache *cache)
+{
+	struct cellcache_entry *entry = cache->newest;
+	while (entry) {
+		struct cellcache_entry *older = entry->older;
+		free(entry);
+		entry = older;
+	}
+	memset(cache->bucket, 0, cache->nbuckets * sizeof(struct cellcache_entry*));
+	cache->newest = cache->oldest = 0;
+	cache->nentries = 0;
+	cache->used = 0;
+}
+
+void cellcache_delete(struct cellcache *cache)
+{
+	if (cache->bucket) { cellcache_clear(cache); }
+	free(cache->bucket);
+	free(cache->mask);
+	free(cache);
+}
+
+static size_t cellcache_pixsize(struct cellcache *cache, unsigned int format)
+{
+	size_t rowsize = format == CELLCACHE_MASK1 ? (cache->width + 7) / 8 : cache->width;
+	return rowsize * cache->height;
+}
+
+/* multiplicative mixing is enough here, the glyph addresses already differ
+ * in their low bits.
+ */
+static uint32_t cellcache_hash(const unsigned char *glyph, unsigned int fg, unsigned int bg, unsigned int attr, unsigned int format)
+{
+	uint64_t h = (uint64_t) (uintptr_t) glyph * 0x9e3779b97f4a7c15ULL;
+	h ^= (uint64_t) (fg | bg << 8 | attr << 16 | format << 24) * 0xff51afd7ed558ccdULL;
+	return (uint32_t) (h >> 32) ^ (uint32_t) h;
+}
+
+static void cellcache_unlink(struct cellcache *cache, struct cellcache_entry *entry)
+{
+	if (entry->newer) { entry->newer->older = entry->older; } else { cache->newest = entry->older; }
+	if (entry->older) { entry->older->newer = entry->newer; } else { cache->oldest = entry->newer; }
+}
+
+static void cellcache_push(struct cellcache *cache, struct cellcache_entry *entry)
+{
+	entry->newer = 0;
+	entry->older = cache->newest;
+	if (cache->newest) { cache->newest->newer = entry; } else { cache->oldest = entry; }
+	cache->newest = entry;
+}
+
+static void cellcache_evict(struct cellcache *cache)
+{
+	struct cellcache_entry *entry = cache->oldest, **pp;
+	for (pp = &cache->bucket[entry->hash & (cache->nbuckets - 1)]; *pp != entry; pp = &(*pp)->next) {}
+	*pp = entry->next;
+	cellcache_unlink(cache, entry);
+	cache->used -= sizeof(struct cellcache_entry) + cellcache_pixsize(cache, entry->format);
+	--cache->nentries;
+	++cache->evictions;
+	free(entry);
+}
+
+/* doubles the number of buckets. If that fails, the chains just get longer */
+static void cellcache_grow(struct cellcache *cache)
+{
+	unsigned int nbuckets = cache->nbuckets * 2, i;
+	struct cellcache_entry **bucket = calloc(nbuckets, sizeof(struct cellcache_entry*));
+	if (!bucket) { return; }
+	for (i = 0; i < cache->nbuckets; ++i) {
+		struct cellcache_entry *entry = cache->bucket[i];
+		while (entry) {
+			struct cellcache_entry *next = entry->next;
+			entry->next = bucket[entry->hash & (nbuckets - 1)];
+			bucket[entry->hash & (nbuckets - 1)] = entry;
+			entry = next;
+		}
+	}
+	free(cache->bucket);
+	cache->bucket = bucket;
+	cache->nbuckets = nbuckets;
+}
+
+/* draws the variant of the glyph into the cache mask, one row at a time */
+static void cellcache_drawmask(struct cellcache *cache, const unsigned char *glyph, unsigned int attr)
+{
+	unsigned int rowbytes = (cache->width + 7) / 8, y, i;
+	unsigned char last = 0xff << ((8 - cache->width % 8) % 8);
+	int smear = (attr & CELLCACHE_BOLD) && (cache->flags & CELLCACHE_SMEARBOLD);
+	for (y = 0; y < cache->height; ++y) {
+		unsigned char *row = cache->mask + y * rowbytes;
+		if ((attr & CELLCACHE_UNDERLINE) && y == cache->height - 1) {
+			memset(row, 0xff, rowbytes);
+		} else if (glyph) {
+			memcpy(row, glyph + y * rowbytes, rowbytes);
+			if (smear) {
+				/* row |= row >> 1, over the whole row */
+				for (i = rowbytes; i-- > 0;) {
+					row[i] |= (row[i] >> 1) | (i > 0 ? row[i - 1] << 7 : 0);
+				}
+			}
+		} else {
+			memset(row, 0, rowbytes);
+		}
+		row[rowbytes - 1] &= last;
+	}
+}
+
+/* expands the cache mask into pixels */
+static void cellcache_expand(struct cellcache *cache, unsigned int fg, unsigned int bg, unsigned int format, unsigned char *pixels)
+{
+	unsigned int rowbytes = (cache->width + 7) / 8, width = cache->width, x, y;
+	if (format == CELLCACHE_MASK1) {
+		memcpy(pixels, cache->mask, (size_t) rowbytes * cache->height);
+		return;
+	}
+	uint64_t fgw = (uint64_t) (fg & 0xff) * 0x0101010101010101ULL;
+	uint64_t bgw = (uint64_t) (bg & 0xff) * 0x0101010101010101ULL;
+	for (y = 0; y < cache->height; ++y, pixels += width) {
+		const unsigned char *row = cache->mask + y * rowbytes;
+		for (x = 0; x < width; x += 8) {
+			uint64_t spread = cellcache_spread[row[x / 8]];
+			uint64_t px = (fgw & spread) | (bgw & ~spread);
+			memcpy(pixels + x, &px, width - x < 8 ? width - x : 8);
+		}
+	}
+}
+
+const unsigned char *cellcache_get(struct cellcache *cache, const unsigned char *glyph, unsigned int fg, unsigned int bg, unsigned int attr, unsigned int format)
+{
+	if (format == CELLCACHE_MASK1) { fg = bg = 0; }
+	if (!(cache->flags & CELLCACHE_SMEARBOLD)) { attr &= ~CELLCACHE_BOLD; }
+	uint32_t hash = cellcache_hash(glyph, fg, bg, attr, format);
+	struct cellcache_entry *entry;
+	for (entry = cache->bucket[hash & (cache->nbuckets - 1)]; entry; entry = entry->next) {
+		if (entry->glyph == glyph && entry->fg == fg && entry->bg == bg && entry->attr == attr && entry->format == format) {
+			++cache->hits;
+			if (entry != cache->newest) {
+				cellcache_unlink(cache, entry);
+				cellcache_push(cache, entry);
+			}
+			return entry->pixels;
+		}
+	}
+
+	++cache->misses;
+	size_t size = sizeof(struct cellcache_entry) + cellcache_pixsize(cache, format);
+	/* a cache that is too small still holds one cell */
+	while (cache->oldest && cache->used + size > cache->budget) {
+		cellcache_evict(cache);
+	}
+	entry = malloc(size);
+	if (!entry) {
+		perror(__func__);
+		return 0;
+	}
+	entry->glyph = glyph;
+	entry->fg = fg;
+	entry->bg = bg;
+	entry->attr = attr;
+	entry->format = format;
+	entry->hash = hash;
+	cellcache_drawmask(cache, glyph, attr);
+	cellcache_expand(cache, fg, bg, format, entry->pixels);
+
+	if (cache->nentries >= cache->nbuckets) { cellcache_grow(cache); }
+	entry->next = cache->bucket[hash & (cache->nbuckets - 1)];
+	cache->bucket[hash & (cache->nbuckets - 1)] = entry;
+	cellcache_push(cache, entry);
+	cache->used += size;
+	++cache->nentries;
+	return entry->pixels;
+}
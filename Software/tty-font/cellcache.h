@@ -0,0 +1,112 @@
+/* cellcache.h
+ *
+ * cache of rendered character cells for the vt emulation.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ *
+ * A terminal draws the same few glyphs over and over, in a handful of color
+ * and attribute combinations. The cache keeps fully drawn cells, keyed by
+ * glyph, colors, attributes and pixel format, so that drawing a cell that
+ * was drawn before is just copying its rows. Variants of a glyph (underline,
+ * smeared bold) are made from its bitmap with operations on whole rows
+ * before the row is expanded to pixels. When the cache would grow beyond its
+ * memory budget, the least recently used cells are dropped.
+ */
+
+#ifndef cellcache_h
+#define cellcache_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* pixel formats */
+#define CELLCACHE_INDEX8 0	/* one palette index per pixel, like vt_render */
+#define CELLCACHE_MASK1  1	/* packed rows of 1 bit per pixel, 1 for fg */
+
+/* cell attributes that change the pixels */
+#define CELLCACHE_UNDERLINE 0x01
+#define CELLCACHE_BOLD      0x02	/* smeared, only with CELLCACHE_SMEARBOLD */
+
+/* flags for cellcache_new */
+#define CELLCACHE_SMEARBOLD 0x01	/* draw bold cells with the glyph smeared
+									 * one pixel to the right */
+
+struct cellcache_entry;
+
+struct cellcache {
+	unsigned int width, height;		/* cell size in pixels */
+	unsigned int flags;
+	size_t budget, used;			/* memory in bytes */
+	struct cellcache_entry **bucket;
+	unsigned int nbuckets, nentries;
+	struct cellcache_entry *newest, *oldest;	/* lru list */
+	unsigned char *mask;			/* scratch space for the bitmap variant */
+
+	/* counters */
+	unsigned long long hits, misses, evictions;
+};
+
+/* cellcache_new
+ *
+ * allocates a new, empty cell cache.
+ *
+ * Arguments:
+ *	width	cell width in pixels
+ *	height	cell height in pixels
+ *	budget	memory the cached cells may use in bytes, including their
+ *			bookkeeping
+ *	flags	CELLCACHE_SMEARBOLD or 0
+ *
+ * Returns:
+ *	a pointer to the new cache, or 0 on error.
+ */
+struct cellcache *cellcache_new(unsigned int width, unsigned int height, size_t budget, unsigned int flags);
+
+/* cellcache_delete
+ *
+ * frees a cell cache and all cells in it.
+ *
+ * Arguments:
+ *	cache	the cache
+ *
+ * Returns:
+ *	-
+ */
+void cellcache_delete(struct cellcache *cache);
+
+/* cellcache_clear
+ *
+ * drops all cells from the cache. Cells are keyed by the address of the
+ * glyph bitmap, so this must be called when fonts are freed or changed.
+ *
+ * Arguments:
+ *	cache	the cache
+ *
+ * Returns:
+ *	-
+ */
+void cellcache_clear(struct cellcache *cache);
+
+/* cellcache_get
+ *
+ * returns a drawn cell, from the cache if it is there, or draws it and adds
+ * it to the cache.
+ *
+ * Arguments:
+ *	cache	the cache
+ *	glyph	the glyph bitmap as in a psf font of the cell size, or 0 for a
+ *			blank cell
+ *	fg		foreground palette index
+ *	bg		background palette index
+ *	attr	CELLCACHE_UNDERLINE and CELLCACHE_BOLD
+ *	format	CELLCACHE_INDEX8 or CELLCACHE_MASK1, fg and bg are ignored for
+ *			CELLCACHE_MASK1
+ *
+ * Returns:
+ *	the pixels of the cell, height rows of width bytes for CELLCACHE_INDEX8
+ *	or (width + 7) / 8 bytes for CELLCACHE_MASK1. They stay valid until the
+ *	next call. Returns 0 if there is not enough memory.
+ */
+const unsigned char *cellcache_get(struct cellcache *cache, const unsigned char *glyph, unsigned int fg, unsigned int bg, unsigned int attr, unsigned int format);
+
+#endif /* cellcache_h */
@@ -0,0 +1,54 @@
+/* fontdir.c
+ *
+ * finds the font files below a directory.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "fontdir.h"
+
+int fontdir_walk(const char *dir, int (*found)(void *ctx, char *path, const struct stat *st), void *ctx)
+{
+	DIR *d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return 0;
+	}
+	struct dirent *ent;
+	int ok = 1;
+	while (ok && (ent = readdir(d)) != 0) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) { continue; }
+		char *path = malloc(strlen(dir) + strlen(ent->d_name) + 2);
+		if (!path) {
+			perror(__func__);
+			ok = 0;
+			break;
+		}
+		sprintf(path, "%s/%s", dir, ent->d_name);
+		struct stat st;
+		int isdir = 0;
+#ifdef DT_DIR
+		isdir = ent->d_type == DT_DIR;
+		if (ent->d_type == DT_UNKNOWN)
+#endif
+		if (lstat(path, &st) == 0) {
+			isdir = S_ISDIR(st.st_mode);
+		}
+		if (isdir) {
+			ok = fontdir_walk(path, found, ctx);
+			free(path);
+		} else if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+			ok = found(ctx, path, &st);
+		} else {
+			free(path);
+		}
+	}
+	closedir(d);
+	return ok;
+}
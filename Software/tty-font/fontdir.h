@@ -0,0 +1,32 @@
+/* fontdir.h
+ *
+ * finds the font files below a directory.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#ifndef fontdir_h
+#define fontdir_h
+
+#include <sys/stat.h>
+
+/* fontdir_walk
+ *
+ * calls found for every regular file in a directory and its
+ * subdirectories. Symlinks to files are followed, symlinks to directories
+ * are not, so there are no loops. Files are reported in directory order.
+ *
+ * Arguments:
+ *	dir		directory to walk
+ *	found	called with ctx, the path of the file, which the callback
+ *			owns and must free, and the result of stat() for it. Returns
+ *			1 to go on, 0 to stop the walk.
+ *	ctx		passed to found
+ *
+ * Returns:
+ *	1 on success, 0 if a directory could not be read, memory ran out or
+ *	found returned 0
+ */
+int fontdir_walk(const char *dir, int (*found)(void *ctx, char *path, const struct stat *st), void *ctx);
+
+#endif /* fontdir_h */
@@ -0,0 +1,311 @@
+/* panel.c
+ *
+ * partial screen updates for small spi display panels.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "panel.h"
+
+/* display controller commands */
+#define PANEL_CASET 0x2a
+#define PANEL_RASET 0x2b
+#define PANEL_RAMWR 0x2c
+
+struct panel *panel_new(struct vt *vt, struct psf_fontset *set, struct panel_transport *transport, size_t dmasize)
+{
+	struct psf_font *first = psf_fontset_font(set, 0);
+	struct panel *panel = 0;
+	if (!first || dmasize < 2 || dmasize % 2) {
+		fprintf(stderr, "%s: invalid fonts or dma size\n", __func__);
+	} else if (!(panel = calloc(1, sizeof(struct panel)))) {
+		perror(__func__);
+	}
+	if (!panel) {
+		transport->close(transport->ctx);
+		return 0;
+	}
+	panel->cols = vt->cols;
+	panel->rows = vt->rows;
+	panel->cellw = psf_width(first);
+	panel->cellh = psf_height(first);
+	panel->stride = (size_t) panel->cols * panel->cellw;
+	panel->fb = calloc(panel->stride, (size_t) panel->rows * panel->cellh);
+	panel->shadow = malloc((size_t) panel->cols * panel->rows * sizeof(struct vt_cell));
+	panel->dma[0] = malloc(dmasize);
+	panel->dma[1] = malloc(dmasize);
+	panel->dmasize = dmasize;
+	panel->transport = transport;
+	if (!panel->fb || !panel->shadow || !panel->dma[0] || !panel->dma[1]) {
+		perror(__func__);
+		panel_delete(panel);
+		return 0;
+	}
+	/* no cell matches this, so the first update sends everything */
+	memset(panel->shadow, 0xff, (size_t) panel->cols * panel->rows * sizeof(struct vt_cell));
+	panel->cursorx = panel->cols;
+	unsigned int i;
+	for (i = 0; i < 256; ++i) {
+		uint32_t rgb = vt_palette(i);
+		panel->color[i] = ((rgb >> 8) & 0xf800) | ((rgb >> 5) & 0x07e0) | ((rgb >> 3) & 0x001f);
+	}
+	return panel;
+}
+
+void panel_delete(struct panel *panel)
+{
+	if (panel->transport) { panel->transport->close(panel->transport->ctx); }
+	free(panel->fb);
+	free(panel->shadow);
+	free(panel->dma[0]);
+	free(panel->dma[1]);
+	free(panel);
+}
+
+/* hands the filled dma buffer to the transport and switches to the other
+ * one, after the transfer from that has finished.
+ */
+static int panel_flush(struct panel *panel)
+{
+	struct panel_transport *tp = panel->transport;
+	if (panel->fill == 0) { return 1; }
+	if (!tp->sync(tp->ctx) || !tp->send(tp->ctx, panel->dma[panel->cur], panel->fill)) { return 0; }
+	panel->bytes += panel->fill;
+	panel->cur ^= 1;
+	panel->fill = 0;
+	return 1;
+}
+
+/* sends the pixels of a rectangle of cells */
+static int panel_send(struct panel *panel, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+	struct panel_transport *tp = panel->transport;
+	unsigned int px0 = x0 * panel->cellw, px1 = x1 * panel->cellw;
+	unsigned int py0 = y0 * panel->cellh, py1 = y1 * panel->cellh;
+	unsigned int x, y;
+
+	if (!panel_flush(panel) || !tp->sync(tp->ctx) || !tp->window(tp->ctx, px0, py0, px1 - 1, py1 - 1)) { return 0; }
+	++panel->windows;
+	panel->bytes += PANEL_WINDOW_COST;
+	for (y = py0; y < py1; ++y) {
+		const unsigned char *src = panel->fb + y * panel->stride;
+		for (x = px0; x < px1; ++x) {
+			uint16_t c = panel->color[src[x]];
+			unsigned char *dst = panel->dma[panel->cur] + panel->fill;
+			dst[0] = c >> 8;
+			dst[1] = c & 0xff;
+			panel->fill += 2;
+			if (panel->fill == panel->dmasize && !panel_flush(panel)) { return 0; }
+		}
+	}
+	return panel_flush(panel);
+}
+
+/* open window, for merging spans of consecutive lines */
+struct panel_rect {
+	unsigned int x0, x1, y0;
+};
+
+int panel_update(struct panel *panel, struct vt *vt, struct psf_fontset *set)
+{
+	unsigned int cols = panel->cols, x, y, i;
+	unsigned int cursorx = vt->cursorvisible ? vt->cur.x : cols, cursory = vt->cur.y;
+	/* gaps this many cells wide are cheaper to send than a new window */
+	unsigned int maxgap = PANEL_WINDOW_COST / (2 * panel->cellw * panel->cellh);
+	struct panel_rect open[cols], next[cols];
+	unsigned int nopen = 0, nnext;
+	int ok = 1;
+
+	vt_render(vt, set, panel->fb, panel->stride);
+	++panel->updates;
+
+	for (y = 0; ok && y <= panel->rows; ++y) {
+		nnext = 0;
+		if (y < panel->rows) {
+			struct vt_cell *line = vt->line[y], *shadow = &panel->shadow[(size_t) y * cols];
+			for (x = 0; x < cols; ++x) {
+				int changed = memcmp(&line[x], &shadow[x], sizeof(struct vt_cell)) != 0
+					|| (x == cursorx && y == cursory) != (x == panel->cursorx && y == panel->cursory);
+				if (!changed) { continue; }
+				shadow[x] = line[x];
+				if (nnext > 0 && x - next[nnext - 1].x1 <= maxgap) {
+					next[nnext - 1].x1 = x + 1;
+				} else {
+					next[nnext].x0 = x;
+					next[nnext].x1 = x + 1;
+					next[nnext].y0 = y;
+					++nnext;
+				}
+			}
+		}
+		/* spans continuing an open window with the same columns extend it,
+		 * all other open windows are sent.
+		 */
+		unsigned int j = 0;
+		for (i = 0; ok && i < nopen; ++i) {
+			while (j < nnext && next[j].x0 < open[i].x0) { ++j; }
+			if (j < nnext && next[j].x0 == open[i].x0 && next[j].x1 == open[i].x1) {
+				next[j].y0 = open[i].y0;
+			} else {
+				ok = panel_send(panel, open[i].x0, open[i].y0, open[i].x1, y);
+			}
+		}
+		memcpy(open, next, nnext * sizeof(struct panel_rect));
+		nopen = nnext;
+	}
+	panel->cursorx = cursorx;
+	panel->cursory = cursory;
+	return ok && panel->transport->sync(panel->transport->ctx);
+}
+
+/* file transport */
+
+struct panel_file {
+	struct panel_transport tp;
+	FILE *file;
+};
+
+static int panel_file_put(struct panel_file *pf, int type, const void *buf, size_t len)
+{
+	unsigned char hdr[5] = { type, len & 0xff, (len >> 8) & 0xff, (len >> 16) & 0xff, (len >> 24) & 0xff };
+	if (fwrite(hdr, 1, 5, pf->file) != 5 || fwrite(buf, 1, len, pf->file) != len) {
+		perror("panel");
+		return 0;
+	}
+	return 1;
+}
+
+static int panel_file_window(void *ctx, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+	unsigned char cmd, cols[4] = { x0 >> 8, x0 & 0xff, x1 >> 8, x1 & 0xff };
+	unsigned char rows[4] = { y0 >> 8, y0 & 0xff, y1 >> 8, y1 & 0xff };
+	cmd = PANEL_CASET;
+	int ok = panel_file_put(ctx, 'C', &cmd, 1) && panel_file_put(ctx, 'D', cols, 4);
+	cmd = PANEL_RASET;
+	ok = ok && panel_file_put(ctx, 'C', &cmd, 1) && panel_file_put(ctx, 'D', rows, 4);
+	cmd = PANEL_RAMWR;
+	return ok && panel_file_put(ctx, 'C', &cmd, 1);
+}
+
+static int panel_file_send(void *ctx, const unsigned char *buf, size_t len)
+{
+	return panel_file_put(ctx, 'D', buf, len);
+}
+
+/* writes are done when send returns */
+static int panel_file_sync(void *ctx)
+{
+	(void) ctx;
+	return 1;
+}
+
+static void panel_file_close(void *ctx)
+{
+	struct panel_file *pf = ctx;
+	fflush(pf->file);
+	free(pf);
+}
+
+struct panel_transport *panel_file_transport(FILE *file)
+{
+	struct panel_file *pf = calloc(1, sizeof(struct panel_file));
+	if (!pf) {
+		perror(__func__);
+		return 0;
+	}
+	pf->file = file;
+	pf->tp.window = panel_file_window;
+	pf->tp.send = panel_file_send;
+	pf->tp.sync = panel_file_sync;
+	pf->tp.close = panel_file_close;
+	pf->tp.ctx = pf;
+	return &pf->tp;
+}
+
+/* memory transport */
+
+struct panel_memory {
+	struct panel_transport tp;
+	unsigned int width, height;
+	unsigned int x0, y0, x1, y1, x, y;
+	int havebyte;
+	unsigned char byte;
+	uint16_t *pixels;
+};
+
+static int panel_memory_window(void *ctx, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+	struct panel_memory *mem = ctx;
+	if (x0 > x1 || y0 > y1 || x1 >= mem->width || y1 >= mem->height) {
+		fprintf(stderr, "panel: window out of range\n");
+		return 0;
+	}
+	mem->x0 = mem->x = x0;
+	mem->y0 = mem->y = y0;
+	mem->x1 = x1;
+	mem->y1 = y1;
+	mem->havebyte = 0;
+	return 1;
+}
+
+/* pixels go into the window line by line, and wrap around at its end */
+static int panel_memory_send(void *ctx, const unsigned char *buf, size_t len)
+{
+	struct panel_memory *mem = ctx;
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		if (!mem->havebyte) {
+			mem->byte = buf[i];
+			mem->havebyte = 1;
+			continue;
+		}
+		mem->pixels[(size_t) mem->y * mem->width + mem->x] = (mem->byte << 8) | buf[i];
+		mem->havebyte = 0;
+		if (mem->x++ == mem->x1) {
+			mem->x = mem->x0;
+			if (mem->y++ == mem->y1) { mem->y = mem->y0; }
+		}
+	}
+	return 1;
+}
+
+/* pixels are stored when send returns */
+static int panel_memory_sync(void *ctx)
+{
+	(void) ctx;
+	return 1;
+}
+
+static void panel_memory_close(void *ctx)
+{
+	struct panel_memory *mem = ctx;
+	free(mem->pixels);
+	free(mem);
+}
+
+struct panel_transport *panel_memory_transport(unsigned int width, unsigned int height)
+{
+	struct panel_memory *mem = calloc(1, sizeof(struct panel_memory));
+	if (!mem || !(mem->pixels = calloc((size_t) width * height, sizeof(uint16_t)))) {
+		perror(__func__);
+		free(mem);
+		return 0;
+	}
+	mem->width = width;
+	mem->height = height;
+	mem->tp.window = panel_memory_window;
+	mem->tp.send = panel_memory_send;
+	mem->tp.sync = panel_memory_sync;
+	mem->tp.close = panel_memory_close;
+	mem->tp.ctx = mem;
+	return &mem->tp;
+}
+
+const uint16_t *panel_memory_pixels(struct panel_transport *transport)
+{
+	struct panel_memory *mem = transport->ctx;
+	return mem->pixels;
+}
@@ -0,0 +1,146 @@
+/* panel.h
+ *
+ * partial screen updates for small spi display panels.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ *
+ * Panels like the st7789 or ili9341 are written by setting an address
+ * window and then streaming the pixels for it. Instead of sending the whole
+ * screen for every frame, the cells that changed since the last update are
+ * collected into as few windows as possible, and only their pixels are sent,
+ * as 16 bit rgb565, big endian. Pixels are packed into two dma buffers, one
+ * is filled while the other is sent.
+ */
+
+#ifndef panel_h
+#define panel_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "psf.h"
+#include "vt.h"
+
+/* bytes sent for setting an address window: CASET, RASET and RAMWR with
+ * their parameters. A gap between changed cells in a line is sent along
+ * if that is cheaper than a new window.
+ */
+#define PANEL_WINDOW_COST 11
+
+/* how pixels get to the panel */
+struct panel_transport {
+	/* sets the address window, coordinates are inclusive */
+	int (*window)(void *ctx, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+	/* starts sending pixel data. buf must stay valid until sync is called */
+	int (*send)(void *ctx, const unsigned char *buf, size_t len);
+	/* waits until the last send has finished */
+	int (*sync)(void *ctx);
+	/* frees the transport */
+	void (*close)(void *ctx);
+	void *ctx;
+};
+
+struct panel {
+	unsigned int cols, rows;		/* in cells */
+	unsigned int cellw, cellh;		/* cell size in pixels */
+	unsigned char *fb;				/* the screen, as drawn by vt_render */
+	size_t stride;
+	struct vt_cell *shadow;			/* cells as last sent to the panel */
+	unsigned int cursorx, cursory;	/* cursor as last sent, or cols if hidden */
+	unsigned char *dma[2];
+	size_t dmasize, fill;
+	unsigned int cur;				/* dma buffer being filled */
+	uint16_t color[256];			/* rgb565 for each palette index */
+	struct panel_transport *transport;
+
+	/* counters */
+	unsigned long long updates, windows, bytes;
+};
+
+/* panel_new
+ *
+ * sets up partial updates of a panel showing a terminal. The first update
+ * sends the whole screen.
+ *
+ * Arguments:
+ *	vt			the terminal
+ *	set			the fonts to draw with, which determine the cell size
+ *	transport	how to talk to the panel, owned by the panel from now on
+ *	dmasize		size of each of the two dma buffers in bytes, even
+ *
+ * Returns:
+ *	a pointer to the new panel, or 0 on error.
+ */
+struct panel *panel_new(struct vt *vt, struct psf_fontset *set, struct panel_transport *transport, size_t dmasize);
+
+/* panel_delete
+ *
+ * frees a panel and closes its transport.
+ *
+ * Arguments:
+ *	panel	the panel
+ *
+ * Returns:
+ *	-
+ */
+void panel_delete(struct panel *panel);
+
+/* panel_update
+ *
+ * draws the lines of the terminal that changed, and sends the cells that
+ * changed since the last update to the panel.
+ *
+ * Arguments:
+ *	panel	the panel
+ *	vt		the terminal
+ *	set		the fonts
+ *
+ * Returns:
+ *	1 on success, 0 if the transport failed.
+ */
+int panel_update(struct panel *panel, struct vt *vt, struct psf_fontset *set);
+
+/* panel_file_transport
+ *
+ * a transport that writes what would go over the spi bus to a file. Every
+ * transfer is written as 'C' for a command or 'D' for data, a 4 byte little
+ * endian length and the bytes. A window is set with the commands CASET
+ * (0x2a) and RASET (0x2b), each followed by 4 bytes of data, and RAMWR
+ * (0x2c), after which the pixel data follows.
+ *
+ * Arguments:
+ *	file	the file to write to, not closed with the transport
+ *
+ * Returns:
+ *	the transport, or 0 on error.
+ */
+struct panel_transport *panel_file_transport(FILE *file);
+
+/* panel_memory_transport
+ *
+ * a transport that works like the panel itself: it keeps a framebuffer the
+ * pixels are written into, in the current address window.
+ *
+ * Arguments:
+ *	width	panel width in pixels
+ *	height	panel height in pixels
+ *
+ * Returns:
+ *	the transport, or 0 on error.
+ */
+struct panel_transport *panel_memory_transport(unsigned int width, unsigned int height);
+
+/* panel_memory_pixels
+ *
+ * returns the framebuffer of a memory transport, width * height rgb565
+ * values in native byte order.
+ *
+ * Arguments:
+ *	transport	a transport created with panel_memory_transport
+ *
+ * Returns:
+ *	the pixels.
+ */
+const uint16_t *panel_memory_pixels(struct panel_transport *transport);
+
+#endif /* panel_h */
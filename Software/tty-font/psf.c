@@ -9,16 +9,123 @@
  * http://www.win.tue.nl/~aeb/linux/kbd/font-formats-1.html
  */
 
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define PSF_POSIX	/* use POSIX file io where it helps */
+#endif
+
+#if defined(PSF_WITH_ZLIB) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* for fopencookie() */
+#elif defined(PSF_POSIX) && !defined(_XOPEN_SOURCE) && !defined(_GNU_SOURCE)
+#define _XOPEN_SOURCE 700	/* for mkstemp(), fchmod() */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef PSF_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#endif
+#ifdef PSF_WITH_ZLIB
+#include <sys/types.h>
+#include <zlib.h>
+#endif
+#if defined(PSF_POSIX) && !defined(IOV_MAX)
+#define IOV_MAX 1024
+#endif
+#if defined(PSF_POSIX) && !defined(PATH_MAX)
+#define PATH_MAX 4096
+#endif
 #include "psf.h"
 #include "mini_utf8.h"
 
+/* gzip magic number, see RFC 1952 */
+#define PSF_GZIP_MAGIC0 0x1f
+#define PSF_GZIP_MAGIC1 0x8b
+
 static int psf_reallocglyphs(struct psf_font *psf, unsigned int num);
+static unsigned char *psf_encode_index(struct psf_font *psf, size_t tabend, size_t *size);
+
+/* memory allocation, see struct psf_allocator */
+
+static void *psf_std_alloc(void *ctx, size_t size)
+{
+	(void) ctx;
+	return malloc(size);
+}
+
+static void *psf_std_realloc(void *ctx, void *ptr, size_t oldsize, size_t size)
+{
+	(void) ctx;
+	(void) oldsize;
+	return realloc(ptr, size);
+}
+
+static void psf_std_free(void *ctx, void *ptr)
+{
+	(void) ctx;
+	free(ptr);
+}
+
+static const struct psf_allocator psf_std_allocator = { psf_std_alloc, psf_std_realloc, psf_std_free, 0 };
+
+static void *psf_mem_alloc(const struct psf_allocator *alloc, size_t size)
+{
+	return alloc->alloc(alloc->ctx, size ? size : 1);
+}
+
+static void *psf_mem_calloc(const struct psf_allocator *alloc, size_t num, size_t size)
+{
+	if (size && num > (size_t) -1 / size) { return 0; }
+	void *ptr = psf_mem_alloc(alloc, num * size);
+	if (ptr) { memset(ptr, 0, num * size); }
+	return ptr;
+}
+
+/* without a realloc function, a new block is allocated and the old one
+ * copied and freed
+ */
+static void *psf_mem_realloc(const struct psf_allocator *alloc, void *ptr, size_t oldsize, size_t size)
+{
+	if (!ptr) { return psf_mem_alloc(alloc, size); }
+	if (alloc->realloc) { return alloc->realloc(alloc->ctx, ptr, oldsize, size ? size : 1); }
+	void *newptr = psf_mem_alloc(alloc, size);
+	if (newptr) {
+		memcpy(newptr, ptr, oldsize < size ? oldsize : size);
+		if (alloc->free) { alloc->free(alloc->ctx, ptr); }
+	}
+	return newptr;
+}
+
+static void psf_mem_free(const struct psf_allocator *alloc, void *ptr)
+{
+	if (ptr && alloc->free) { alloc->free(alloc->ctx, ptr); }
+}
+
+/* fonts attached with psf_attach_shared can not be changed */
+static int psf_readonly(struct psf_font *psf, const char *func)
+{
+	if (psf->shared) {
+		fprintf(stderr, "%s: font is shared and read only\n", func);
+		return 1;
+	}
+	return 0;
+}
 
 struct psf_font *psf_new(unsigned int version, unsigned int width, unsigned int height)
 {
+	return psf_new_ex(version, width, height, 0);
+}
+
+struct psf_font *psf_new_ex(unsigned int version, unsigned int width, unsigned int height, const struct psf_allocator *alloc)
+{
+	if (!alloc) { alloc = &psf_std_allocator; }
 	if (version != 1 && version != 2) {
 		fprintf(stderr, "%s: invalid version\n", __func__);
 		return 0;
@@ -28,12 +135,13 @@ struct psf_font *psf_new(unsigned int version, unsigned int width, unsigned int
 		return 0;
 	}
 
-	struct psf_font *psf = calloc(1, sizeof(struct psf_font));
+	struct psf_font *psf = psf_mem_calloc(alloc, 1, sizeof(struct psf_font));
 	if (!psf) {
 		perror(__func__);
 		return 0;
 	}
 
+	psf->alloc = *alloc;
 	psf->version = version;
 	if (version == 1) {
 		psf->header.psf1.charsize = height;
@@ -65,16 +173,6 @@ static int psf_read_byte(FILE *file, unsigned int *bval)
 	return 1;
 }
 
-static int psf_write_byte(FILE *file, unsigned int bval)
-{
-	int wr = fputc(bval & 0xff, file);
-	if (wr == EOF) {
-		perror(__func__);
-		return 0;
-	}
-	return 1;
-}
-
 static int psf_read_word(FILE *file, unsigned int *wval)
 {
 	unsigned int byte0, byte1;
@@ -85,14 +183,6 @@ static int psf_read_word(FILE *file, unsigned int *wval)
 	return 1;
 }
 
-static int psf_write_word(FILE *file, unsigned int wval)
-{
-	unsigned int byte0, byte1;
-	byte0 = wval & 0xff;
-	byte1 = (wval >> 8) & 0xff;
-	return psf_write_byte(file, byte0) && psf_write_byte(file, byte1);
-}
-
 static int psf_read_int(FILE *file, unsigned int *ival)
 {
 	unsigned int byte0, byte1, byte2, byte3;
@@ -103,23 +193,34 @@ static int psf_read_int(FILE *file, unsigned int *ival)
 	return 1;
 }
 
-static int psf_write_int(FILE *file, unsigned int ival)
+static void psf_put_word(unsigned char *buf, unsigned int wval)
 {
-	unsigned int byte0, byte1, byte2, byte3;
-	byte0 = ival & 0xff;
-	byte1 = (ival >> 8) & 0xff;
-	byte2 = (ival >> 16) & 0xff;
-	byte3 = (ival >> 24) & 0xff;
-	return psf_write_byte(file, byte0) && psf_write_byte(file, byte1) && psf_write_byte(file, byte2) && psf_write_byte(file, byte3);
+	buf[0] = wval & 0xff;
+	buf[1] = (wval >> 8) & 0xff;
+}
+
+static void psf_put_int(unsigned char *buf, unsigned int ival)
+{
+	buf[0] = ival & 0xff;
+	buf[1] = (ival >> 8) & 0xff;
+	buf[2] = (ival >> 16) & 0xff;
+	buf[3] = (ival >> 24) & 0xff;
+}
+
+static uint32_t psf_get_int(const unsigned char *buf)
+{
+	return (uint32_t) buf[0] | ((uint32_t) buf[1] << 8) | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
 }
 
 static int psf_read_glyphs(FILE *file, struct psf_font *psf, unsigned int numglyphs, unsigned int glyphsize)
 {
 	unsigned int glyph;
-	psf->glyph = calloc(numglyphs, sizeof(struct psf_glyph));
+	psf_mem_free(&psf->alloc, psf->glyph);
+	psf->glyph = psf_mem_calloc(&psf->alloc, numglyphs, sizeof(struct psf_glyph));
+	psf->capacity = psf->glyph ? numglyphs : 0;
 	if (!psf->glyph) { return 0; }
 	for (glyph = 0; glyph < numglyphs; ++glyph) {
-		psf->glyph[glyph].data = malloc(glyphsize);
+		psf->glyph[glyph].data = psf_mem_alloc(&psf->alloc, glyphsize);
 		if (!psf->glyph[glyph].data) { return 0; } /* psf_delete will take care of cleanup */
 		if (fread(psf->glyph[glyph].data, 1, glyphsize, file) != glyphsize) { return 0; }
 	}
@@ -141,7 +242,10 @@ static int psf1_read_ucvals(FILE *file, struct psf_font *psf, unsigned int numgl
 	return 1;
 }
 
-static struct psf_font *psf1_load_fromfile(FILE* file)
+/* reads the rest of a psf1 header, the magic byte has already been read.
+ * Returns a font without glyphs.
+ */
+static struct psf_font *psf1_read_header(FILE* file, const struct psf_allocator *alloc)
 {
 	unsigned char magic[2];
 	magic[0] = PSF1_MAGIC0;
@@ -157,10 +261,19 @@ static struct psf_font *psf1_load_fromfile(FILE* file)
 	if (!psf_read_byte(file, &mode)) { return 0; }
 	if (!psf_read_byte(file, &height)) { return 0; }
 
-	struct psf_font *psf = psf_new(1, 8, height);
+	struct psf_font *psf = psf_new_ex(1, 8, height, alloc);
+	if (!psf) { return 0; }
 	psf->header.psf1.mode = mode;
+	return psf;
+}
+
+static struct psf_font *psf1_load_fromfile(FILE* file, const struct psf_allocator *alloc)
+{
+	struct psf_font *psf = psf1_read_header(file, alloc);
+	if (!psf) { return 0; }
 
-	int numglyphs = (mode & PSF1_MODE512) ? 512 : 256;
+	int numglyphs = (psf->header.psf1.mode & PSF1_MODE512) ? 512 : 256;
+	int height = psf->header.psf1.charsize;
 	if (!psf_read_glyphs(file, psf, numglyphs, height)) {
 		psf_delete(psf);
 		return 0;
@@ -174,18 +287,18 @@ static struct psf_font *psf1_load_fromfile(FILE* file)
 	return psf;
 }
 
-static unsigned char *psf2_read_remaining_file(FILE *file, unsigned int *size)
+static unsigned char *psf2_read_remaining_file(FILE *file, unsigned int *size, const struct psf_allocator *alloc)
 {
 	unsigned char buf[BUFSIZ], *ubuf = 0;
 	size_t nrd = 0, total = 0;
 
 	while ((nrd = fread(buf, 1, BUFSIZ, file)) > 0) {
-		unsigned char *newubuf = realloc(ubuf, total + nrd);
+		unsigned char *newubuf = psf_mem_realloc(alloc, ubuf, total, total + nrd);
 		if (newubuf) {
 			ubuf = newubuf;
 		} else {
 			perror(__func__);
-			free(ubuf);
+			psf_mem_free(alloc, ubuf);
 			return 0;
 		}
 		memcpy(&ubuf[total], buf, nrd);
@@ -193,19 +306,21 @@ static unsigned char *psf2_read_remaining_file(FILE *file, unsigned int *size)
 	}
 	if (ferror(file)) {
 		perror(__func__);
-		free(ubuf);
+		psf_mem_free(alloc, ubuf);
 		return 0;
 	}
 	*size = total;
 	return ubuf;
 }
 
-static int psf2_read_ucvals(FILE *file, struct psf_font *psf, unsigned int numglyphs)
+static int psf_index_adopt(struct psf_font *psf, FILE *file, const unsigned char *ubuf, size_t size, size_t offset);
+
+/* decodes a psf2 unicode table from a buffer. Returns a pointer behind the
+ * table, or 0 on error.
+ */
+static const unsigned char *psf2_decode_ucvals(struct psf_font *psf, const unsigned char *ptr, const unsigned char *end, unsigned int numglyphs)
 {
-	unsigned int size = 0, i;
-	unsigned char *ubuf = psf2_read_remaining_file(file, &size);
-	if (!ubuf) { return 0; }
-	unsigned char *ptr = ubuf, *end = ubuf + size;
+	unsigned int i;
 	for (i = 0; i < numglyphs; ++i) {
 		struct psf_glyph *glyph = &psf->glyph[i];
 		int ucval;
@@ -228,11 +343,42 @@ static int psf2_read_ucvals(FILE *file, struct psf_font *psf, unsigned int numgl
 			psf_glyph_adducval(psf, glyph, (unsigned)ucval & 0x1FFFFF);
 		}
 	}
+	return ptr;
+}
+
+static int psf2_read_ucvals(FILE *file, struct psf_font *psf, unsigned int numglyphs)
+{
+	unsigned int size = 0;
+	long tabstart = ftell(file);
+	unsigned char *ubuf = psf2_read_remaining_file(file, &size, &psf->alloc);
+	if (!ubuf) { return 0; }
+	unsigned char *ptr = ubuf, *end = ubuf + size;
+	if (!psf_hasunicodetable(psf)) {
+		psf_mem_free(&psf->alloc, ubuf);
+		return 1;
+	}
+	ptr = (unsigned char*) psf2_decode_ucvals(psf, ptr, end, numglyphs);
+	if (!ptr) {
+		psf_mem_free(&psf->alloc, ubuf);
+		return 0;
+	}
+
+	/* a lookup index may follow the unicode table, see psf_buildindex */
+	size_t tabend = sizeof(struct psf2_header) + (size_t) numglyphs * psf->header.psf2.charsize + (ptr - ubuf);
+	size_t pad = (PSFI_ALIGN - tabend % PSFI_ALIGN) % PSFI_ALIGN;
+	if ((size_t) (end - ptr) > pad) {
+		long offset = tabstart >= 0 ? tabstart + (long) (ptr - ubuf + pad) : -1;
+		psf_index_adopt(psf, offset >= 0 ? file : 0, ptr + pad, end - ptr - pad, offset);
+	}
 
+	psf_mem_free(&psf->alloc, ubuf);
 	return 1;
 }
 
-static struct psf_font *psf2_load_fromfile(FILE* file)
+/* reads the rest of a psf2 header, the magic byte has already been read.
+ * Returns a font without glyphs.
+ */
+static struct psf_font *psf2_read_header(FILE* file, const struct psf_allocator *alloc)
 {
 	unsigned char magic[4];
 	magic[0] = PSF2_MAGIC0;
@@ -254,7 +400,8 @@ static struct psf_font *psf2_load_fromfile(FILE* file)
 	if (!psf_read_int(file, &height)) { return 0; }
 	if (!psf_read_int(file, &width)) { return 0; }
 
-	struct psf_font *psf = psf_new(2, width, height);
+	struct psf_font *psf = psf_new_ex(2, width, height, alloc);
+	if (!psf) { return 0; }
 	psf->header.psf2.version = version;
 	psf->header.psf2.headersize = headersize;
 	psf->header.psf2.flags = flags;
@@ -262,8 +409,16 @@ static struct psf_font *psf2_load_fromfile(FILE* file)
 	psf->header.psf2.charsize = charsize;
 	psf->header.psf2.width = width;
 	psf->header.psf2.height = height;
+	return psf;
+}
 
-	if (!psf_read_glyphs(file, psf, length, charsize)) {
+static struct psf_font *psf2_load_fromfile(FILE* file, const struct psf_allocator *alloc)
+{
+	struct psf_font *psf = psf2_read_header(file, alloc);
+	if (!psf) { return 0; }
+
+	unsigned int length = psf->header.psf2.length;
+	if (!psf_read_glyphs(file, psf, length, psf->header.psf2.charsize)) {
 		psf_delete(psf);
 		return 0;
 	}
@@ -276,336 +431,2649 @@ static struct psf_font *psf2_load_fromfile(FILE* file)
 	return psf;
 }
 
-struct psf_font *psf_load_fromfile(FILE* file)
+/* varints, see psf.h */
+
+unsigned int psf_putvarint(unsigned char *buf, uint64_t val)
 {
-	struct psf_font *res = 0;
-	int byte = fgetc(file);
-	if (byte == PSF1_MAGIC0) {
-		res = psf1_load_fromfile(file);
-	} else if (byte == PSF2_MAGIC0) {
-		res = psf2_load_fromfile(file);
-	} else {
-		fprintf(stderr, "%s: invalid magic number", __func__);
+	unsigned int len = 0;
+	while (val >= 0x80) {
+		buf[len++] = (val & 0x7f) | 0x80;
+		val >>= 7;
 	}
-	return res;
+	buf[len++] = val;
+	return len;
 }
 
-struct psf_font *psf_load(const char* filename)
+int psf_getvarint(const unsigned char **ptr, const unsigned char *end, uint64_t *val)
 {
-	FILE *file = fopen(filename, "rb");
-	if (!file) {
-		perror(__func__);
-		return 0;
-	}
-	struct psf_font *res = psf_load_fromfile(file);
-	fclose(file);
-	return res;
+	const unsigned char *p = *ptr;
+	unsigned int shift = 0;
+	uint64_t v = 0;
+	do {
+		if (p >= end || shift > 63) { return 0; }
+		if (shift == 63 && (*p & 0x7e)) { return 0; }
+		v |= (uint64_t) (*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*ptr = p;
+	*val = v;
+	return 1;
 }
 
-static int psf_write_dummy(FILE *file, unsigned int size)
+/* compressed container, see psf.h */
+
+/* psf_getvarint for the 32 bit values of PSFZ and PSFX */
+static int psfz_getvarint(const unsigned char **ptr, const unsigned char *end, unsigned int *val)
 {
-	unsigned int i;
-	for (i = 0; i < size; ++i) {
-		if (fputc('\0', file) == EOF) { return 0; }
-	}
+	const unsigned char *p = *ptr;
+	uint64_t v;
+	if (!psf_getvarint(&p, end, &v) || v > 0xffffffffu) { return 0; }
+	*ptr = p;
+	*val = (unsigned int) v;
 	return 1;
 }
 
-static int psf_write_glyphs(FILE *file, struct psf_font *psf, unsigned int numglyphs, unsigned int glyphsize)
+/* decodes the data of one glyph into out. Returns 1 on success, 0 if the
+ * data is broken.
+ */
+static int psfz_decode(const unsigned char *ptr, const unsigned char *end, unsigned int rowsize, unsigned int height, unsigned char *out)
 {
-	unsigned int i;
-	for (i = 0; i < numglyphs; ++i) {
-		if (psf->glyph[i].data) {
-			int nwr = fwrite(psf->glyph[i].data, 1, glyphsize, file);
-			if (nwr != (int) glyphsize) {
-				perror(__func__);
-				return 0;
+	unsigned int head, nrows;
+	memset(out, 0, (size_t) rowsize * height);
+	if (ptr == end) { return 1; }
+	if (!psfz_getvarint(&ptr, end, &head) || !psfz_getvarint(&ptr, end, &nrows)) { return 0; }
+	unsigned int first = head >> 2;
+	if (first > height || nrows > height - first) { return 0; }
+
+	unsigned char *dst = out + (size_t) first * rowsize;
+	size_t len = (size_t) nrows * rowsize, pos = 0, n;
+	switch (head & 3) {
+	case PSFZ_RAW:
+		if ((size_t) (end - ptr) < len) { return 0; }
+		memcpy(dst, ptr, len);
+		return 1;
+	case PSFZ_ROWS:
+		while (pos < len) {
+			if (ptr >= end) { return 0; }
+			n = ((size_t) (*ptr & 0x7f) + 1) * rowsize;
+			if (n > len - pos) { return 0; }
+			if (*ptr++ & 0x80) {
+				/* overlapping copy repeats the row before */
+				size_t i;
+				if (pos > 0) {
+					for (i = 0; i < n; ++i) { dst[pos + i] = dst[pos + i - rowsize]; }
+				}
+			} else {
+				if ((size_t) (end - ptr) < n) { return 0; }
+				memcpy(&dst[pos], ptr, n);
+				ptr += n;
 			}
-		} else {
-			if (!psf_write_dummy(file, glyphsize)) {
-				perror(__func__);
-				return 0;
+			pos += n;
+		}
+		return 1;
+	case PSFZ_XOR:
+		while (pos < len) {
+			if (ptr >= end) { return 0; }
+			n = (size_t) (*ptr & 0x7f) + 1;
+			if (n > len - pos) { return 0; }
+			if (!(*ptr++ & 0x80)) {
+				if ((size_t) (end - ptr) < n) { return 0; }
+				memcpy(&dst[pos], ptr, n);
+				ptr += n;
 			}
+			pos += n;
+		}
+		for (pos = rowsize; pos < len; ++pos) {
+			dst[pos] ^= dst[pos - rowsize];
 		}
+		return 1;
 	}
-	return 1;
+	return 0;
 }
 
-static int psf1_write_ucvals(FILE *file, struct psf_font *psf, unsigned int numglyphs)
+/* checks the header of a compressed font. Returns a pointer to the offset
+ * table, or 0 if the header is broken.
+ */
+static const unsigned char *psfz_check(const unsigned char *image, size_t size)
 {
-	unsigned int i, ucv;
-	for (i = 0; i < numglyphs; ++i) {
-		for (ucv = 0; ucv < psf->glyph[i].nucvals; ++ucv) {
-			if (!psf_write_word(file, psf->glyph[i].ucvals[ucv])) { return 0; }
-		}
-		if (!psf_write_word(file, PSF1_SEPARATOR)) { return 0; }
+	if (size < PSFZ_HEADERSIZE || image[0] != PSFZ_MAGIC0 || image[1] != PSFZ_MAGIC1 || image[2] != PSFZ_MAGIC2 || image[3] != PSFZ_MAGIC3) {
+		fprintf(stderr, "%s: invalid magic number\n", __func__);
+		return 0;
 	}
-	return 1;
+	uint32_t version = psf_get_int(image + 4), headersize = psf_get_int(image + 8);
+	uint32_t length = psf_get_int(image + 16), charsize = psf_get_int(image + 20);
+	uint32_t height = psf_get_int(image + 24), datasize = psf_get_int(image + 40);
+	uint32_t osize = psf_get_int(image + 44);
+	if (version > PSFZ_VERSION || headersize < PSFZ_HEADERSIZE || height == 0 || charsize % height != 0
+		|| (osize != 2 && osize != 4) || headersize > size || (size - headersize) / osize <= length
+		|| size - headersize - osize * ((size_t) length + 1) < datasize) {
+		fprintf(stderr, "%s: invalid header\n", __func__);
+		return 0;
+	}
+	return image + headersize;
 }
 
-static int psf1_save_tofile(FILE *file, struct psf_font *psf)
+/* returns entry no of the offset table */
+static uint32_t psfz_offset(const unsigned char *offsets, uint32_t osize, size_t no)
 {
-	if (!psf_write_byte(file, psf->header.psf1.magic[0])) { return 0; }
-	if (!psf_write_byte(file, psf->header.psf1.magic[1])) { return 0; }
-	if (!psf_write_byte(file, psf->header.psf1.mode)) { return 0; }
-	if (!psf_write_byte(file, psf->header.psf1.charsize)) { return 0; }
+	const unsigned char *ptr = offsets + osize * no;
+	return osize == 2 ? (uint32_t) ptr[0] | ((uint32_t) ptr[1] << 8) : psf_get_int(ptr);
+}
 
-	int numglyphs = (psf->header.psf1.mode & PSF1_MODE512) ? 512 : 256;
-	if (!psf_write_glyphs(file, psf, numglyphs, psf->header.psf1.charsize)) {
+int psf_zglyph(const unsigned char *image, size_t size, unsigned int no, unsigned char *out)
+{
+	const unsigned char *offsets = psfz_check(image, size);
+	if (!offsets) { return 0; }
+	uint32_t length = psf_get_int(image + 16), charsize = psf_get_int(image + 20);
+	uint32_t height = psf_get_int(image + 24), datasize = psf_get_int(image + 40);
+	uint32_t osize = psf_get_int(image + 44);
+	if (no >= length) {
+		fprintf(stderr, "%s: invalid glyph number\n", __func__);
 		return 0;
 	}
-
-	if (psf->header.psf1.mode & (PSF1_MODEHASTAB | PSF1_MODEHASSEQ)) {
-		if (!psf1_write_ucvals(file, psf, numglyphs)) {
-			return 0;
-		}
+	const unsigned char *data = offsets + osize * ((size_t) length + 1);
+	uint32_t start = psfz_offset(offsets, osize, no), end = psfz_offset(offsets, osize, (size_t) no + 1);
+	if (start > end || end > datasize || !psfz_decode(data + start, data + end, charsize / height, height, out)) {
+		fprintf(stderr, "%s: invalid glyph data\n", __func__);
+		return 0;
 	}
 	return 1;
 }
 
-static int psf2_write_ucvals(FILE *file, struct psf_font *psf, unsigned int numglyphs)
+/* decodes a psf1 unicode table from a buffer. Returns a pointer behind the
+ * table, or 0 on error.
+ */
+static const unsigned char *psf1_decode_ucvals(struct psf_font *psf, const unsigned char *ptr, const unsigned char *end, unsigned int numglyphs)
 {
-	char u8buf[8];
-	unsigned int i, ucv;
+	unsigned int i;
 	for (i = 0; i < numglyphs; ++i) {
-		for (ucv = 0; ucv < psf->glyph[i].nucvals; ++ucv) {
-			if (psf->glyph[i].ucvals[ucv] == PSF1_STARTSEQ) {
-				if (!psf_write_byte(file, PSF2_STARTSEQ)) { return 0; }
-			} else {
-				unsigned int len = mini_utf8_encode(psf->glyph[i].ucvals[ucv], u8buf, 8);
-				if (len <= 0) {
-					fprintf(stderr, "%s: invalid unicode value\n", __func__);
-					return 0;
-				}
-				if (fwrite(u8buf, 1, len, file) < len) {
-					perror(__func__);
-					return 0;
-				}
+		while (1) {
+			if (end - ptr < 2) {
+				fprintf(stderr, "%s: unexpected end of file\n", __func__);
+				return 0;
 			}
+			unsigned int ucval = ptr[0] + (ptr[1] << 8);
+			ptr += 2;
+			if (ucval == PSF1_SEPARATOR) { break; }
+			psf_glyph_adducval(psf, &psf->glyph[i], ucval);
 		}
-		if (!psf_write_byte(file, PSF2_SEPARATOR)) { return 0; }
 	}
-	return 1;
+	return ptr;
 }
 
-static int psf2_save_tofile(FILE *file, struct psf_font *psf)
+/* builds a font from a compressed font in memory */
+static struct psf_font *psfz_decode_font(const unsigned char *image, size_t size, const struct psf_allocator *alloc)
 {
-	int i;
-	for (i = 0; i < 4; ++i) {
-		if (!psf_write_byte(file, psf->header.psf2.magic[i])) { return 0; }
+	const unsigned char *offsets = psfz_check(image, size);
+	if (!offsets) { return 0; }
+	uint32_t flags = psf_get_int(image + 12), length = psf_get_int(image + 16);
+	uint32_t charsize = psf_get_int(image + 20), height = psf_get_int(image + 24);
+	uint32_t width = psf_get_int(image + 28), version = psf_get_int(image + 32);
+	uint32_t mode = psf_get_int(image + 36), datasize = psf_get_int(image + 40);
+	uint32_t osize = psf_get_int(image + 44);
+	if ((version == 1 && (mode > PSF1_MAXMODE || length != ((mode & PSF1_MODE512) ? 512 : 256)))
+		|| (version == 2 && charsize != ((width + 7) / 8) * height)) {
+		fprintf(stderr, "%s: invalid header\n", __func__);
+		return 0;
 	}
-	if (!psf_write_int(file, psf->header.psf2.version)) { return 0; }
-	if (!psf_write_int(file, psf->header.psf2.headersize)) { return 0; }
-	if (!psf_write_int(file, psf->header.psf2.flags)) { return 0; }
-	if (!psf_write_int(file, psf->header.psf2.length)) { return 0; }
-	if (!psf_write_int(file, psf->header.psf2.charsize)) { return 0; }
-	if (!psf_write_int(file, psf->header.psf2.height)) { return 0; }
-	if (!psf_write_int(file, psf->header.psf2.width)) { return 0; }
-
-	if (!psf_write_glyphs(file, psf, psf->header.psf2.length, psf->header.psf2.charsize)) {
+	struct psf_font *psf = psf_new_ex(version, width, height, alloc);
+	if (!psf) { return 0; }
+	int hastab;
+	if (version == 1) {
+		psf->header.psf1.mode = mode;
+		hastab = (mode & (PSF1_MODEHASTAB | PSF1_MODEHASSEQ)) != 0;
+	} else {
+		psf->header.psf2.flags = flags;
+		psf->header.psf2.length = length;
+		hastab = psf_hasunicodetable(psf);
+	}
+	psf_mem_free(&psf->alloc, psf->glyph);
+	psf->glyph = psf_mem_calloc(&psf->alloc, length, sizeof(struct psf_glyph));
+	psf->capacity = psf->glyph ? length : 0;
+	if (!psf->glyph) {
+		perror(__func__);
+		psf_delete(psf);
 		return 0;
 	}
 
-	if (psf->header.psf2.flags & PSF2_HAS_UNICODE_TABLE) {
-		if (!psf2_write_ucvals(file, psf, psf->header.psf2.length)) {
+	const unsigned char *data = offsets + osize * ((size_t) length + 1), *ptr = data + datasize;
+	unsigned int i;
+	for (i = 0; i < length; ++i) {
+		uint32_t start = psfz_offset(offsets, osize, i), end = psfz_offset(offsets, osize, (size_t) i + 1);
+		psf->glyph[i].data = psf_mem_alloc(&psf->alloc, charsize);
+		if (!psf->glyph[i].data) {
+			perror(__func__);
+			psf_delete(psf);
+			return 0;
+		}
+		if (start > end || end > datasize || !psfz_decode(data + start, data + end, charsize / height, height, psf->glyph[i].data)) {
+			fprintf(stderr, "%s: invalid glyph data\n", __func__);
+			psf_delete(psf);
 			return 0;
 		}
 	}
-
-	return 1;
-}
-
-int psf_save_tofile(FILE *file, struct psf_font *psf)
-{
-	int res = 0;
-	if (psf->version == 1) {
-		res = psf1_save_tofile(file, psf);
-	} else {
-		res = psf2_save_tofile(file, psf);
+	if (hastab && version == 1) {
+		ptr = psf1_decode_ucvals(psf, ptr, image + size, length);
+	} else if (hastab) {
+		ptr = psf2_decode_ucvals(psf, ptr, image + size, length);
 	}
-	return res;
+	if (!ptr) {
+		psf_delete(psf);
+		return 0;
+	}
+	return psf;
 }
 
-int psf_save(const char *filename, struct psf_font *psf)
+static struct psf_font *psfz_load_fromfile(FILE *file, const struct psf_allocator *alloc)
 {
-	FILE *file = fopen(filename, "wb");
-	if (!file) {
+	unsigned int size = 0;
+	unsigned char *rest = psf2_read_remaining_file(file, &size, alloc);
+	if (!rest) {
+		if (!ferror(file)) { fprintf(stderr, "%s: unexpected end of file\n", __func__); }
+		return 0;
+	}
+	/* the magic byte has already been read */
+	/* the padding keeps the utf8 decoder from reading past the end */
+	unsigned char *image = psf_mem_calloc(alloc, 1, (size_t) size + 1 + 4);
+	if (!image) {
 		perror(__func__);
+		psf_mem_free(alloc, rest);
 		return 0;
 	}
-	int res = psf_save_tofile(file, psf);
-	fclose(file);
-	return res;
+	image[0] = PSFZ_MAGIC0;
+	memcpy(&image[1], rest, size);
+	psf_mem_free(alloc, rest);
+	struct psf_font *psf = psfz_decode_font(image, (size_t) size + 1, alloc);
+	psf_mem_free(alloc, image);
+	return psf;
 }
 
-void psf_delete(struct psf_font *psf)
+#ifdef PSF_WITH_ZLIB
+
+/* streaming gzip layer. A psf_gzstream wraps a FILE handle and is itself
+ * exposed as a FILE handle through fopencookie(), so that the normal readers
+ * and writers work on compressed files without any temporary files.
+ */
+
+#define PSF_GZBUFSIZE 65536
+
+struct psf_gzstream {
+	FILE *file;
+	struct psf_allocator alloc;
+	z_stream zs;
+	int writing;
+	unsigned char buf[PSF_GZBUFSIZE];
+};
+
+static ssize_t psf_gz_read(void *cookie, char *buf, size_t size)
 {
-	if (psf->glyph) {
-		int i, nglyphs;
-		if (psf->version == 1) {
-			nglyphs = (psf->header.psf1.mode & PSF1_MODE512) ? 512 : 256;
-		} else {
-			nglyphs = psf->header.psf2.length;
+	struct psf_gzstream *gz = cookie;
+	gz->zs.next_out = (Bytef*) buf;
+	gz->zs.avail_out = size;
+	while (gz->zs.avail_out > 0) {
+		if (gz->zs.avail_in == 0) {
+			size_t nrd = fread(gz->buf, 1, PSF_GZBUFSIZE, gz->file);
+			if (nrd == 0) {
+				if (ferror(gz->file)) { return -1; }
+				break;
+			}
+			gz->zs.next_in = gz->buf;
+			gz->zs.avail_in = nrd;
 		}
-		for (i = 0; i < nglyphs; ++i) {
-			if (psf->glyph[i].data) { free(psf->glyph[i].data); }
-			if (psf->glyph[i].ucvals) { free(psf->glyph[i].ucvals); }
+		int rc = inflate(&gz->zs, Z_NO_FLUSH);
+		if (rc == Z_STREAM_END) {
+			/* there may be more members concatenated to this one */
+			if (inflateReset(&gz->zs) != Z_OK) { return -1; }
+		} else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+			fprintf(stderr, "%s: %s\n", __func__, gz->zs.msg ? gz->zs.msg : "inflate failed");
+			return -1;
 		}
-		free(psf->glyph);
 	}
-	free(psf);
+	return size - gz->zs.avail_out;
 }
 
-static int psf_reallocglyphs(struct psf_font *psf, unsigned int num)
+static int psf_gz_deflate(struct psf_gzstream *gz, int flush)
 {
-	int alloced = (psf->glyph != 0);
-	unsigned int ng = alloced ? psf_numglyphs(psf) : 0;
-
-	if (psf->version == 1) {
-		if (num > 512) {
-			fprintf(stderr, "%s: no more than 512 chars for a version 1 psf font\n", __func__);
-			return 0;
-		}
-		unsigned int nng = num <= 256 ? 256 : 512;
-		if (nng > ng) {
-			struct psf_glyph *newglyph = calloc(nng, sizeof(struct psf_glyph));
-			if (!newglyph) {
-				perror(__func__);
-				return 0;
-			}
-			if (alloced) {
-				/* this can only be true if 256 glyphs were allocated and the new size is 512 */
-				memcpy(newglyph, psf->glyph, 256 * sizeof(struct psf_glyph));
-				free(psf->glyph);
-			}
-			psf->glyph = newglyph;
-			if (nng == 512) {
-				psf->header.psf1.mode |= PSF1_MODE512;
-			}
-			return 1;
-		}
-	} else {
-		if (num > ng) {
-			struct psf_glyph *newglyph = calloc(num, sizeof(struct psf_glyph));
-			if (!newglyph) {
-				perror(__func__);
-				return 0;
-			}
-			if (alloced) {
-				memcpy(newglyph, psf->glyph, ng * sizeof(struct psf_glyph));
-				free(psf->glyph);
-			}
-			psf->glyph = newglyph;
-			psf->header.psf2.length = num;
-			return 1;
-		}
-	}
-	return 0;
+	int rc;
+	do {
+		gz->zs.next_out = gz->buf;
+		gz->zs.avail_out = PSF_GZBUFSIZE;
+		rc = deflate(&gz->zs, flush);
+		if (rc == Z_STREAM_ERROR) { return 0; }
+		size_t nwr = PSF_GZBUFSIZE - gz->zs.avail_out;
+		if (fwrite(gz->buf, 1, nwr, gz->file) != nwr) { return 0; }
+	} while (gz->zs.avail_out == 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+	return 1;
 }
 
-struct psf_glyph *psf_getglyph(struct psf_font *psf, unsigned int no)
+static ssize_t psf_gz_write(void *cookie, const char *buf, size_t size)
 {
-	if (no >= psf_numglyphs(psf)) {
-		return 0;
-	}
-	return &psf->glyph[no];
+	struct psf_gzstream *gz = cookie;
+	gz->zs.next_in = (Bytef*) buf;
+	gz->zs.avail_in = size;
+	if (!psf_gz_deflate(gz, Z_NO_FLUSH)) { return -1; }
+	return size;
 }
 
-struct psf_glyph *psf_addglyph(struct psf_font *psf, unsigned int no)
+static int psf_gz_close(void *cookie)
 {
-	if (no >= psf_numglyphs(psf)) {
-		if (!psf_reallocglyphs(psf, no + 1)) {
-			return 0;
-		}
+	struct psf_gzstream *gz = cookie;
+	int res = 0;
+	if (gz->writing) {
+		gz->zs.next_in = 0;
+		gz->zs.avail_in = 0;
+		res = psf_gz_deflate(gz, Z_FINISH) ? 0 : EOF;
+		deflateEnd(&gz->zs);
+	} else {
+		inflateEnd(&gz->zs);
 	}
-	psf_glyph_init(psf, &psf->glyph[no]);
-	return &psf->glyph[no];
+	struct psf_allocator alloc = gz->alloc;
+	psf_mem_free(&alloc, gz);
+	return res;
 }
 
-int psf_glyph_init(struct psf_font *psf, struct psf_glyph *glyph)
+/* zlib allocates its state through the allocator of the stream */
+static voidpf psf_gz_zalloc(voidpf opaque, uInt items, uInt size)
 {
-	if (glyph->data != 0) { free(glyph->data); }
-	if (glyph->ucvals != 0) { free(glyph->ucvals); }
-
-	unsigned int charsize = (psf->version == 1) ? psf->header.psf1.charsize : psf->header.psf2.charsize;
-	glyph->data = calloc(1, charsize);
-	glyph->nucvals = 0;
-	glyph->ucvals = 0;
-	return 1;
+	return psf_mem_calloc(opaque, items, size);
 }
 
-int psf_glyph_setpx(struct psf_font *psf, struct psf_glyph *glyph, unsigned int x, unsigned int y, unsigned int val)
+static void psf_gz_zfree(voidpf opaque, voidpf ptr)
 {
-	if (!glyph->data) { return 0; }
-	unsigned int w = psf_width(psf);
-	unsigned int h = psf_height(psf);
-	if (x >= w || y >= h) { return 0; }
-	unsigned int byte = y * ((w + 7) >> 3) + (x >> 3);
-	unsigned int mask = 0x80 >> (x & 7);
-	if (val) {
-		glyph->data[byte] |= mask;
-	} else {
-		glyph->data[byte] &= ~mask;
-	}
-	return 1;
+	psf_mem_free(opaque, ptr);
 }
 
-int psf_glyph_getpx(struct psf_font *psf, struct psf_glyph *glyph, unsigned int x, unsigned int y)
+/* opens a gzip (de)compressing stream on top of file, with its buffers
+ * taken from alloc. Closing the returned handle does not close file.
+ */
+static FILE *psf_gzopen(FILE *file, int writing, const struct psf_allocator *alloc)
 {
-	if (!glyph->data) { return 0; }
-	unsigned int w = psf_width(psf);
-	unsigned int h = psf_height(psf);
-	if (x >= w || y >= h) { return 0; }
-	unsigned int byte = y * ((w + 7) >> 3) + (x >> 3);
-	unsigned int mask = 0x80 >> (x & 7);
-	return (glyph->data[byte] & mask) == 0;
+	struct psf_gzstream *gz = psf_mem_calloc(alloc, 1, sizeof(struct psf_gzstream));
+	if (!gz) {
+		perror(__func__);
+		return 0;
+	}
+	gz->file = file;
+	gz->alloc = *alloc;
+	gz->writing = writing;
+	gz->zs.zalloc = psf_gz_zalloc;
+	gz->zs.zfree = psf_gz_zfree;
+	gz->zs.opaque = &gz->alloc;
+	/* window bits + 16 selects the gzip wrapper instead of zlib */
+	int rc = writing ? deflateInit2(&gz->zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) : inflateInit2(&gz->zs, 15 + 16);
+	if (rc != Z_OK) {
+		fprintf(stderr, "%s: could not initialize zlib\n", __func__);
+		psf_mem_free(alloc, gz);
+		return 0;
+	}
+	cookie_io_functions_t io = { psf_gz_read, psf_gz_write, 0, psf_gz_close };
+	FILE *res = fopencookie(gz, writing ? "wb" : "rb", io);
+	if (!res) {
+		perror(__func__);
+		if (writing) { deflateEnd(&gz->zs); } else { inflateEnd(&gz->zs); }
+		psf_mem_free(alloc, gz);
+	}
+	return res;
 }
 
-int psf_glyph_adducval(struct psf_font *psf, struct psf_glyph *glyph, unsigned int uni)
+#endif /* PSF_WITH_ZLIB */
+
+struct psf_font *psf_load_fromfile(FILE* file)
 {
-	if (psf->version == 1 && uni > 0xFFFF) {
-		fprintf(stderr, "%s: unicode value too big for psf1\n", __func__);
-		return 0;
+	return psf_load_fromfile_ex(file, 0);
+}
+
+struct psf_font *psf_load_fromfile_ex(FILE* file, const struct psf_allocator *alloc)
+{
+	struct psf_font *res = 0;
+	int byte = fgetc(file);
+	if (!alloc) { alloc = &psf_std_allocator; }
+	if (byte == PSF1_MAGIC0) {
+		res = psf1_load_fromfile(file, alloc);
+	} else if (byte == PSF2_MAGIC0) {
+		res = psf2_load_fromfile(file, alloc);
+	} else if (byte == PSFZ_MAGIC0) {
+		res = psfz_load_fromfile(file, alloc);
+	} else if (byte == PSF_GZIP_MAGIC0) {
+#ifdef PSF_WITH_ZLIB
+		ungetc(byte, file);
+		FILE *gz = psf_gzopen(file, 0, alloc);
+		if (gz) {
+			res = psf_load_fromfile_ex(gz, alloc);
+			fclose(gz);
+		}
+#else
+		fprintf(stderr, "%s: gzip compressed fonts are not supported", __func__);
+#endif
+	} else {
+		fprintf(stderr, "%s: invalid magic number", __func__);
 	}
-	unsigned int newnucvals = glyph->nucvals + 1;
-	unsigned int *newucvals = calloc(newnucvals, sizeof(unsigned int));
-	if (!newucvals) {
+	return res;
+}
+
+struct psf_font *psf_load(const char* filename)
+{
+	return psf_load_ex(filename, 0);
+}
+
+struct psf_font *psf_load_ex(const char* filename, const struct psf_allocator *alloc)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file) {
 		perror(__func__);
 		return 0;
 	}
-	if (glyph->ucvals) {
-		memcpy(newucvals, glyph->ucvals, glyph->nucvals * sizeof(unsigned int));
-		free(glyph->ucvals);
+	struct psf_font *res = psf_load_fromfile_ex(file, alloc);
+	fclose(file);
+	return res;
+}
+
+/* parses the header of a font in hdr, which has size bytes of it */
+static int psf_probe_header(const unsigned char *hdr, size_t size, struct psf_info *info)
+{
+	if (size >= sizeof(struct psf1_header) && hdr[0] == PSF1_MAGIC0 && hdr[1] == PSF1_MAGIC1) {
+		info->version = 1;
+		info->width = 8;
+		info->height = info->charsize = hdr[3];
+		info->length = hdr[2] & PSF1_MODE512 ? 512 : 256;
+		info->hasunicodetable = (hdr[2] & PSF1_MODEHASTAB) != 0;
+	} else if (size >= sizeof(struct psf2_header) && hdr[0] == PSF2_MAGIC0 && hdr[1] == PSF2_MAGIC1
+		&& hdr[2] == PSF2_MAGIC2 && hdr[3] == PSF2_MAGIC3) {
+		info->version = 2;
+		info->hasunicodetable = (psf_get_int(hdr + 12) & PSF2_HAS_UNICODE_TABLE) != 0;
+		info->length = psf_get_int(hdr + 16);
+		info->charsize = psf_get_int(hdr + 20);
+		info->height = psf_get_int(hdr + 24);
+		info->width = psf_get_int(hdr + 28);
+	} else if (size >= PSFZ_HEADERSIZE && hdr[0] == PSFZ_MAGIC0 && hdr[1] == PSFZ_MAGIC1
+		&& hdr[2] == PSFZ_MAGIC2 && hdr[3] == PSFZ_MAGIC3) {
+		info->container = PSF_PSFZ;
+		info->length = psf_get_int(hdr + 16);
+		info->charsize = psf_get_int(hdr + 20);
+		info->height = psf_get_int(hdr + 24);
+		info->width = psf_get_int(hdr + 28);
+		info->version = psf_get_int(hdr + 32);
+		if (info->version == 1) {
+			info->hasunicodetable = (psf_get_int(hdr + 36) & PSF1_MODEHASTAB) != 0;
+		} else {
+			info->hasunicodetable = (psf_get_int(hdr + 12) & PSF2_HAS_UNICODE_TABLE) != 0;
+		}
+	} else {
+		return 0;
 	}
-	glyph->ucvals = newucvals;
-	glyph->nucvals = newnucvals;
-	glyph->ucvals[newnucvals - 1] = uni;
-	if (psf->version == 1) {
-		psf->header.psf1.mode |= PSF1_MODEHASTAB;
-		if (uni == PSF1_STARTSEQ) {
-			psf->header.psf1.mode |= PSF1_MODEHASSEQ;
+	/* the same checks as the loaders: psf2_read_header takes any charsize,
+	 * so padded glyphs are fine, the compressed container wants them exact
+	 */
+	return (info->version == 1 || info->version == 2) && info->width > 0 && info->height > 0
+		&& (info->container != PSF_PSFZ || (info->charsize % info->height == 0
+			&& (info->version == 1 || info->charsize == (info->width + 7) / 8 * info->height)));
+}
+
+int psf_probe(const char *filename, struct psf_info *info)
+{
+	unsigned char hdr[PSFZ_HEADERSIZE];
+	memset(info, 0, sizeof(struct psf_info));
+	FILE *file = fopen(filename, "rb");
+	if (!file) { return 0; }
+	size_t size = fread(hdr, 1, sizeof(hdr), file);
+#ifdef PSF_WITH_ZLIB
+	if (size >= 2 && hdr[0] == PSF_GZIP_MAGIC0 && hdr[1] == PSF_GZIP_MAGIC1 && fseek(file, 0, SEEK_SET) == 0) {
+		FILE *gz = psf_gzopen(file, 0, &psf_std_allocator);
+		if (!gz) {
+			fclose(file);
+			return 0;
+		}
+		size = fread(hdr, 1, sizeof(hdr), gz);
+		fclose(gz);
+		fclose(file);
+		int res = psf_probe_header(hdr, size, info);
+		info->container = PSF_GZIP;
+		return res;
+	}
+#endif
+	fclose(file);
+	return psf_probe_header(hdr, size, info);
+}
+
+/* streaming reader. If the font has a unicode table, the entries for a glyph
+ * come after all bitmaps. In a seekable file, the reader keeps two positions,
+ * one in the bitmaps and one in the table, and reads the table through a
+ * buffer of its own so that it seeks only when that runs empty. From a pipe,
+ * the bitmaps are first copied to a temporary file.
+ */
+
+#define PSF_READER_BUFSIZE 4096
+
+static int psf_reader_hastab(struct psf_reader *rd)
+{
+	if (rd->psf->version == 1) {
+		return (rd->psf->header.psf1.mode & (PSF1_MODEHASTAB | PSF1_MODEHASSEQ)) != 0;
+	}
+	return psf_hasunicodetable(rd->psf);
+}
+
+struct psf_reader *psf_reader_open(FILE *file)
+{
+	return psf_reader_open_ex(file, 0);
+}
+
+struct psf_reader *psf_reader_open_ex(FILE *file, const struct psf_allocator *alloc)
+{
+	if (!alloc) { alloc = &psf_std_allocator; }
+	struct psf_reader *rd = psf_mem_calloc(alloc, 1, sizeof(struct psf_reader));
+	if (!rd) {
+		perror(__func__);
+		return 0;
+	}
+	rd->alloc = *alloc;
+	rd->file = file;
+	int byte = fgetc(file);
+	if (byte == PSF_GZIP_MAGIC0) {
+#ifdef PSF_WITH_ZLIB
+		ungetc(byte, file);
+		rd->gz = psf_gzopen(file, 0, alloc);
+		if (!rd->gz) {
+			psf_mem_free(alloc, rd);
+			return 0;
 		}
+		rd->file = rd->gz;
+		byte = fgetc(rd->file);
+#else
+		fprintf(stderr, "%s: gzip compressed fonts are not supported\n", __func__);
+		psf_mem_free(alloc, rd);
+		return 0;
+#endif
+	}
+	if (byte == PSF1_MAGIC0) {
+		rd->psf = psf1_read_header(rd->file, alloc);
+	} else if (byte == PSF2_MAGIC0) {
+		rd->psf = psf2_read_header(rd->file, alloc);
+	} else if (byte == PSFZ_MAGIC0) {
+		/* the offset table comes first, so these are loaded whole */
+		rd->psf = psfz_load_fromfile(rd->file, alloc);
+		rd->whole = 1;
 	} else {
-		psf->header.psf2.flags |= PSF2_HAS_UNICODE_TABLE;
+		fprintf(stderr, "%s: invalid magic number\n", __func__);
+	}
+	if (!rd->psf) {
+		psf_reader_close(rd);
+		return 0;
 	}
+	if (rd->whole) { return rd; }
 
+	/* the header font has no glyphs, it is only for the properties */
+	psf_mem_free(&rd->psf->alloc, rd->psf->glyph);
+	rd->psf->glyph = 0;
+	rd->psf->capacity = 0;
+
+	size_t charsize = psf_charsize(rd->psf), left = charsize * psf_numglyphs(rd->psf);
+	rd->glyph.data = psf_mem_alloc(alloc, charsize);
+	if (!rd->glyph.data) {
+		perror(__func__);
+		psf_reader_close(rd);
+		return 0;
+	}
+	if (!psf_reader_hastab(rd)) { return rd; }
+
+	rd->glyphpos = ftell(rd->file);
+	if (rd->glyphpos >= 0 && fseek(rd->file, rd->glyphpos + (long) left, SEEK_SET) == 0) {
+		rd->tabpos = rd->glyphpos + (long) left;
+		rd->seeked = 1;
+		rd->tbuf = psf_mem_alloc(alloc, PSF_READER_BUFSIZE);
+		if (!rd->tbuf) {
+			perror(__func__);
+			psf_reader_close(rd);
+			return 0;
+		}
+		return rd;
+	}
+
+	/* not seekable, spill the bitmaps */
+	unsigned char buf[BUFSIZ];
+	rd->spill = tmpfile();
+	if (!rd->spill) {
+		perror(__func__);
+		psf_reader_close(rd);
+		return 0;
+	}
+	while (left > 0) {
+		size_t n = left < BUFSIZ ? left : BUFSIZ;
+		if (fread(buf, 1, n, rd->file) != n) {
+			fprintf(stderr, "%s: unexpected end of file\n", __func__);
+			psf_reader_close(rd);
+			return 0;
+		}
+		if (fwrite(buf, 1, n, rd->spill) != n) {
+			perror(__func__);
+			psf_reader_close(rd);
+			return 0;
+		}
+		left -= n;
+	}
+	if (fflush(rd->spill) != 0 || fseek(rd->spill, 0, SEEK_SET) != 0) {
+		perror(__func__);
+		psf_reader_close(rd);
+		return 0;
+	}
+	return rd;
+}
+
+/* returns the next byte of the unicode table, or EOF */
+static int psf_reader_tabbyte(struct psf_reader *rd)
+{
+	if (!rd->tbuf) { return fgetc(rd->file); }
+	if (rd->tpos == rd->tlen) {
+		if (fseek(rd->file, rd->tabpos, SEEK_SET) != 0) { return EOF; }
+		rd->tlen = fread(rd->tbuf, 1, PSF_READER_BUFSIZE, rd->file);
+		rd->tpos = 0;
+		rd->tabpos += (long) rd->tlen;
+		rd->seeked = 1;
+		if (rd->tlen == 0) { return EOF; }
+	}
+	return rd->tbuf[rd->tpos++];
+}
+
+static int psf_reader_adducval(struct psf_reader *rd, unsigned int ucval)
+{
+	if (rd->glyph.nucvals == rd->ucvcap) {
+		unsigned int ncap = rd->ucvcap ? rd->ucvcap * 2 : 8;
+		unsigned int *nucvals = psf_mem_realloc(&rd->alloc, rd->glyph.ucvals, rd->ucvcap * sizeof(unsigned int), ncap * sizeof(unsigned int));
+		if (!nucvals) {
+			perror(__func__);
+			return 0;
+		}
+		rd->glyph.ucvals = nucvals;
+		rd->ucvcap = ncap;
+	}
+	rd->glyph.ucvals[rd->glyph.nucvals++] = ucval;
 	return 1;
 }
 
-unsigned int psf_numglyphs(struct psf_font *psf)
+/* reads the unicode table entries of the next glyph */
+static int psf_reader_ucvals(struct psf_reader *rd)
 {
-	if (psf->version == 1) {
-		return psf->header.psf1.mode & PSF1_MODE512 ? 512 : 256;
+	int byte, i;
+	rd->glyph.nucvals = 0;
+	while (1) {
+		unsigned int ucval;
+		if ((byte = psf_reader_tabbyte(rd)) == EOF) { break; }
+		if (rd->psf->version == 1) {
+			int byte1 = psf_reader_tabbyte(rd);
+			if (byte1 == EOF) { break; }
+			ucval = (unsigned int) byte | ((unsigned int) byte1 << 8);
+			if (ucval == PSF1_SEPARATOR) { return 1; }
+		} else if (byte == PSF2_SEPARATOR) {
+			return 1;
+		} else if (byte == PSF2_STARTSEQ) {
+			ucval = PSF1_STARTSEQ;
+		} else {
+			/* collect the whole utf8 char, the padding stops the decoder */
+			char buf[8] = { (char) byte };
+			const char *ptr = buf;
+			int len = byte < 0x80 ? 1 : byte < 0xe0 ? 2 : byte < 0xf0 ? 3 : 4;
+			for (i = 1; i < len; ++i) {
+				if ((byte = psf_reader_tabbyte(rd)) == EOF) { break; }
+				buf[i] = (char) byte;
+			}
+			if (byte == EOF) { break; }
+			int cp = mini_utf8_decode(&ptr);
+			if (cp < 0 || ptr != buf + len) {
+				fprintf(stderr, "%s: invalid utf8 char\n", __func__);
+				return 0;
+			}
+			ucval = (unsigned int) cp & 0x1FFFFF;
+		}
+		if (!psf_reader_adducval(rd, ucval)) { return 0; }
+	}
+	if (rd->tbuf || !ferror(rd->file)) {
+		fprintf(stderr, "%s: unexpected end of file\n", __func__);
 	} else {
-		return psf->header.psf2.length;
+		perror(__func__);
 	}
+	return 0;
 }
 
-unsigned int psf_hasunicodetable(struct psf_font *psf)
+struct psf_glyph *psf_reader_next(struct psf_reader *rd)
+{
+	if (rd->next >= psf_numglyphs(rd->psf)) { return 0; }
+	if (rd->whole) { return &rd->psf->glyph[rd->next++]; }
+
+	size_t charsize = psf_charsize(rd->psf);
+	FILE *src = rd->spill ? rd->spill : rd->file;
+	if (psf_reader_hastab(rd) && !psf_reader_ucvals(rd)) { return 0; }
+	if (rd->tbuf && rd->seeked) {
+		if (fseek(rd->file, rd->glyphpos, SEEK_SET) != 0) {
+			perror(__func__);
+			return 0;
+		}
+		rd->seeked = 0;
+	}
+	if (fread(rd->glyph.data, 1, charsize, src) != charsize) {
+		fprintf(stderr, "%s: unexpected end of file\n", __func__);
+		return 0;
+	}
+	rd->glyphpos += (long) charsize;
+	++rd->next;
+	return &rd->glyph;
+}
+
+void psf_reader_close(struct psf_reader *rd)
+{
+	if (rd->psf) { psf_delete(rd->psf); }
+	if (rd->spill) { fclose(rd->spill); }
+	if (rd->gz) { fclose(rd->gz); }
+	struct psf_allocator alloc = rd->alloc;
+	psf_mem_free(&alloc, rd->glyph.data);
+	psf_mem_free(&alloc, rd->glyph.ucvals);
+	psf_mem_free(&alloc, rd->tbuf);
+	psf_mem_free(&alloc, rd);
+}
+
+/* the writers first serialize the header and unicode table into buffers,
+ * so that a font is written with a few large writes straight from the glyph
+ * storage.
+ */
+
+#define PSF_MAXHEADERSIZE 32
+
+static unsigned int psf_encode_header(struct psf_font *psf, unsigned char *buf)
 {
 	if (psf->version == 1) {
-		return (psf->header.psf1.mode & PSF1_MODEHASTAB) != 0;
-	} else {
-		return (psf->header.psf2.flags & PSF2_HAS_UNICODE_TABLE) != 0;
+		buf[0] = psf->header.psf1.magic[0];
+		buf[1] = psf->header.psf1.magic[1];
+		buf[2] = psf->header.psf1.mode;
+		buf[3] = psf->header.psf1.charsize;
+		return 4;
+	}
+	memcpy(buf, psf->header.psf2.magic, 4);
+	psf_put_int(&buf[4], psf->header.psf2.version);
+	psf_put_int(&buf[8], psf->header.psf2.headersize);
+	psf_put_int(&buf[12], psf->header.psf2.flags);
+	psf_put_int(&buf[16], psf->header.psf2.length);
+	psf_put_int(&buf[20], psf->header.psf2.charsize);
+	psf_put_int(&buf[24], psf->header.psf2.height);
+	psf_put_int(&buf[28], psf->header.psf2.width);
+	return 32;
+}
+
+/* encodes the unicode table into a newly allocated buffer. Returns the buffer
+ * and stores its size in *size, or returns 0 on error. If the font does not
+ * need a unicode table, *size is 0.
+ */
+static unsigned char *psf_encode_ucvals(struct psf_font *psf, size_t *size)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), i, ucv;
+	size_t maxsize = 0, pos = 0;
+
+	*size = 0;
+	int hastab = psf->version == 1 ? (psf->header.psf1.mode & (PSF1_MODEHASTAB | PSF1_MODEHASSEQ)) != 0 : psf_hasunicodetable(psf);
+	/* worst case is 4 bytes for an utf8 char, 2 bytes per separator */
+	for (i = 0; i < numglyphs; ++i) {
+		maxsize += 4 * psf->glyph[i].nucvals + 2;
+	}
+	unsigned char *buf = psf_mem_alloc(&psf->alloc, maxsize);
+	if (!buf) {
+		perror(__func__);
+		return 0;
+	}
+	if (!hastab) { return buf; }
+
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		for (ucv = 0; ucv < glyph->nucvals; ++ucv) {
+			if (psf->version == 1) {
+				psf_put_word(&buf[pos], glyph->ucvals[ucv]);
+				pos += 2;
+			} else if (glyph->ucvals[ucv] == PSF1_STARTSEQ) {
+				buf[pos++] = PSF2_STARTSEQ;
+			} else {
+				int len = mini_utf8_encode(glyph->ucvals[ucv], (char*) &buf[pos], 4);
+				if (len <= 0) {
+					fprintf(stderr, "%s: invalid unicode value\n", __func__);
+					psf_mem_free(&psf->alloc, buf);
+					return 0;
+				}
+				pos += len;
+			}
+		}
+		if (psf->version == 1) {
+			psf_put_word(&buf[pos], PSF1_SEPARATOR);
+			pos += 2;
+		} else {
+			buf[pos++] = PSF2_SEPARATOR;
+		}
+	}
+	*size = pos;
+	return buf;
+}
+
+/* calls fn(data, len, ud) for every contiguous range of glyph bitmaps, in
+ * order. Glyphs without a bitmap are passed as zero.
+ */
+static int psf_foreach_bitmap_range(struct psf_font *psf, const unsigned char *zero, int (*fn)(const unsigned char*, size_t, void*), void *ud)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), charsize = psf_charsize(psf), i;
+	const unsigned char *start = 0;
+	size_t len = 0;
+	for (i = 0; i < numglyphs; ++i) {
+		const unsigned char *data = psf->glyph[i].data ? psf->glyph[i].data : zero;
+		if (start && data == start + len && data != zero) {
+			len += charsize;
+			continue;
+		}
+		if (start && !fn(start, len, ud)) { return 0; }
+		start = data;
+		len = charsize;
+	}
+	if (start && !fn(start, len, ud)) { return 0; }
+	return 1;
+}
+
+static int psf_fwrite_range(const unsigned char *data, size_t len, void *ud)
+{
+	if (fwrite(data, 1, len, (FILE*) ud) != len) {
+		perror("psf_save_tofile");
+		return 0;
+	}
+	return 1;
+}
+
+int psf_save_tofile(FILE *file, struct psf_font *psf)
+{
+	unsigned char header[PSF_MAXHEADERSIZE];
+	unsigned int hdrsize = psf_encode_header(psf, header);
+	if (fwrite(header, 1, hdrsize, file) != hdrsize) {
+		perror(__func__);
+		return 0;
+	}
+
+	size_t ucsize = 0;
+	unsigned char *ucbuf = psf_encode_ucvals(psf, &ucsize);
+	unsigned char *zero = psf_mem_calloc(&psf->alloc, 1, psf_charsize(psf));
+	size_t idxsize = 0;
+	unsigned char *idxbuf = psf_encode_index(psf, hdrsize + (size_t) psf_numglyphs(psf) * psf_charsize(psf) + ucsize, &idxsize);
+	int res = ucbuf && zero && psf_foreach_bitmap_range(psf, zero, psf_fwrite_range, file);
+	if (res && ucsize > 0 && fwrite(ucbuf, 1, ucsize, file) != ucsize) {
+		perror(__func__);
+		res = 0;
+	}
+	if (res && idxsize > 0 && fwrite(idxbuf, 1, idxsize, file) != idxsize) {
+		perror(__func__);
+		res = 0;
+	}
+	psf_mem_free(&psf->alloc, idxbuf);
+	psf_mem_free(&psf->alloc, zero);
+	psf_mem_free(&psf->alloc, ucbuf);
+	return res;
+}
+
+/* writer for the compressed container */
+
+/* longest glyph header, two varints for 32 bit values */
+#define PSFZ_MAXGLYPHHDR 10
+
+/* PSFZ_ROWS encoding of len bytes of rows, into buf. Returns the size. */
+static size_t psfz_encode_rows(const unsigned char *rows, size_t len, unsigned int rowsize, unsigned char *buf)
+{
+	size_t pos = 0, y = 0, nrows = len / rowsize, n;
+	while (y < nrows) {
+		const unsigned char *row = &rows[y * rowsize];
+		if (y > 0 && memcmp(row, row - rowsize, rowsize) == 0) {
+			for (n = 1; n < 128 && y + n < nrows && memcmp(row + n * rowsize, row, rowsize) == 0; ++n) {}
+			buf[pos++] = 0x80 | (n - 1);
+		} else {
+			for (n = 1; n < 128 && y + n < nrows && memcmp(row + n * rowsize, row + (n - 1) * rowsize, rowsize) != 0; ++n) {}
+			buf[pos++] = n - 1;
+			memcpy(&buf[pos], row, n * rowsize);
+			pos += n * rowsize;
+		}
+		y += n;
+	}
+	return pos;
+}
+
+/* PSFZ_XOR encoding of len bytes of rows, into buf. Returns the size. */
+static size_t psfz_encode_xor(const unsigned char *rows, size_t len, unsigned int rowsize, unsigned char *buf)
+{
+	size_t pos = 0, i = 0, n;
+#define PSFZ_XORBYTE(k) ((k) < rowsize ? rows[k] : rows[k] ^ rows[(k) - rowsize])
+	while (i < len) {
+		if (PSFZ_XORBYTE(i) == 0 && i + 1 < len && PSFZ_XORBYTE(i + 1) == 0) {
+			for (n = 2; n < 128 && i + n < len && PSFZ_XORBYTE(i + n) == 0; ++n) {}
+			buf[pos++] = 0x80 | (n - 1);
+		} else {
+			/* single zero bytes are cheaper to store than to skip */
+			size_t start = pos++;
+			for (n = 0; n < 128 && i + n < len; ++n) {
+				if (n > 0 && PSFZ_XORBYTE(i + n) == 0 && i + n + 1 < len && PSFZ_XORBYTE(i + n + 1) == 0) { break; }
+				buf[pos++] = PSFZ_XORBYTE(i + n);
+			}
+			buf[start] = n - 1;
+		}
+		i += n;
+	}
+#undef PSFZ_XORBYTE
+	return pos;
+}
+
+/* encodes the bitmap of a glyph into buf, which must have room for
+ * charsize + PSFZ_MAXGLYPHHDR bytes. tmp is for trying out the methods and
+ * must have room for 4 * charsize bytes. Returns the size, 0 for a blank
+ * glyph.
+ */
+static size_t psfz_encode(const unsigned char *data, unsigned int rowsize, unsigned int height, unsigned char *buf, unsigned char *tmp)
+{
+	unsigned int first = 0, last = height, y;
+	for (; first < height; ++first) {
+		for (y = 0; y < rowsize && data[first * rowsize + y] == 0; ++y) {}
+		if (y < rowsize) { break; }
+	}
+	if (first == height) { return 0; }
+	for (; last > first; --last) {
+		for (y = 0; y < rowsize && data[(last - 1) * rowsize + y] == 0; ++y) {}
+		if (y < rowsize) { break; }
+	}
+
+	const unsigned char *rows = data + (size_t) first * rowsize, *best = rows;
+	size_t len = (size_t) (last - first) * rowsize, size = len;
+	unsigned int method = PSFZ_RAW;
+	/* both encodings take at most twice the space of the rows */
+	size_t rowslen = psfz_encode_rows(rows, len, rowsize, tmp);
+	if (rowslen < size) {
+		method = PSFZ_ROWS;
+		size = rowslen;
+		best = tmp;
+	}
+	size_t xorlen = psfz_encode_xor(rows, len, rowsize, tmp + 2 * len);
+	if (xorlen < size) {
+		method = PSFZ_XOR;
+		size = xorlen;
+		best = tmp + 2 * len;
+	}
+	unsigned int hdrlen = psf_putvarint(buf, first << 2 | method);
+	hdrlen += psf_putvarint(&buf[hdrlen], last - first);
+	memcpy(&buf[hdrlen], best, size);
+	return hdrlen + size;
+}
+
+int psf_save_compressed_tofile(FILE *file, struct psf_font *psf)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), charsize = psf_charsize(psf), height = psf_height(psf), i;
+	unsigned char header[PSFZ_HEADERSIZE];
+	size_t ucsize = 0, datasize = 0;
+	unsigned char *ucbuf = psf_encode_ucvals(psf, &ucsize);
+	const struct psf_allocator *alloc = &psf->alloc;
+	uint32_t *offset = psf_mem_alloc(alloc, ((size_t) numglyphs + 1) * sizeof(uint32_t));
+	unsigned char *offsets = psf_mem_alloc(alloc, 4 * ((size_t) numglyphs + 1));
+	unsigned char *zero = psf_mem_calloc(alloc, 1, charsize);
+	unsigned char *tmp = psf_mem_alloc(alloc, 4 * (size_t) charsize);
+	unsigned char *data = psf_mem_alloc(alloc, (size_t) numglyphs * (charsize + PSFZ_MAXGLYPHHDR) + 1);
+	int res = ucbuf && offset && offsets && zero && tmp && data;
+	if (!res && ucbuf) { perror(__func__); }
+
+	for (i = 0; res && i < numglyphs; ++i) {
+		const unsigned char *bitmap = psf->glyph[i].data ? psf->glyph[i].data : zero;
+		offset[i] = datasize;
+		datasize += psfz_encode(bitmap, charsize / height, height, &data[datasize], tmp);
+		if (datasize > 0xffffffffU) {
+			fprintf(stderr, "%s: font too large\n", __func__);
+			res = 0;
+		}
+	}
+	/* small fonts get by with 16 bit offsets */
+	unsigned int osize = datasize <= 0xffff ? 2 : 4;
+	if (res) {
+		offset[numglyphs] = datasize;
+		for (i = 0; i <= numglyphs; ++i) {
+			if (osize == 2) {
+				psf_put_word(&offsets[2 * i], offset[i]);
+			} else {
+				psf_put_int(&offsets[4 * i], offset[i]);
+			}
+		}
+		header[0] = PSFZ_MAGIC0;
+		header[1] = PSFZ_MAGIC1;
+		header[2] = PSFZ_MAGIC2;
+		header[3] = PSFZ_MAGIC3;
+		psf_put_int(&header[4], PSFZ_VERSION);
+		psf_put_int(&header[8], PSFZ_HEADERSIZE);
+		psf_put_int(&header[12], psf->version == 1 ? 0 : psf->header.psf2.flags);
+		psf_put_int(&header[16], numglyphs);
+		psf_put_int(&header[20], charsize);
+		psf_put_int(&header[24], height);
+		psf_put_int(&header[28], psf_width(psf));
+		psf_put_int(&header[32], psf->version);
+		psf_put_int(&header[36], psf->version == 1 ? psf->header.psf1.mode : 0);
+		psf_put_int(&header[40], datasize);
+		psf_put_int(&header[44], osize);
 	}
+	if (res && (fwrite(header, 1, PSFZ_HEADERSIZE, file) != PSFZ_HEADERSIZE
+		|| fwrite(offsets, osize, (size_t) numglyphs + 1, file) != (size_t) numglyphs + 1
+		|| fwrite(data, 1, datasize, file) != datasize
+		|| fwrite(ucbuf, 1, ucsize, file) != ucsize)) {
+		perror(__func__);
+		res = 0;
+	}
+	psf_mem_free(alloc, data);
+	psf_mem_free(alloc, tmp);
+	psf_mem_free(alloc, zero);
+	psf_mem_free(alloc, offsets);
+	psf_mem_free(alloc, offset);
+	psf_mem_free(alloc, ucbuf);
+	return res;
+}
+
+static int psf_isgzname(const char *filename)
+{
+	size_t len = strlen(filename);
+	return len > 3 && strcmp(&filename[len - 3], ".gz") == 0;
 }
+
+#ifdef PSF_POSIX
+
+/* collects the bitmap ranges into the iovec array pointed to by ud */
+struct psf_iovecs {
+	struct iovec *iov;
+	int n;
+};
+
+static int psf_iovec_range(const unsigned char *data, size_t len, void *ud)
+{
+	struct psf_iovecs *iovs = ud;
+	iovs->iov[iovs->n].iov_base = (void*) data;
+	iovs->iov[iovs->n].iov_len = len;
+	++iovs->n;
+	return 1;
+}
+
+static int psf_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t nwr = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+		if (nwr < 0) {
+			if (errno == EINTR) { continue; }
+			return 0;
+		}
+		/* skip what was written, continue with the rest */
+		while (iovcnt > 0 && (size_t) nwr >= iov->iov_len) {
+			nwr -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (nwr > 0) {
+			iov->iov_base = (char*) iov->iov_base + nwr;
+			iov->iov_len -= nwr;
+		}
+	}
+	return 1;
+}
+
+/* writes a font to a file descriptor using writev(). */
+static int psf_save_tofd(int fd, struct psf_font *psf)
+{
+	unsigned char header[PSF_MAXHEADERSIZE];
+	unsigned int numglyphs = psf_numglyphs(psf);
+	size_t ucsize = 0;
+	unsigned char *ucbuf = psf_encode_ucvals(psf, &ucsize);
+	unsigned char *zero = psf_mem_calloc(&psf->alloc, 1, psf_charsize(psf));
+	unsigned int hdrsize = psf_encode_header(psf, header);
+	size_t idxsize = 0;
+	unsigned char *idxbuf = psf_encode_index(psf, hdrsize + (size_t) numglyphs * psf_charsize(psf) + ucsize, &idxsize);
+	struct psf_iovecs iovs;
+	iovs.iov = psf_mem_alloc(&psf->alloc, ((size_t) numglyphs + 3) * sizeof(struct iovec));
+	iovs.n = 0;
+	int res = 0;
+	if (ucbuf && zero && iovs.iov) {
+		psf_iovec_range(header, hdrsize, &iovs);
+		psf_foreach_bitmap_range(psf, zero, psf_iovec_range, &iovs);
+		if (ucsize > 0) {
+			psf_iovec_range(ucbuf, ucsize, &iovs);
+		}
+		if (idxsize > 0) {
+			psf_iovec_range(idxbuf, idxsize, &iovs);
+		}
+		res = psf_writev_all(fd, iovs.iov, iovs.n);
+		if (!res) { perror(__func__); }
+	} else if (ucbuf) {
+		perror(__func__);
+	}
+	psf_mem_free(&psf->alloc, iovs.iov);
+	psf_mem_free(&psf->alloc, idxbuf);
+	psf_mem_free(&psf->alloc, zero);
+	psf_mem_free(&psf->alloc, ucbuf);
+	return res;
+}
+
+/* writes the font with save into a temp file next to filename, and then
+ * renames that to filename, so that nobody ever sees a partially written font.
+ * If filename is a symlink, the file it points to is replaced. A file that is
+ * replaced keeps its mode, and its owner if we may set that.
+ */
+static int psf_save_atomic(const char *filename, struct psf_font *psf, int (*save)(FILE*, struct psf_font*))
+{
+	char target[PATH_MAX];
+	if (realpath(filename, target)) { filename = target; }
+	size_t len = strlen(filename);
+	char *tmpname = psf_mem_alloc(&psf->alloc, len + 8);
+	if (!tmpname) {
+		perror(__func__);
+		return 0;
+	}
+	memcpy(tmpname, filename, len);
+	memcpy(&tmpname[len], ".XXXXXX", 8);
+	int fd = mkstemp(tmpname);
+	if (fd < 0) {
+		perror(__func__);
+		psf_mem_free(&psf->alloc, tmpname);
+		return 0;
+	}
+	struct stat st;
+	if (stat(filename, &st) == 0) {
+		if (fchown(fd, st.st_uid, st.st_gid) != 0) {
+			/* only root may give files away, keep the group if we can */
+			if (fchown(fd, (uid_t) -1, st.st_gid) != 0) { st.st_mode &= ~(mode_t) (S_ISUID | S_ISGID); }
+		}
+		fchmod(fd, st.st_mode & 07777);
+	} else {
+		/* mkstemp creates the file as 0600, use what fopen would have used */
+		mode_t mask = umask(0);
+		umask(mask);
+		fchmod(fd, 0666 & ~mask);
+	}
+
+	int res = 0;
+#ifdef PSF_WITH_ZLIB
+	if (psf_isgzname(filename)) {
+		FILE *file = fdopen(fd, "wb");
+		FILE *gz = file ? psf_gzopen(file, 1, &psf->alloc) : 0;
+		if (gz) {
+			res = save(gz, psf);
+			if (fclose(gz) != 0) {
+				fprintf(stderr, "%s: could not compress font\n", __func__);
+				res = 0;
+			}
+		}
+		res = res && fflush(file) == 0 && fsync(fd) == 0;
+		if (file) { fclose(file); } else { close(fd); }
+	} else
+#endif
+	if (save == psf_save_tofile) {
+		res = psf_save_tofd(fd, psf) && fsync(fd) == 0;
+		if (close(fd) != 0) { res = 0; }
+	} else {
+		FILE *file = fdopen(fd, "wb");
+		res = file && save(file, psf) && fflush(file) == 0 && fsync(fd) == 0;
+		if (file) {
+			if (fclose(file) != 0) { res = 0; }
+		} else {
+			perror(__func__);
+			close(fd);
+		}
+	}
+
+	if (res && rename(tmpname, filename) != 0) {
+		perror(__func__);
+		res = 0;
+	}
+	if (!res) { unlink(tmpname); }
+	psf_mem_free(&psf->alloc, tmpname);
+	return res;
+}
+
+#endif /* PSF_POSIX */
+
+static int psf_save_with(const char *filename, struct psf_font *psf, int (*save)(FILE*, struct psf_font*))
+{
+#ifndef PSF_WITH_ZLIB
+	if (psf_isgzname(filename)) {
+		fprintf(stderr, "psf_save: gzip compressed fonts are not supported\n");
+		return 0;
+	}
+#endif
+#ifdef PSF_POSIX
+	/* special files like /dev/stdout can not be replaced */
+	struct stat st;
+	if (stat(filename, &st) != 0 || S_ISREG(st.st_mode)) {
+		return psf_save_atomic(filename, psf, save);
+	}
+#endif
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		perror("psf_save");
+		return 0;
+	}
+	int res = 0;
+#ifdef PSF_WITH_ZLIB
+	if (psf_isgzname(filename)) {
+		FILE *gz = psf_gzopen(file, 1, &psf->alloc);
+		if (gz) {
+			res = save(gz, psf);
+			if (fclose(gz) != 0) {
+				fprintf(stderr, "psf_save: could not compress font\n");
+				res = 0;
+			}
+		}
+	} else {
+		res = save(file, psf);
+	}
+#else
+	res = save(file, psf);
+#endif
+	if (fclose(file) != 0) {
+		perror("psf_save");
+		res = 0;
+	}
+	return res;
+}
+
+int psf_save(const char *filename, struct psf_font *psf)
+{
+	return psf_save_with(filename, psf, psf_save_tofile);
+}
+
+int psf_save_compressed(const char *filename, struct psf_font *psf)
+{
+	return psf_save_with(filename, psf, psf_save_compressed_tofile);
+}
+
+void psf_delete(struct psf_font *psf)
+{
+	psf_dropindex(psf);
+	if (psf->glyph) {
+		int i, nglyphs;
+		if (psf->version == 1) {
+			nglyphs = (psf->header.psf1.mode & PSF1_MODE512) ? 512 : 256;
+		} else {
+			nglyphs = psf->header.psf2.length;
+		}
+		/* bitmaps and unicode values of a shared font are in the segment */
+		if (psf->shared) { nglyphs = 0; }
+		for (i = 0; i < nglyphs; ++i) {
+			psf_mem_free(&psf->alloc, psf->glyph[i].data);
+			psf_mem_free(&psf->alloc, psf->glyph[i].ucvals);
+		}
+		psf_mem_free(&psf->alloc, psf->glyph);
+	}
+#ifdef PSF_POSIX
+	if (psf->shared) { munmap((void*) psf->shared, psf->sharedsize); }
+#endif
+	/* the allocator lives in the font */
+	struct psf_allocator alloc = psf->alloc;
+	psf_mem_free(&alloc, psf);
+}
+
+/* makes room for at least num glyphs in the glyph table, without changing
+ * the number of glyphs in the font.
+ */
+static int psf_reserveglyphs(struct psf_font *psf, unsigned int num)
+{
+	if (num <= psf->capacity) { return 1; }
+	if (psf_readonly(psf, __func__)) { return 0; }
+	struct psf_glyph *newglyph = psf_mem_realloc(&psf->alloc, psf->glyph, psf->capacity * sizeof(struct psf_glyph), (size_t) num * sizeof(struct psf_glyph));
+	if (!newglyph) {
+		perror(__func__);
+		return 0;
+	}
+	memset(&newglyph[psf->capacity], 0, (num - psf->capacity) * sizeof(struct psf_glyph));
+	psf->glyph = newglyph;
+	psf->capacity = num;
+	return 1;
+}
+
+static int psf_reallocglyphs(struct psf_font *psf, unsigned int num)
+{
+	unsigned int ng = psf->glyph ? psf_numglyphs(psf) : 0;
+
+	if (psf->version == 1) {
+		if (num > 512) {
+			fprintf(stderr, "%s: no more than 512 chars for a version 1 psf font\n", __func__);
+			return 0;
+		}
+		unsigned int nng = num <= 256 ? 256 : 512;
+		if (nng > ng) {
+			if (!psf_reserveglyphs(psf, nng)) { return 0; }
+			if (nng == 512) {
+				psf->header.psf1.mode |= PSF1_MODE512;
+			}
+			return 1;
+		}
+	} else {
+		if (num > ng) {
+			/* grow geometrically, so that adding glyphs one by one is cheap */
+			unsigned int ncap = psf->capacity ? psf->capacity : 16;
+			while (ncap < num) {
+				ncap = ncap <= 0x7fffffff ? ncap * 2 : num;
+			}
+			if (!psf_reserveglyphs(psf, ncap)) { return 0; }
+			psf->header.psf2.length = num;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int psf_reserve(struct psf_font *psf, unsigned int num)
+{
+	if (psf->version == 1) {
+		if (num > 512) {
+			fprintf(stderr, "%s: no more than 512 chars for a version 1 psf font\n", __func__);
+			return 0;
+		}
+		return 1;
+	}
+	return psf_reserveglyphs(psf, num);
+}
+
+int psf_resize(struct psf_font *psf, unsigned int width, unsigned int height)
+{
+	if (psf_readonly(psf, __func__)) { return 0; }
+	if ((psf->version == 1 && (width != 8 || height > 255)) || width == 0 || height == 0
+		|| (width + 7) / 8 > 0xffffffffU / height) {
+		fprintf(stderr, "%s: invalid char size\n", __func__);
+		return 0;
+	}
+	unsigned int numglyphs = psf_numglyphs(psf), charsize = (width + 7) / 8 * height, i;
+	/* allocate everything first, so that a failure leaves the font as it was */
+	unsigned char **data = psf_mem_calloc(&psf->alloc, numglyphs, sizeof(unsigned char*));
+	for (i = 0; data && i < numglyphs; ++i) {
+		if (!(data[i] = psf_mem_calloc(&psf->alloc, 1, charsize))) { break; }
+	}
+	if (!data || i < numglyphs) {
+		perror(__func__);
+		while (data && i > 0) { psf_mem_free(&psf->alloc, data[--i]); }
+		psf_mem_free(&psf->alloc, data);
+		return 0;
+	}
+	for (i = 0; i < numglyphs; ++i) {
+		psf_mem_free(&psf->alloc, psf->glyph[i].data);
+		psf->glyph[i].data = data[i];
+	}
+	psf_mem_free(&psf->alloc, data);
+	if (psf->version == 1) {
+		psf->header.psf1.charsize = height;
+	} else {
+		psf->header.psf2.width = width;
+		psf->header.psf2.height = height;
+		psf->header.psf2.charsize = charsize;
+	}
+	return 1;
+}
+
+struct psf_glyph *psf_getglyph(struct psf_font *psf, unsigned int no)
+{
+	if (no >= psf_numglyphs(psf)) {
+		return 0;
+	}
+	return &psf->glyph[no];
+}
+
+struct psf_glyph *psf_addglyph(struct psf_font *psf, unsigned int no)
+{
+	if (no >= psf_numglyphs(psf)) {
+		if (!psf_reallocglyphs(psf, no + 1)) {
+			return 0;
+		}
+	}
+	psf_glyph_init(psf, &psf->glyph[no]);
+	return &psf->glyph[no];
+}
+
+int psf_glyph_init(struct psf_font *psf, struct psf_glyph *glyph)
+{
+	if (psf_readonly(psf, __func__)) { return 0; }
+	psf_dropindex(psf);
+	psf_mem_free(&psf->alloc, glyph->data);
+	psf_mem_free(&psf->alloc, glyph->ucvals);
+
+	glyph->data = psf_mem_calloc(&psf->alloc, 1, psf_charsize(psf));
+	glyph->nucvals = 0;
+	glyph->ucvals = 0;
+	return 1;
+}
+
+int psf_glyph_setpx(struct psf_font *psf, struct psf_glyph *glyph, unsigned int x, unsigned int y, unsigned int val)
+{
+	if (!glyph->data || psf_readonly(psf, __func__)) { return 0; }
+	unsigned int w = psf_width(psf);
+	unsigned int h = psf_height(psf);
+	if (x >= w || y >= h) { return 0; }
+	unsigned int byte = y * ((w + 7) >> 3) + (x >> 3);
+	unsigned int mask = 0x80 >> (x & 7);
+	if (val) {
+		glyph->data[byte] |= mask;
+	} else {
+		glyph->data[byte] &= ~mask;
+	}
+	return 1;
+}
+
+int psf_glyph_getpx(struct psf_font *psf, struct psf_glyph *glyph, unsigned int x, unsigned int y)
+{
+	if (!glyph->data) { return 0; }
+	unsigned int w = psf_width(psf);
+	unsigned int h = psf_height(psf);
+	if (x >= w || y >= h) { return 0; }
+	unsigned int byte = y * ((w + 7) >> 3) + (x >> 3);
+	unsigned int mask = 0x80 >> (x & 7);
+	return (glyph->data[byte] & mask) == 0;
+}
+
+int psf_glyph_adducval(struct psf_font *psf, struct psf_glyph *glyph, unsigned int uni)
+{
+	if (psf->version == 1 && uni > 0xFFFF) {
+		fprintf(stderr, "%s: unicode value too big for psf1\n", __func__);
+		return 0;
+	}
+	if (psf_readonly(psf, __func__)) { return 0; }
+	psf_dropindex(psf);
+	unsigned int newnucvals = glyph->nucvals + 1;
+	unsigned int *newucvals = psf_mem_calloc(&psf->alloc, newnucvals, sizeof(unsigned int));
+	if (!newucvals) {
+		perror(__func__);
+		return 0;
+	}
+	if (glyph->ucvals) {
+		memcpy(newucvals, glyph->ucvals, glyph->nucvals * sizeof(unsigned int));
+		psf_mem_free(&psf->alloc, glyph->ucvals);
+	}
+	glyph->ucvals = newucvals;
+	glyph->nucvals = newnucvals;
+	glyph->ucvals[newnucvals - 1] = uni;
+	if (psf->version == 1) {
+		psf->header.psf1.mode |= PSF1_MODEHASTAB;
+		if (uni == PSF1_STARTSEQ) {
+			psf->header.psf1.mode |= PSF1_MODEHASSEQ;
+		}
+	} else {
+		psf->header.psf2.flags |= PSF2_HAS_UNICODE_TABLE;
+	}
+
+	return 1;
+}
+
+unsigned int psf_numglyphs(struct psf_font *psf)
+{
+	if (psf->version == 1) {
+		return psf->header.psf1.mode & PSF1_MODE512 ? 512 : 256;
+	} else {
+		return psf->header.psf2.length;
+	}
+}
+
+unsigned int psf_hasunicodetable(struct psf_font *psf)
+{
+	if (psf->version == 1) {
+		return (psf->header.psf1.mode & PSF1_MODEHASTAB) != 0;
+	} else {
+		return (psf->header.psf2.flags & PSF2_HAS_UNICODE_TABLE) != 0;
+	}
+}
+
+/* codepoint lookup index. While building, the index lives in buf in the
+ * same layout as the index section in a file, but in host byte order.
+ */
+
+struct psf_index {
+	const uint32_t *top;	/* PSFI_NPAGES top level entries */
+	const uint32_t *pages;	/* npages * PSFI_PAGESIZE glyph numbers */
+	uint32_t npages;
+	const struct psf_allocator *alloc;
+	uint32_t *buf;			/* index data, if allocated */
+	size_t bufsize;			/* size of buf in words */
+	void *map;				/* index data, if mmap()ed */
+	size_t maplen;
+	int persist;
+	struct psf_run *runs;	/* see psf_runs */
+	uint32_t nruns;
+	int runsdone;			/* runs are found or loaded */
+};
+
+#define PSFI_HEADERWORDS (PSFI_HEADERSIZE / 4)
+
+static int psf_host_le(void)
+{
+	const uint16_t one = 1;
+	return *(const unsigned char*) &one == 1;
+}
+
+static struct psf_index *psf_index_new(const struct psf_allocator *alloc)
+{
+	struct psf_index *idx = psf_mem_calloc(alloc, 1, sizeof(struct psf_index));
+	if (!idx) { return 0; }
+	idx->alloc = alloc;
+	idx->bufsize = PSFI_HEADERWORDS + PSFI_NPAGES + 16 * PSFI_PAGESIZE;
+	idx->buf = psf_mem_alloc(alloc, idx->bufsize * sizeof(uint32_t));
+	if (!idx->buf) {
+		psf_mem_free(alloc, idx);
+		return 0;
+	}
+	memset(&idx->buf[PSFI_HEADERWORDS], 0xff, PSFI_NPAGES * sizeof(uint32_t));
+	return idx;
+}
+
+/* maps cp to val, unless cp is already mapped */
+static int psf_index_set(struct psf_index *idx, unsigned int cp, uint32_t val)
+{
+	if (cp >= PSFI_NPAGES * PSFI_PAGESIZE) { return 1; }
+	uint32_t page = idx->buf[PSFI_HEADERWORDS + cp / PSFI_PAGESIZE];
+	if (page == PSFI_NONE) {
+		size_t need = PSFI_HEADERWORDS + PSFI_NPAGES + (size_t) (idx->npages + 1) * PSFI_PAGESIZE;
+		if (need > idx->bufsize) {
+			size_t newsize = idx->bufsize * 2;
+			uint32_t *newbuf = psf_mem_realloc(idx->alloc, idx->buf, idx->bufsize * sizeof(uint32_t), newsize * sizeof(uint32_t));
+			if (!newbuf) { return 0; }
+			idx->buf = newbuf;
+			idx->bufsize = newsize;
+		}
+		page = idx->npages++;
+		idx->buf[PSFI_HEADERWORDS + cp / PSFI_PAGESIZE] = page;
+		memset(&idx->buf[PSFI_HEADERWORDS + PSFI_NPAGES + (size_t) page * PSFI_PAGESIZE], 0xff, PSFI_PAGESIZE * sizeof(uint32_t));
+	}
+	uint32_t *entry = &idx->buf[PSFI_HEADERWORDS + PSFI_NPAGES + (size_t) page * PSFI_PAGESIZE + cp % PSFI_PAGESIZE];
+	if (*entry == PSFI_NONE) { *entry = val; }
+	return 1;
+}
+
+static void psf_index_finish(struct psf_index *idx)
+{
+	idx->buf[0] = PSFI_MAGIC;
+	idx->buf[1] = PSFI_VERSION;
+	idx->buf[2] = (PSFI_HEADERWORDS + PSFI_NPAGES + idx->npages * PSFI_PAGESIZE) * sizeof(uint32_t);
+	idx->buf[3] = idx->npages;
+	idx->top = &idx->buf[PSFI_HEADERWORDS];
+	idx->pages = &idx->buf[PSFI_HEADERWORDS + PSFI_NPAGES];
+}
+
+static void psf_index_free(struct psf_index *idx)
+{
+#ifdef PSF_POSIX
+	if (idx->map) { munmap(idx->map, idx->maplen); }
+#endif
+	psf_mem_free(idx->alloc, idx->buf);
+	psf_mem_free(idx->alloc, idx->runs);
+	psf_mem_free(idx->alloc, idx);
+}
+
+/* finds the runs of at least two codepoints in the index */
+static int psf_index_findruns(struct psf_index *idx)
+{
+	struct psf_run *runs = 0, cur = { 0, 0, 0 };
+	size_t nruns = 0, capacity = 0;
+	uint32_t cp = 0;
+	while (cp <= PSFI_NPAGES * PSFI_PAGESIZE) {
+		uint32_t glyph = PSFI_NONE, next = cp + 1;
+		if (cp < PSFI_NPAGES * PSFI_PAGESIZE) {
+			uint32_t page = idx->top[cp / PSFI_PAGESIZE];
+			if (page == PSFI_NONE) {
+				next = cp + PSFI_PAGESIZE;
+			} else {
+				glyph = idx->pages[(size_t) page * PSFI_PAGESIZE + cp % PSFI_PAGESIZE];
+			}
+		}
+		if (glyph != PSFI_NONE && cur.len > 0 && glyph == cur.glyph + cur.len) {
+			++cur.len;
+		} else {
+			if (cur.len >= 2) {
+				if (nruns == capacity) {
+					size_t ncap = capacity ? capacity * 2 : 64;
+					struct psf_run *newruns = psf_mem_realloc(idx->alloc, runs, capacity * sizeof(struct psf_run), ncap * sizeof(struct psf_run));
+					if (!newruns) {
+						psf_mem_free(idx->alloc, runs);
+						return 0;
+					}
+					runs = newruns;
+					capacity = ncap;
+				}
+				runs[nruns++] = cur;
+			}
+			cur.cp = cp;
+			cur.glyph = glyph;
+			cur.len = glyph != PSFI_NONE;
+		}
+		cp = next;
+	}
+	psf_mem_free(idx->alloc, idx->runs);
+	idx->runs = runs;
+	idx->nruns = nruns;
+	idx->runsdone = 1;
+	return 1;
+}
+
+/* takes over an index section read from a file. data/size is what follows
+ * the unicode table and padding, offset is the position of data in file or
+ * -1 if unknown. The section is mmap()ed if possible, and copied otherwise.
+ * Broken or unknown index sections are ignored.
+ */
+static int psf_index_adopt(struct psf_font *psf, FILE *file, const unsigned char *data, size_t size, size_t offset)
+{
+	if (size < PSFI_HEADERSIZE || psf_get_int(data) != PSFI_MAGIC) { return 0; }
+	uint32_t version = psf_get_int(data + 4), secsize = psf_get_int(data + 8), npages = psf_get_int(data + 12), nruns = 0, i;
+	if ((version != 1 && version != PSFI_VERSION) || npages > PSFI_NPAGES || secsize > size) { return 0; }
+	size_t pagesend = (PSFI_HEADERWORDS + PSFI_NPAGES + (size_t) npages * PSFI_PAGESIZE) * sizeof(uint32_t);
+	if (version == 1) {
+		if (secsize != pagesend) { return 0; }
+	} else {
+		if (secsize < pagesend + 4) { return 0; }
+		nruns = psf_get_int(data + pagesend);
+		if (nruns > (secsize - pagesend - 4) / 12 || secsize != pagesend + 4 + (size_t) nruns * 12) { return 0; }
+	}
+	for (i = 0; i < PSFI_NPAGES; ++i) {
+		uint32_t page = psf_get_int(data + PSFI_HEADERSIZE + i * 4);
+		if (page != PSFI_NONE && page >= npages) { return 0; }
+	}
+	/* runs must be sorted, must not overlap, and must stay within the font */
+	uint32_t numglyphs = psf_numglyphs(psf), cpend = 0;
+	for (i = 0; i < nruns; ++i) {
+		const unsigned char *run = data + pagesend + 4 + (size_t) i * 12;
+		uint32_t cp = psf_get_int(run), glyph = psf_get_int(run + 4), len = psf_get_int(run + 8);
+		if (cp < cpend || len < 2 || len > PSFI_NPAGES * PSFI_PAGESIZE - cp || glyph > numglyphs || len > numglyphs - glyph) {
+			return 0;
+		}
+		cpend = cp + len;
+	}
+
+	const struct psf_allocator *alloc = &psf->alloc;
+	struct psf_index *idx = psf_mem_calloc(alloc, 1, sizeof(struct psf_index));
+	if (!idx) { return 0; }
+	idx->alloc = alloc;
+	idx->npages = npages;
+	idx->persist = 1;
+	if (version != 1) {
+		idx->runs = psf_mem_alloc(alloc, (size_t) nruns * sizeof(struct psf_run));
+		if (!idx->runs) {
+			psf_mem_free(alloc, idx);
+			return 0;
+		}
+		for (i = 0; i < nruns; ++i) {
+			const unsigned char *run = data + pagesend + 4 + (size_t) i * 12;
+			idx->runs[i].cp = psf_get_int(run);
+			idx->runs[i].glyph = psf_get_int(run + 4);
+			idx->runs[i].len = psf_get_int(run + 8);
+		}
+		idx->nruns = nruns;
+		idx->runsdone = 1;
+	}
+#ifdef PSF_POSIX
+	struct stat st;
+	int fd = file ? fileno(file) : -1;
+	if (fd >= 0 && psf_host_le() && offset % 4 == 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		size_t pgoff = offset % (size_t) sysconf(_SC_PAGESIZE);
+		void *map = mmap(0, pagesend + pgoff, PROT_READ, MAP_SHARED, fd, offset - pgoff);
+		if (map != MAP_FAILED) {
+			idx->map = map;
+			idx->maplen = pagesend + pgoff;
+			idx->top = (const uint32_t*) ((const unsigned char*) map + pgoff + PSFI_HEADERSIZE);
+		}
+	}
+#else
+	(void) file;
+	(void) offset;
+#endif
+	if (!idx->map) {
+		idx->bufsize = pagesend / sizeof(uint32_t);
+		idx->buf = psf_mem_alloc(alloc, pagesend);
+		if (!idx->buf) {
+			psf_mem_free(alloc, idx->runs);
+			psf_mem_free(alloc, idx);
+			return 0;
+		}
+		for (i = 0; i < idx->bufsize; ++i) {
+			idx->buf[i] = psf_get_int(data + i * 4);
+		}
+		idx->top = &idx->buf[PSFI_HEADERWORDS];
+	}
+	idx->pages = idx->top + PSFI_NPAGES;
+	psf->index = idx;
+	return 1;
+}
+
+/* encodes the index section including the padding that aligns it, for a
+ * unicode table that ends at offset tabend. Returns 0 with *size = 0 if
+ * there is no index to save.
+ */
+static unsigned char *psf_encode_index(struct psf_font *psf, size_t tabend, size_t *size)
+{
+	*size = 0;
+	if (!psf_hasindex(psf) || psf->version != 2 || !psf_hasunicodetable(psf)) { return 0; }
+	struct psf_index *idx = psf->index;
+	if (!idx->runsdone && !psf_index_findruns(idx)) {
+		perror(__func__);
+		return 0;
+	}
+	size_t pad = (PSFI_ALIGN - tabend % PSFI_ALIGN) % PSFI_ALIGN;
+	size_t nwords = PSFI_NPAGES + (size_t) idx->npages * PSFI_PAGESIZE, i;
+	size_t secsize = PSFI_HEADERSIZE + nwords * 4 + 4 + (size_t) idx->nruns * 12;
+	unsigned char *buf = psf_mem_calloc(&psf->alloc, 1, pad + secsize);
+	if (!buf) {
+		perror(__func__);
+		return 0;
+	}
+	unsigned char *ptr = buf + pad;
+	psf_put_int(ptr, PSFI_MAGIC);
+	psf_put_int(ptr + 4, PSFI_VERSION);
+	psf_put_int(ptr + 8, secsize);
+	psf_put_int(ptr + 12, idx->npages);
+	ptr += PSFI_HEADERSIZE;
+	/* top and pages are contiguous */
+	for (i = 0; i < nwords; ++i, ptr += 4) {
+		psf_put_int(ptr, idx->top[i]);
+	}
+	psf_put_int(ptr, idx->nruns);
+	ptr += 4;
+	for (i = 0; i < idx->nruns; ++i, ptr += 12) {
+		psf_put_int(ptr, idx->runs[i].cp);
+		psf_put_int(ptr + 4, idx->runs[i].glyph);
+		psf_put_int(ptr + 8, idx->runs[i].len);
+	}
+	*size = ptr - buf;
+	return buf;
+}
+
+int psf_buildindex(struct psf_font *psf, int persist)
+{
+	if (persist && (psf->version != 2 || !psf_hasunicodetable(psf))) {
+		fprintf(stderr, "%s: only psf2 fonts with a unicode table can store an index\n", __func__);
+		return 0;
+	}
+	psf_dropindex(psf);
+	struct psf_index *idx = psf_index_new(&psf->alloc);
+	if (!idx) {
+		perror(__func__);
+		return 0;
+	}
+	unsigned int numglyphs = psf_numglyphs(psf), i, ucv;
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		for (ucv = 0; ucv < glyph->nucvals && glyph->ucvals[ucv] != PSF1_STARTSEQ; ++ucv) {
+			if (!psf_index_set(idx, glyph->ucvals[ucv], i)) {
+				perror(__func__);
+				psf_index_free(idx);
+				return 0;
+			}
+		}
+	}
+	psf_index_finish(idx);
+	idx->persist = persist;
+	psf->index = idx;
+	return 1;
+}
+
+void psf_dropindex(struct psf_font *psf)
+{
+	if (psf->index) {
+		psf_index_free(psf->index);
+		psf->index = 0;
+	}
+}
+
+unsigned int psf_hasindex(struct psf_font *psf)
+{
+	return psf->index && psf->index->persist;
+}
+
+const struct psf_run *psf_runs(struct psf_font *psf, unsigned int *nruns)
+{
+	*nruns = 0;
+	if (!psf_hasunicodetable(psf)) { return 0; }
+	if (!psf->index && !psf_buildindex(psf, 0)) { return 0; }
+	if (!psf->index->runsdone && !psf_index_findruns(psf->index)) {
+		perror(__func__);
+		return 0;
+	}
+	*nruns = psf->index->nruns;
+	return psf->index->runs;
+}
+
+int psf_permute(struct psf_font *psf, const unsigned int *order)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), i;
+	if (psf_readonly(psf, __func__)) { return 0; }
+	struct psf_glyph *old = psf_mem_alloc(&psf->alloc, (size_t) numglyphs * sizeof(struct psf_glyph));
+	unsigned char *seen = psf_mem_calloc(&psf->alloc, numglyphs, 1);
+	if (!old || !seen) {
+		perror(__func__);
+		psf_mem_free(&psf->alloc, old);
+		psf_mem_free(&psf->alloc, seen);
+		return 0;
+	}
+	for (i = 0; i < numglyphs; ++i) {
+		if (order[i] >= numglyphs || seen[order[i]]) {
+			fprintf(stderr, "%s: order is not a permutation of the glyphs\n", __func__);
+			psf_mem_free(&psf->alloc, old);
+			psf_mem_free(&psf->alloc, seen);
+			return 0;
+		}
+		seen[order[i]] = 1;
+	}
+	memcpy(old, psf->glyph, numglyphs * sizeof(struct psf_glyph));
+	for (i = 0; i < numglyphs; ++i) {
+		psf->glyph[i] = old[order[i]];
+	}
+	psf_mem_free(&psf->alloc, old);
+	psf_mem_free(&psf->alloc, seen);
+	psf_dropindex(psf);
+	return 1;
+}
+
+/* sort key of a glyph: hot glyphs first, then its lowest single codepoint */
+struct psf_sortkey {
+	unsigned int hot;
+	unsigned int cp;
+	unsigned int glyph;
+};
+
+static int psf_sortkey_cmp(const void *a, const void *b)
+{
+	const struct psf_sortkey *ka = a, *kb = b;
+	if (ka->hot != kb->hot) { return ka->hot ? -1 : 1; }
+	if (ka->cp != kb->cp) { return ka->cp < kb->cp ? -1 : 1; }
+	return ka->glyph < kb->glyph ? -1 : ka->glyph > kb->glyph;
+}
+
+/* sorts the glyphs by codepoint, the ones flagged in hot first, and
+ * rebuilds the index
+ */
+static int psf_reorder(struct psf_font *psf, const unsigned char *hot)
+{
+	if (!psf_hasunicodetable(psf)) {
+		fprintf(stderr, "%s: font has no unicode table\n", __func__);
+		return 0;
+	}
+	unsigned int numglyphs = psf_numglyphs(psf), i, ucv;
+	int persist = psf_hasindex(psf);
+	struct psf_sortkey *key = psf_mem_alloc(&psf->alloc, (size_t) numglyphs * sizeof(struct psf_sortkey));
+	unsigned int *order = psf_mem_alloc(&psf->alloc, (size_t) numglyphs * sizeof(unsigned int));
+	if (!key || !order) {
+		perror(__func__);
+		psf_mem_free(&psf->alloc, key);
+		psf_mem_free(&psf->alloc, order);
+		return 0;
+	}
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		key[i].hot = hot ? hot[i] : 0;
+		key[i].cp = PSFI_NONE;
+		key[i].glyph = i;
+		for (ucv = 0; ucv < glyph->nucvals && glyph->ucvals[ucv] != PSF1_STARTSEQ; ++ucv) {
+			if (glyph->ucvals[ucv] < key[i].cp) { key[i].cp = glyph->ucvals[ucv]; }
+		}
+	}
+	qsort(key, numglyphs, sizeof(struct psf_sortkey), psf_sortkey_cmp);
+	for (i = 0; i < numglyphs; ++i) {
+		order[i] = key[i].glyph;
+	}
+	int ok = psf_permute(psf, order) && psf_buildindex(psf, persist);
+	psf_mem_free(&psf->alloc, key);
+	psf_mem_free(&psf->alloc, order);
+	return ok;
+}
+
+int psf_sort(struct psf_font *psf)
+{
+	return psf_reorder(psf, 0);
+}
+
+/* usage histogram */
+
+struct psf_usage {
+	uint64_t *page[PSFI_NPAGES];
+};
+
+struct psf_usage *psf_usage_new(void)
+{
+	struct psf_usage *usage = calloc(1, sizeof(struct psf_usage));
+	if (!usage) { perror(__func__); }
+	return usage;
+}
+
+void psf_usage_delete(struct psf_usage *usage)
+{
+	unsigned int i;
+	for (i = 0; i < PSFI_NPAGES; ++i) {
+		free(usage->page[i]);
+	}
+	free(usage);
+}
+
+int psf_usage_count(struct psf_usage *usage, unsigned int cp, unsigned long long n)
+{
+	if (cp >= PSFI_NPAGES * PSFI_PAGESIZE) { return 0; }
+	uint64_t **page = &usage->page[cp / PSFI_PAGESIZE];
+	if (!*page && !(*page = calloc(PSFI_PAGESIZE, sizeof(uint64_t)))) { return 0; }
+	(*page)[cp % PSFI_PAGESIZE] += n;
+	return 1;
+}
+
+unsigned long long psf_usage_get(struct psf_usage *usage, unsigned int cp)
+{
+	if (cp >= PSFI_NPAGES * PSFI_PAGESIZE || !usage->page[cp / PSFI_PAGESIZE]) { return 0; }
+	return usage->page[cp / PSFI_PAGESIZE][cp % PSFI_PAGESIZE];
+}
+
+int psf_usage_load(struct psf_usage *usage, FILE *file)
+{
+	unsigned int version, cp, lineno = 1;
+	unsigned long long n;
+	if (fscanf(file, "psfusage %u\n", &version) != 1 || version != 1) {
+		fprintf(stderr, "%s: not a usage histogram\n", __func__);
+		return 0;
+	}
+	int res;
+	while ((res = fscanf(file, "U+%x %llu\n", &cp, &n)) == 2) {
+		++lineno;
+		if (!psf_usage_count(usage, cp, n)) {
+			fprintf(stderr, "%s: invalid codepoint or out of memory in line %u\n", __func__, lineno);
+			return 0;
+		}
+	}
+	if (res != EOF || ferror(file)) {
+		fprintf(stderr, "%s: invalid line %u\n", __func__, lineno + 1);
+		return 0;
+	}
+	return 1;
+}
+
+int psf_usage_save(struct psf_usage *usage, FILE *file)
+{
+	unsigned int i, j;
+	fprintf(file, "psfusage 1\n");
+	for (i = 0; i < PSFI_NPAGES; ++i) {
+		for (j = 0; usage->page[i] && j < PSFI_PAGESIZE; ++j) {
+			if (usage->page[i][j]) {
+				fprintf(file, "U+%04x %llu\n", i * PSFI_PAGESIZE + j, (unsigned long long) usage->page[i][j]);
+			}
+		}
+	}
+	if (fflush(file) != 0 || ferror(file)) {
+		perror(__func__);
+		return 0;
+	}
+	return 1;
+}
+
+/* glyph and use count, for picking the hot glyphs */
+struct psf_glyphuse {
+	unsigned long long n;
+	unsigned int glyph;
+};
+
+static int psf_glyphuse_cmp(const void *a, const void *b)
+{
+	const struct psf_glyphuse *ua = a, *ub = b;
+	if (ua->n != ub->n) { return ua->n > ub->n ? -1 : 1; }
+	return ua->glyph < ub->glyph ? -1 : ua->glyph > ub->glyph;
+}
+
+int psf_layout(struct psf_font *psf, struct psf_usage *usage, unsigned int percent)
+{
+	if (!psf_hasunicodetable(psf)) {
+		fprintf(stderr, "%s: font has no unicode table\n", __func__);
+		return -1;
+	}
+	if (percent < 1 || percent > 100) {
+		fprintf(stderr, "%s: invalid percentage: %u\n", __func__, percent);
+		return -1;
+	}
+	unsigned int numglyphs = psf_numglyphs(psf), i, ucv, nhot = 0;
+	struct psf_glyphuse *use = psf_mem_alloc(&psf->alloc, (size_t) numglyphs * sizeof(struct psf_glyphuse));
+	unsigned char *hot = psf_mem_calloc(&psf->alloc, numglyphs, 1);
+	if (!use || !hot) {
+		perror(__func__);
+		psf_mem_free(&psf->alloc, use);
+		psf_mem_free(&psf->alloc, hot);
+		return -1;
+	}
+	/* codepoints mapped to several glyphs count for the one lookups find */
+	unsigned long long total = 0, sum = 0;
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		use[i].n = 0;
+		use[i].glyph = i;
+		for (ucv = 0; ucv < glyph->nucvals && glyph->ucvals[ucv] != PSF1_STARTSEQ; ++ucv) {
+			if (psf_lookup(psf, glyph->ucvals[ucv]) == (int) i) {
+				use[i].n += psf_usage_get(usage, glyph->ucvals[ucv]);
+			}
+		}
+		total += use[i].n;
+	}
+	qsort(use, numglyphs, sizeof(struct psf_glyphuse), psf_glyphuse_cmp);
+	while (nhot < numglyphs && use[nhot].n > 0 && sum < total / 100.0 * percent) {
+		sum += use[nhot].n;
+		hot[use[nhot++].glyph] = 1;
+	}
+	int ok = psf_reorder(psf, hot);
+	psf_mem_free(&psf->alloc, use);
+	psf_mem_free(&psf->alloc, hot);
+	return ok ? (int) nhot : -1;
+}
+
+int psf_lookup(struct psf_font *psf, unsigned int cp)
+{
+	if (!psf_hasunicodetable(psf)) {
+		return cp < psf_numglyphs(psf) ? (int) cp : -1;
+	}
+	if (cp >= PSFI_NPAGES * PSFI_PAGESIZE) { return -1; }
+	if (!psf->index && !psf_buildindex(psf, 0)) { return -1; }
+	uint32_t page = psf->index->top[cp / PSFI_PAGESIZE];
+	if (page == PSFI_NONE) { return -1; }
+	uint32_t glyph = psf->index->pages[(size_t) page * PSFI_PAGESIZE + cp % PSFI_PAGESIZE];
+	return glyph < psf_numglyphs(psf) ? (int) glyph : -1;
+}
+
+/* font sets. The merged index maps codepoints to (font << 24) | glyph. As
+ * psf_index_set never overwrites an entry, adding a font only fills the
+ * holes left by the fonts with higher priority.
+ */
+
+#define PSF_FONTSET_MAXFONTS  255
+#define PSF_FONTSET_GLYPHBITS 24
+
+struct psf_fontset {
+	struct psf_font **font;
+	unsigned int nfonts;
+	struct psf_index *index;
+};
+
+struct psf_fontset *psf_fontset_new(void)
+{
+	struct psf_fontset *set = calloc(1, sizeof(struct psf_fontset));
+	if (!set) {
+		perror(__func__);
+		return 0;
+	}
+	set->index = psf_index_new(&psf_std_allocator);
+	if (!set->index) {
+		perror(__func__);
+		free(set);
+		return 0;
+	}
+	psf_index_finish(set->index);
+	return set;
+}
+
+int psf_fontset_add(struct psf_fontset *set, struct psf_font *psf)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), i, ucv;
+	if (set->nfonts >= PSF_FONTSET_MAXFONTS || numglyphs > (1U << PSF_FONTSET_GLYPHBITS)) {
+		fprintf(stderr, "%s: too many fonts or glyphs\n", __func__);
+		return 0;
+	}
+	if (set->nfonts > 0 && (psf_width(psf) != psf_width(set->font[0]) || psf_height(psf) != psf_height(set->font[0]))) {
+		fprintf(stderr, "%s: font size does not match the set\n", __func__);
+		return 0;
+	}
+	struct psf_font **newfont = realloc(set->font, (set->nfonts + 1) * sizeof(struct psf_font*));
+	if (!newfont) {
+		perror(__func__);
+		return 0;
+	}
+	set->font = newfont;
+
+	uint32_t fontbits = (uint32_t) set->nfonts << PSF_FONTSET_GLYPHBITS;
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		int ok = 1;
+		if (!psf_hasunicodetable(psf)) {
+			ok = psf_index_set(set->index, i, fontbits | i);
+		}
+		for (ucv = 0; ok && ucv < glyph->nucvals && glyph->ucvals[ucv] != PSF1_STARTSEQ; ++ucv) {
+			ok = psf_index_set(set->index, glyph->ucvals[ucv], fontbits | i);
+		}
+		if (!ok) {
+			/* remove the entries already made for this font */
+			size_t e, nentries = (size_t) set->index->npages * PSFI_PAGESIZE;
+			uint32_t *pages = &set->index->buf[PSFI_HEADERWORDS + PSFI_NPAGES];
+			for (e = 0; e < nentries; ++e) {
+				if (pages[e] != PSFI_NONE && (pages[e] >> PSF_FONTSET_GLYPHBITS) == set->nfonts) {
+					pages[e] = PSFI_NONE;
+				}
+			}
+			perror(__func__);
+			psf_index_finish(set->index);
+			return 0;
+		}
+	}
+	psf_index_finish(set->index);
+	set->font[set->nfonts++] = psf;
+	return 1;
+}
+
+int psf_fontset_lookup(struct psf_fontset *set, unsigned int cp, struct psf_font **font)
+{
+	if (cp >= PSFI_NPAGES * PSFI_PAGESIZE) { return -1; }
+	uint32_t page = set->index->top[cp / PSFI_PAGESIZE];
+	if (page == PSFI_NONE) { return -1; }
+	uint32_t entry = set->index->pages[(size_t) page * PSFI_PAGESIZE + cp % PSFI_PAGESIZE];
+	if (entry == PSFI_NONE) { return -1; }
+	if (font) {
+		*font = set->font[entry >> PSF_FONTSET_GLYPHBITS];
+	}
+	return entry & ((1U << PSF_FONTSET_GLYPHBITS) - 1);
+}
+
+struct psf_font *psf_fontset_font(struct psf_fontset *set, unsigned int no)
+{
+	return no < set->nfonts ? set->font[no] : 0;
+}
+
+void psf_fontset_delete(struct psf_fontset *set)
+{
+	unsigned int i;
+	for (i = 0; i < set->nfonts; ++i) {
+		psf_delete(set->font[i]);
+	}
+	free(set->font);
+	psf_index_free(set->index);
+	free(set);
+}
+
+unsigned int psf_coverage(struct psf_font *psf, uint32_t *bits)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), count = 0, i, ucv;
+	memset(bits, 0, PSF_COVERAGE_WORDS * sizeof(uint32_t));
+	if (!psf_hasunicodetable(psf)) {
+		/* glyph numbers are codepoints, there are only so many of those */
+		for (i = 0; i < numglyphs && i < PSF_MAXUNICODE; ++i) {
+			bits[i / 32] |= (uint32_t) 1 << (i % 32);
+			++count;
+		}
+		return count;
+	}
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		for (ucv = 0; ucv < glyph->nucvals && glyph->ucvals[ucv] != PSF1_STARTSEQ; ++ucv) {
+			unsigned int cp = glyph->ucvals[ucv];
+			uint32_t mask = (uint32_t) 1 << (cp % 32);
+			if (cp < PSF_MAXUNICODE && !(bits[cp / 32] & mask)) {
+				bits[cp / 32] |= mask;
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+/* this is MurmurHash64A by Austin Appleby, reading data as little endian
+ * words so that the hash does not depend on the host byte order.
+ */
+uint64_t psf_hash_data(uint64_t h, const void *data, size_t len)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	const unsigned char *ptr = data;
+
+	h ^= len * m;
+	while (len >= 8) {
+		uint64_t k = (uint64_t) ptr[0] | ((uint64_t) ptr[1] << 8) | ((uint64_t) ptr[2] << 16) | ((uint64_t) ptr[3] << 24)
+			| ((uint64_t) ptr[4] << 32) | ((uint64_t) ptr[5] << 40) | ((uint64_t) ptr[6] << 48) | ((uint64_t) ptr[7] << 56);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+		ptr += 8;
+		len -= 8;
+	}
+	switch (len) {
+		case 7: h ^= (uint64_t) ptr[6] << 48; /* fallthrough */
+		case 6: h ^= (uint64_t) ptr[5] << 40; /* fallthrough */
+		case 5: h ^= (uint64_t) ptr[4] << 32; /* fallthrough */
+		case 4: h ^= (uint64_t) ptr[3] << 24; /* fallthrough */
+		case 3: h ^= (uint64_t) ptr[2] << 16; /* fallthrough */
+		case 2: h ^= (uint64_t) ptr[1] << 8; /* fallthrough */
+		case 1: h ^= (uint64_t) ptr[0];
+			h *= m;
+	}
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+uint64_t psf_hash(struct psf_font *psf)
+{
+	unsigned int nglyphs = psf_numglyphs(psf), charsize = psf_charsize(psf), i, ucv;
+	unsigned char hdr[24], ucbuf[256];
+	uint64_t h = PSF_HASH_SEED;
+
+	psf_put_int(&hdr[0], psf->version);
+	psf_put_int(&hdr[4], psf_width(psf));
+	psf_put_int(&hdr[8], psf_height(psf));
+	psf_put_int(&hdr[12], nglyphs);
+	psf_put_int(&hdr[16], charsize);
+	psf_put_int(&hdr[20], psf_hasunicodetable(psf));
+	h = psf_hash_data(h, hdr, sizeof(hdr));
+
+	unsigned char *zero = psf_mem_calloc(&psf->alloc, 1, charsize);
+	if (!zero) {
+		perror(__func__);
+		return 0;
+	}
+	for (i = 0; i < nglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		h = psf_hash_data(h, glyph->data ? glyph->data : zero, charsize);
+		/* unicode values in blocks of 64, prefixed by their count */
+		psf_put_int(ucbuf, glyph->nucvals);
+		unsigned int nbuf = 4;
+		for (ucv = 0; ucv < glyph->nucvals; ++ucv) {
+			psf_put_int(&ucbuf[nbuf], glyph->ucvals[ucv]);
+			nbuf += 4;
+			if (nbuf == sizeof(ucbuf)) {
+				h = psf_hash_data(h, ucbuf, nbuf);
+				nbuf = 0;
+			}
+		}
+		if (nbuf > 0) { h = psf_hash_data(h, ucbuf, nbuf); }
+	}
+	psf_mem_free(&psf->alloc, zero);
+	return h;
+}
+
+/* font deltas */
+
+static unsigned int psf_flags(struct psf_font *psf)
+{
+	return psf->version == 1 ? psf->header.psf1.mode : psf->header.psf2.flags;
+}
+
+/* encodes new xor old as runs of zero and literal bytes */
+static size_t psf_diff_xor(unsigned char *buf, const unsigned char *old, const unsigned char *new, unsigned int charsize)
+{
+	size_t len = 0;
+	unsigned int pos = 0;
+	while (pos < charsize) {
+		unsigned int zeros = 0, lit = 0, i;
+		while (pos + zeros < charsize && (old ? old[pos + zeros] : 0) == new[pos + zeros]) { ++zeros; }
+		len += psf_putvarint(buf + len, zeros);
+		pos += zeros;
+		if (pos == charsize) { break; }
+		/* a single unchanged byte is cheaper as part of the literal run */
+		while (pos + lit < charsize && ((old ? old[pos + lit] : 0) != new[pos + lit]
+			|| (pos + lit + 1 < charsize && (old ? old[pos + lit + 1] : 0) != new[pos + lit + 1]))) {
+			++lit;
+		}
+		len += psf_putvarint(buf + len, lit);
+		for (i = 0; i < lit; ++i, ++pos) {
+			buf[len++] = new[pos] ^ (old ? old[pos] : 0);
+		}
+	}
+	return len;
+}
+
+unsigned char *psf_diff(struct psf_font *old, struct psf_font *new, size_t *size)
+{
+	unsigned int oldglyphs = psf_numglyphs(old), newglyphs = psf_numglyphs(new), charsize = psf_charsize(new), i, ucv;
+	int samesize = psf_width(old) == psf_width(new) && psf_height(old) == psf_height(new);
+	/* worst case: every glyph and every unicode value changed */
+	size_t bufsize = PSFX_HEADERSIZE + 1, len = PSFX_HEADERSIZE;
+	for (i = 0; i < newglyphs; ++i) {
+		bufsize += 2 * (1 + 5) + 2 * (size_t) charsize + 5 + 5 + 5 * (size_t) new->glyph[i].nucvals;
+	}
+	unsigned char *buf = psf_mem_alloc(&old->alloc, bufsize);
+	if (!buf) {
+		perror(__func__);
+		return 0;
+	}
+	uint64_t oldhash = psf_hash(old), newhash = psf_hash(new);
+	psf_put_int(buf, PSFX_MAGIC);
+	psf_put_int(buf + 4, PSFX_VERSION);
+	psf_put_int(buf + 8, new->version);
+	psf_put_int(buf + 12, psf_width(new));
+	psf_put_int(buf + 16, psf_height(new));
+	psf_put_int(buf + 20, newglyphs);
+	psf_put_int(buf + 24, psf_flags(new));
+	psf_put_int(buf + 28, (uint32_t) oldhash);
+	psf_put_int(buf + 32, (uint32_t) (oldhash >> 32));
+	psf_put_int(buf + 36, (uint32_t) newhash);
+	psf_put_int(buf + 40, (uint32_t) (newhash >> 32));
+
+	for (i = 0; i < newglyphs; ++i) {
+		struct psf_glyph *ng = &new->glyph[i], *og = i < oldglyphs ? &old->glyph[i] : 0;
+		const unsigned char *odata = og && samesize ? og->data : 0;
+		int changed = 0;
+		if (odata) {
+			changed = ng->data && memcmp(odata, ng->data, charsize) != 0;
+		} else {
+			unsigned int pos;
+			for (pos = 0; ng->data && pos < charsize && !changed; ++pos) { changed = ng->data[pos] != 0; }
+		}
+		if (changed) {
+			buf[len++] = PSFX_GLYPH;
+			len += psf_putvarint(buf + len, i);
+			len += psf_diff_xor(buf + len, odata, ng->data, charsize);
+		}
+		unsigned int onucvals = og ? og->nucvals : 0;
+		if (ng->nucvals != onucvals || (onucvals > 0 && memcmp(ng->ucvals, og->ucvals, onucvals * sizeof(unsigned int)) != 0)) {
+			buf[len++] = PSFX_UCVALS;
+			len += psf_putvarint(buf + len, i);
+			len += psf_putvarint(buf + len, ng->nucvals);
+			for (ucv = 0; ucv < ng->nucvals; ++ucv) {
+				len += psf_putvarint(buf + len, ng->ucvals[ucv]);
+			}
+		}
+	}
+	buf[len++] = PSFX_END;
+	unsigned char *shrunk = psf_mem_realloc(&old->alloc, buf, bufsize, len);
+	*size = len;
+	return shrunk ? shrunk : buf;
+}
+
+/* applies the xor runs of a PSFX_GLYPH record to data */
+static int psf_patch_xor(const unsigned char **ptr, const unsigned char *end, unsigned char *data, unsigned int charsize)
+{
+	unsigned int pos = 0, zeros, lit, i;
+	while (pos < charsize) {
+		if (!psfz_getvarint(ptr, end, &zeros) || zeros > charsize - pos) { return 0; }
+		pos += zeros;
+		if (pos == charsize) { break; }
+		if (!psfz_getvarint(ptr, end, &lit) || lit > charsize - pos || lit > (size_t) (end - *ptr)) { return 0; }
+		for (i = 0; i < lit; ++i) {
+			data[pos++] ^= *(*ptr)++;
+		}
+	}
+	return 1;
+}
+
+/* the delta is not trusted, so its unicode values are checked like psfc
+ * does: codepoints up to U+10FFFF and PSF1_STARTSEQ. psf1 stores them in
+ * 16 bits, where PSF1_SEPARATOR ends the list of a glyph.
+ */
+static int psf_patch_ucval(struct psf_font *psf, unsigned int val)
+{
+	if (val == PSF1_STARTSEQ || (psf->version == 1 ? val < PSF1_SEPARATOR : val <= 0x10ffff)) { return 1; }
+	fprintf(stderr, "psf_patch: unicode value %#x out of range\n", val);
+	return 0;
+}
+
+struct psf_font *psf_patch(struct psf_font *old, const unsigned char *delta, size_t size)
+{
+	if (size < PSFX_HEADERSIZE + 1 || psf_get_int(delta) != PSFX_MAGIC || psf_get_int(delta + 4) != PSFX_VERSION) {
+		fprintf(stderr, "%s: not a font delta\n", __func__);
+		return 0;
+	}
+	uint64_t oldhash = psf_get_int(delta + 28) | (uint64_t) psf_get_int(delta + 32) << 32;
+	uint64_t newhash = psf_get_int(delta + 36) | (uint64_t) psf_get_int(delta + 40) << 32;
+	if (psf_hash(old) != oldhash) {
+		fprintf(stderr, "%s: the delta was made for a different font\n", __func__);
+		return 0;
+	}
+	unsigned int version = psf_get_int(delta + 8), width = psf_get_int(delta + 12), height = psf_get_int(delta + 16);
+	unsigned int length = psf_get_int(delta + 20), flags = psf_get_int(delta + 24), i;
+	if ((version == 1 && (flags > 0xff || (length == 512) != ((flags & PSF1_MODE512) != 0) || (length != 256 && length != 512)))
+		|| (version == 2 && length > (1U << 24))) {
+		fprintf(stderr, "%s: invalid number of glyphs in delta\n", __func__);
+		return 0;
+	}
+	struct psf_font *psf = psf_new_ex(version, width, height, &old->alloc);
+	if (!psf) { return 0; }
+	int ok = psf_reserve(psf, length);
+	unsigned int oldglyphs = psf_numglyphs(old), charsize = psf_charsize(psf);
+	int samesize = psf_width(old) == width && psf_height(old) == height;
+	for (i = 0; ok && i < length; ++i) {
+		struct psf_glyph *glyph = psf_addglyph(psf, i);
+		ok = glyph && glyph->data;
+		if (ok && i < oldglyphs && samesize && old->glyph[i].data) {
+			memcpy(glyph->data, old->glyph[i].data, charsize);
+		}
+		if (ok && i < oldglyphs && old->glyph[i].nucvals > 0) {
+			glyph->ucvals = psf_mem_alloc(&psf->alloc, old->glyph[i].nucvals * sizeof(unsigned int));
+			ok = glyph->ucvals != 0;
+			if (ok) {
+				memcpy(glyph->ucvals, old->glyph[i].ucvals, old->glyph[i].nucvals * sizeof(unsigned int));
+				glyph->nucvals = old->glyph[i].nucvals;
+			}
+		}
+	}
+	if (!ok) { perror(__func__); }
+
+	const unsigned char *ptr = delta + PSFX_HEADERSIZE, *end = delta + size;
+	while (ok && ptr < end && *ptr != PSFX_END) {
+		unsigned int type = *ptr++, no, n, ucv;
+		ok = psfz_getvarint(&ptr, end, &no) && no < length;
+		if (ok && type == PSFX_GLYPH) {
+			ok = psf_patch_xor(&ptr, end, psf->glyph[no].data, charsize);
+		} else if (ok && type == PSFX_UCVALS) {
+			struct psf_glyph *glyph = &psf->glyph[no];
+			ok = psfz_getvarint(&ptr, end, &n) && n <= (size_t) (end - ptr);
+			psf_mem_free(&psf->alloc, glyph->ucvals);
+			glyph->ucvals = ok && n > 0 ? psf_mem_alloc(&psf->alloc, n * sizeof(unsigned int)) : 0;
+			glyph->nucvals = 0;
+			ok = ok && (n == 0 || glyph->ucvals);
+			for (ucv = 0; ok && ucv < n; ++ucv) {
+				ok = psfz_getvarint(&ptr, end, &glyph->ucvals[ucv]) && psf_patch_ucval(psf, glyph->ucvals[ucv]);
+				glyph->nucvals += ok;
+			}
+		} else {
+			ok = 0;
+		}
+		if (!ok) { fprintf(stderr, "%s: broken delta\n", __func__); }
+	}
+	if (ok && (ptr >= end || *ptr != PSFX_END)) {
+		fprintf(stderr, "%s: delta is truncated\n", __func__);
+		ok = 0;
+	}
+	if (ok) {
+		if (version == 1) {
+			psf->header.psf1.mode = flags;
+		} else {
+			psf->header.psf2.flags = flags;
+		}
+		if (psf_hash(psf) != newhash) {
+			fprintf(stderr, "%s: the patched font does not match the delta\n", __func__);
+			ok = 0;
+		}
+	}
+	/* psf_hash does not cover the lookup index, keep it if the font still
+	 * can have one
+	 */
+	if (ok && psf_hasindex(old) && psf->version == 2 && psf_hasunicodetable(psf)) {
+		ok = psf_buildindex(psf, 1);
+	}
+	if (!ok) {
+		psf_delete(psf);
+		return 0;
+	}
+	return psf;
+}
+
+/* shared fonts */
+
+#ifdef PSF_POSIX
+
+#define PSFS_ALIGNUP(n) (((n) + PSFS_ALIGN - 1) / PSFS_ALIGN * PSFS_ALIGN)
+
+int psf_share(struct psf_font *psf, const char *name)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), charsize = psf_charsize(psf), hastab, i;
+	hastab = psf->version == 1 ? (psf->header.psf1.mode & (PSF1_MODEHASTAB | PSF1_MODEHASSEQ)) != 0 : psf_hasunicodetable(psf);
+	if (hastab && !psf->index && !psf_buildindex(psf, 0)) { return 0; }
+	struct psf_index *idx = hastab ? psf->index : 0;
+	size_t nucvals = 0;
+	for (i = 0; i < numglyphs; ++i) {
+		nucvals += psf->glyph[i].nucvals;
+	}
+	size_t bitmaps = PSFS_HEADERSIZE;
+	size_t ucstart = PSFS_ALIGNUP(bitmaps + (size_t) numglyphs * charsize);
+	size_t ucvals = PSFS_ALIGNUP(ucstart + ((size_t) numglyphs + 1) * 4);
+	size_t index = PSFS_ALIGNUP(ucvals + nucvals * 4);
+	size_t indexwords = idx ? PSFI_NPAGES + (size_t) idx->npages * PSFI_PAGESIZE : 0;
+	size_t size = index + indexwords * 4;
+	if (size > 0xffffffffU) {
+		fprintf(stderr, "%s: font too large\n", __func__);
+		return 0;
+	}
+	uint64_t hash = psf_hash(psf);
+
+	if (shm_unlink(name) != 0 && errno != ENOENT) {
+		perror(name);
+		return 0;
+	}
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		perror(name);
+		return 0;
+	}
+	unsigned char *map = MAP_FAILED;
+	if (ftruncate(fd, size) == 0) {
+		map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(name);
+		shm_unlink(name);
+		return 0;
+	}
+
+	uint32_t *hdr = (uint32_t*) map;
+	hdr[1] = PSFS_VERSION;
+	hdr[2] = size;
+	hdr[3] = psf->version;
+	hdr[4] = psf_width(psf);
+	hdr[5] = psf_height(psf);
+	hdr[6] = charsize;
+	hdr[7] = numglyphs;
+	hdr[8] = psf->version == 1 ? psf->header.psf1.mode : psf->header.psf2.flags;
+	hdr[9] = bitmaps;
+	hdr[10] = ucstart;
+	hdr[11] = ucvals;
+	hdr[12] = nucvals;
+	hdr[13] = idx ? index : 0;
+	hdr[14] = idx ? idx->npages : 0;
+	hdr[15] = (uint32_t) hash;
+	hdr[16] = (uint32_t) (hash >> 32);
+	hdr[17] = idx && idx->persist ? PSFS_PERSIST : 0;
+	uint32_t *start = (uint32_t*) (map + ucstart), *val = (uint32_t*) (map + ucvals), n = 0;
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		if (glyph->data) { memcpy(map + bitmaps + (size_t) i * charsize, glyph->data, charsize); }
+		start[i] = n;
+		if (glyph->nucvals) { memcpy(&val[n], glyph->ucvals, glyph->nucvals * sizeof(uint32_t)); }
+		n += glyph->nucvals;
+	}
+	start[numglyphs] = n;
+	/* top and pages are contiguous */
+	if (idx) { memcpy(map + index, idx->top, indexwords * 4); }
+	/* nobody may see the magic before the rest */
+	__sync_synchronize();
+	hdr[0] = PSFS_MAGIC;
+	munmap(map, size);
+	return 1;
+}
+
+/* checks that a section of len bytes at offset off is within the segment */
+static int psf_shared_fits(uint32_t off, uint64_t len, size_t size)
+{
+	return off % 4 == 0 && off >= PSFS_HEADERSIZE && off <= size && len <= size - off;
+}
+
+struct psf_font *psf_attach_shared(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror(name);
+		return 0;
+	}
+	struct stat st;
+	const unsigned char *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= PSFS_HEADERSIZE && (uint64_t) st.st_size <= 0xffffffffU) {
+		map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s is not a shared font\n", __func__, name);
+		return 0;
+	}
+	size_t size = st.st_size;
+	const uint32_t *hdr = (const uint32_t*) map;
+	uint32_t version = hdr[3], width = hdr[4], height = hdr[5], charsize = hdr[6], length = hdr[7], flags = hdr[8];
+	uint32_t nucvals = hdr[12], index = hdr[13], npages = hdr[14], sflags = hdr[17], i;
+	int ok = hdr[0] == PSFS_MAGIC && hdr[1] == PSFS_VERSION && hdr[2] == size && sflags <= PSFS_PERSIST
+		&& (version == 1 || version == 2) && width > 0 && height > 0 && charsize == (width + 7) / 8 * height
+		&& (version == 2 || (width == 8 && flags <= PSF1_MAXMODE && length == ((flags & PSF1_MODE512) ? 512 : 256)))
+		&& psf_shared_fits(hdr[9], (uint64_t) length * charsize, size)
+		&& psf_shared_fits(hdr[10], ((uint64_t) length + 1) * 4, size)
+		&& psf_shared_fits(hdr[11], (uint64_t) nucvals * 4, size)
+		&& (index == 0 || (npages <= PSFI_NPAGES && psf_shared_fits(index, (PSFI_NPAGES + (uint64_t) npages * PSFI_PAGESIZE) * 4, size)));
+	const uint32_t *start = ok ? (const uint32_t*) (map + hdr[10]) : 0;
+	for (i = 0; ok && i < length; ++i) {
+		ok = start[i] <= start[i + 1];
+	}
+	ok = ok && start[0] == 0 && start[length] == nucvals;
+	const uint32_t *top = ok && index ? (const uint32_t*) (map + index) : 0;
+	for (i = 0; top && ok && i < PSFI_NPAGES; ++i) {
+		ok = top[i] == PSFI_NONE || top[i] < npages;
+	}
+	struct psf_font *psf = ok ? psf_new(version, width, height) : 0;
+	if (!psf) {
+		if (!ok) { fprintf(stderr, "%s: %s is not a shared font\n", __func__, name); }
+		munmap((void*) map, size);
+		return 0;
+	}
+	if (version == 1) {
+		psf->header.psf1.mode = flags;
+	} else {
+		psf->header.psf2.flags = flags;
+		psf->header.psf2.length = length;
+	}
+	psf_mem_free(&psf->alloc, psf->glyph);
+	psf->glyph = psf_mem_calloc(&psf->alloc, length, sizeof(struct psf_glyph));
+	psf->capacity = psf->glyph ? length : 0;
+	if (top && psf->glyph && (psf->index = psf_mem_calloc(&psf->alloc, 1, sizeof(struct psf_index))) != 0) {
+		psf->index->alloc = &psf->alloc;
+		psf->index->top = top;
+		psf->index->pages = top + PSFI_NPAGES;
+		psf->index->npages = npages;
+		/* so that saving the font keeps its PSFI section */
+		psf->index->persist = (sflags & PSFS_PERSIST) != 0;
+	}
+	psf->shared = map;
+	psf->sharedsize = size;
+	if (!psf->glyph || (top && !psf->index)) {
+		perror(__func__);
+		psf_delete(psf);
+		return 0;
+	}
+	/* the font is read only, the casts are safe */
+	const uint32_t *val = (const uint32_t*) (map + hdr[11]);
+	for (i = 0; i < length; ++i) {
+		psf->glyph[i].data = (unsigned char*) map + hdr[9] + (size_t) i * charsize;
+		psf->glyph[i].nucvals = start[i + 1] - start[i];
+		psf->glyph[i].ucvals = psf->glyph[i].nucvals ? (unsigned int*) &val[start[i]] : 0;
+	}
+	return psf;
+}
+
+int psf_unshare(const char *name)
+{
+	if (shm_unlink(name) != 0) {
+		perror(name);
+		return 0;
+	}
+	return 1;
+}
+
+#else
+
+int psf_share(struct psf_font *psf, const char *name)
+{
+	(void) psf;
+	(void) name;
+	fprintf(stderr, "%s: shared fonts are not supported\n", __func__);
+	return 0;
+}
+
+struct psf_font *psf_attach_shared(const char *name)
+{
+	(void) name;
+	fprintf(stderr, "%s: shared fonts are not supported\n", __func__);
+	return 0;
+}
+
+int psf_unshare(const char *name)
+{
+	(void) name;
+	fprintf(stderr, "%s: shared fonts are not supported\n", __func__);
+	return 0;
+}
+
+#endif /* PSF_POSIX */
@@ -12,6 +12,9 @@
 #ifndef psf_h
 #define psf_h
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* this first part is copied more or less verbatim from th above source */
 
 #define PSF1_MAGIC0     0x36
@@ -57,6 +60,115 @@ struct psf2_header {
 	/* charsize = height * ((width + 7) / 8) */
 };
 
+/* lookup index section. psf2 fonts with a unicode table may have this
+ * appended after the table, aligned to PSFI_ALIGN bytes from the start of
+ * the file. Standard psf readers stop after the unicode table and never see
+ * it. All values are 32 bit little endian:
+ *	magic, version, size of the section in bytes, number of pages,
+ *	PSFI_NPAGES top level entries (page number or PSFI_NONE),
+ *	pages of PSFI_PAGESIZE entries (glyph number or PSFI_NONE),
+ *	number of runs, and the runs (see psf_runs) as codepoint, glyph and
+ *	length, sorted by codepoint.
+ * The glyph for codepoint cp is page[top[cp / PSFI_PAGESIZE]][cp % PSFI_PAGESIZE].
+ * Version 1 sections end after the pages, their runs are found when needed.
+ */
+
+#define PSFI_MAGIC      0x49465350 /* "PSFI" */
+#define PSFI_VERSION    2
+#define PSFI_ALIGN      16
+#define PSFI_HEADERSIZE 16
+#define PSFI_PAGESIZE   256
+#define PSFI_NPAGES     (0x110000 / PSFI_PAGESIZE)
+#define PSFI_NONE       0xFFFFFFFF
+
+/* compressed container, for storing fonts where space is tight. It is not
+ * understood by other psf readers. All header values are 32 bit little
+ * endian:
+ *	magic, version, headersize (offset of the offset table), flags (psf2
+ *	flags), length, charsize, height, width, psf version of the font, psf1
+ *	mode, size of the glyph data in bytes, size of an offset (2 or 4)
+ * The header is followed by length + 1 little endian offsets into the glyph
+ * data, 16 bit if the glyph data is smaller than 64KiB, then the glyph data,
+ * and then the unicode table as stored in a psf font of that version. Glyph
+ * n takes up offset[n + 1] - offset[n] bytes, a blank glyph none at all.
+ * Glyph data starts with two varints (7 bits per byte, least significant
+ * first, high bit set on all but the last byte), first << 2 | method and
+ * nrows, which give the first row that is not blank and the number of rows
+ * stored; the rows around them are blank. The stored rows are encoded with
+ * one of the methods:
+ *	PSFZ_RAW	the rows as they are
+ *	PSFZ_ROWS	runs of rows, each starting with a byte n. If bit 7 is set, the
+ *				previous row (blank for the first one) is repeated
+ *				(n & 0x7f) + 1 times, otherwise n + 1 rows follow.
+ *	PSFZ_XOR	every row xor the row above (blank for the first one), as
+ *				runs of bytes, each starting with a byte n. If bit 7 is set,
+ *				(n & 0x7f) + 1 zero bytes are inserted, otherwise n + 1 bytes
+ *				follow.
+ */
+
+#define PSFZ_MAGIC0     0x50 /* "PSFZ" */
+#define PSFZ_MAGIC1     0x53
+#define PSFZ_MAGIC2     0x46
+#define PSFZ_MAGIC3     0x5a
+#define PSFZ_VERSION    1
+#define PSFZ_HEADERSIZE 48
+
+#define PSFZ_RAW        0
+#define PSFZ_ROWS       1
+#define PSFZ_XOR        2
+
+/* font delta, the changes from one font to another, see psf_diff. All
+ * header values are 32 bit little endian:
+ *	magic, version, psf version, width, height and length of the new font,
+ *	psf2 flags or psf1 mode of the new font, psf_hash of the old font and of
+ *	the new font as two values each, low half first.
+ * Records follow, each starting with a byte giving its type, with varints
+ * as in the compressed container:
+ *	PSFX_GLYPH	glyph number, then the new bitmap xor the old one (blank if
+ *				the old font has no such glyph or another glyph size), as
+ *				pairs of the number of zero bytes and the number of bytes that
+ *				follow, until charsize bytes are covered.
+ *	PSFX_UCVALS	glyph number, number of unicode values, and the new unicode
+ *				values of the glyph, with PSF1_STARTSEQ starting a sequence.
+ *	PSFX_END	end of the delta.
+ * Glyphs and unicode values without a record are the same as in the old
+ * font, glyphs added to it start out blank and without unicode values.
+ */
+
+#define PSFX_MAGIC      0x58465350 /* "PSFX" */
+#define PSFX_VERSION    1
+#define PSFX_HEADERSIZE 44
+
+#define PSFX_GLYPH      'G'
+#define PSFX_UCVALS     'U'
+#define PSFX_END        'E'
+
+/* shared font, a font in a POSIX shared memory segment, see psf_share. The
+ * layout is read only and uses offsets from the start of the segment instead
+ * of pointers, so that every process can map it anywhere. All values are 32
+ * bit words in host byte order:
+ *	magic (written last, when the segment is complete), version, size of
+ *	the segment, psf version, width, height, charsize, number of glyphs,
+ *	psf2 flags or psf1 mode, offset of the bitmaps, offset of the unicode
+ *	table starts, offset of the unicode values, number of unicode values,
+ *	offset of the lookup index or 0, number of index pages, psf_hash of the
+ *	font as two words, low half first, and flags: PSFS_PERSIST if the
+ *	font had a persistent lookup index (see psf_buildindex).
+ * The bitmaps of all glyphs follow each other. The unicode table is stored in
+ * compressed sparse row form: the values of glyph i are the values from
+ * start[i] to start[i + 1] - 1, with PSF1_STARTSEQ starting a sequence, and
+ * there are length + 1 starts. The lookup index has PSFI_NPAGES top level
+ * entries followed by the pages, as in a PSFI section. Sections are aligned
+ * to PSFS_ALIGN bytes.
+ */
+
+#define PSFS_MAGIC      0x53465350 /* "PSFS" */
+#define PSFS_VERSION    1
+#define PSFS_HEADERSIZE 72
+#define PSFS_ALIGN      8
+
+#define PSFS_PERSIST    1
+
 /* representation of a single glyph, including unicode mapping information */
 
 struct psf_glyph {
@@ -65,6 +177,30 @@ struct psf_glyph {
 	unsigned int* ucvals;
 };
 
+/* memory allocator for a font. All memory of a font, its glyph table,
+ * bitmaps, unicode values and lookup index, and the buffers used while
+ * loading and saving it, including the gzip streams, comes from its
+ * allocator, so that it can live in an arena or a pool. The allocator is
+ * copied into the font. Readers (see psf_reader_open_ex) and deltas made by
+ * psf_diff use it too. Font sets and usage histograms are not tied to one
+ * font and use malloc.
+ *	alloc	allocates size bytes, size is never 0. Returns 0 if there is not
+ *			enough memory.
+ *	realloc	resizes a block of oldsize bytes to size bytes, like realloc.
+ *			May be 0, then a new block is allocated and the old one copied.
+ *	free	frees a block. May be 0 for allocators that free everything at
+ *			once, like an arena.
+ *	ctx		passed to all functions
+ * The default allocator uses malloc, realloc and free.
+ */
+
+struct psf_allocator {
+	void *(*alloc)(void *ctx, size_t size);
+	void *(*realloc)(void *ctx, void *ptr, size_t oldsize, size_t size);
+	void (*free)(void *ctx, void *ptr);
+	void *ctx;
+};
+
 /* representation of a complete psf font. */
 
 struct psf_font {
@@ -74,6 +210,11 @@ struct psf_font {
 		struct psf2_header psf2;
 	} header;
 	struct psf_glyph *glyph;
+	unsigned int capacity;   /* number of allocated entries in glyph */
+	struct psf_index *index; /* codepoint lookup index, private */
+	struct psf_allocator alloc;
+	const void *shared;      /* segment of a shared font, private */
+	size_t sharedsize;
 };
 
 /* psf_width (macro)
@@ -124,9 +265,30 @@ struct psf_font {
  */
 struct psf_font *psf_new(unsigned int version, unsigned int width, unsigned int height);
 
+/* psf_new_ex
+ *
+ * like psf_new, but the font gets its memory from alloc. Bitmaps and unicode
+ * values that are changed directly instead of through the psf_* functions
+ * must be allocated from psf->alloc as well.
+ *
+ * Arguments:
+ *	version	psf version to create font file for
+ *	width	width of char. Must be 8 for version 1 fonts
+ *	height	height of char
+ *	alloc	the allocator, or 0 for the default one
+ *
+ * Returns:
+ *	a pointer to the allocated and initialized psf_font structure, or 0 on
+ *	error.
+ */
+struct psf_font *psf_new_ex(unsigned int version, unsigned int width, unsigned int height, const struct psf_allocator *alloc);
+
 /* psf_load_fromfile
  *
- * loads a psf font from a file handle
+ * loads a psf font from a file handle. If the library was built with
+ * PSF_WITH_ZLIB defined, gzip compressed fonts are detected by their magic
+ * number and decompressed on the fly. Fonts in the compressed container
+ * format (see psf_save_compressed) are decoded as well.
  *
  * Arguments:
  *	file	the file handle to load the font from
@@ -137,9 +299,24 @@ struct psf_font *psf_new(unsigned int version, unsigned int width, unsigned int
  */
 struct psf_font *psf_load_fromfile(FILE *file);
 
+/* psf_load_fromfile_ex
+ *
+ * like psf_load_fromfile, but the font gets its memory from alloc.
+ *
+ * Arguments:
+ *	file	the file handle to load the font from
+ *	alloc	the allocator, or 0 for the default one
+ *
+ * Returns:
+ *	a pointer to a psf_font structure containing the loaded font, or 0 on
+ *	error.
+ */
+struct psf_font *psf_load_fromfile_ex(FILE *file, const struct psf_allocator *alloc);
+
 /* psf_load
  *
- * load a psf font from a file
+ * load a psf font from a file. See psf_load_fromfile for gzip compressed
+ * font files.
  *
  * Arguments:
  *	filename	the name of the file to load the font from
@@ -150,6 +327,127 @@ struct psf_font *psf_load_fromfile(FILE *file);
  */
 struct psf_font *psf_load(const char *filename);
 
+/* psf_load_ex
+ *
+ * like psf_load, but the font gets its memory from alloc.
+ *
+ * Arguments:
+ *	filename	the name of the file to load the font from
+ *	alloc		the allocator, or 0 for the default one
+ *
+ * Returns:
+ *	a pointer to a psf_font structure containing the loaded font, or 0 on
+ *	error.
+ */
+struct psf_font *psf_load_ex(const char *filename, const struct psf_allocator *alloc);
+
+/* font properties that are in the header, see psf_probe */
+struct psf_info {
+	unsigned int version;		/* 1 or 2 */
+	unsigned int width, height;
+	unsigned int length;		/* number of glyphs */
+	unsigned int charsize;
+	unsigned int hasunicodetable;
+	unsigned int container;		/* PSF_PLAIN, PSF_GZIP or PSF_PSFZ */
+};
+
+#define PSF_PLAIN 0
+#define PSF_GZIP  1	/* gzip compressed, needs PSF_WITH_ZLIB */
+#define PSF_PSFZ  2	/* compressed container, see psf_save_compressed */
+
+/* psf_probe
+ *
+ * reads only the header of a font file, without loading glyphs or the
+ * unicode table. This is much cheaper than psf_load if only the properties
+ * of a font are needed. Unlike the other functions, it prints nothing if
+ * the file is not a font, so that directories with other files in them can
+ * be scanned.
+ *
+ * Arguments:
+ *	filename	name of the file to probe
+ *	info		filled with the properties of the font
+ *
+ * Returns:
+ *	1 if the file starts with a valid psf header, 0 if not or on error.
+ */
+int psf_probe(const char *filename, struct psf_info *info);
+
+/* a font that is read one glyph at a time, see psf_reader_open */
+struct psf_reader {
+	struct psf_font *psf;	/* the font header, without glyphs */
+	struct psf_glyph glyph;	/* the glyph read last */
+	unsigned int next;		/* number of the next glyph */
+	/* the rest is private */
+	FILE *file, *gz, *spill;
+	int whole, seeked;
+	long glyphpos, tabpos;
+	unsigned int ucvcap;
+	unsigned char *tbuf;
+	size_t tlen, tpos;
+	struct psf_allocator alloc;
+};
+
+/* psf_reader_open
+ *
+ * starts reading a font from a file handle one glyph at a time, so that
+ * only one glyph and its unicode values are in memory, however large the
+ * font is. The unicode table of psf1 and psf2 fonts comes after all bitmaps,
+ * so if the font has one, the reader reads the bitmaps and the table in
+ * step, seeking between them if the file is seekable. Otherwise the bitmaps
+ * are copied to a temporary file first. gzip compressed fonts are read like
+ * in psf_load_fromfile, compressed containers (see psf_save_compressed) are
+ * loaded whole.
+ *
+ * Arguments:
+ *	file	the file handle to read the font from. It must stay open until
+ *			the reader is closed.
+ *
+ * Returns:
+ *	a pointer to the new reader, or 0 on error. Its psf member has the
+ *	properties of the font, to be used with psf_width, psf_numglyphs etc.
+ */
+struct psf_reader *psf_reader_open(FILE *file);
+
+/* psf_reader_open_ex
+ *
+ * like psf_reader_open, but the reader, its buffers and the font header
+ * are allocated with alloc.
+ *
+ * Arguments:
+ *	file	the file handle to read the font from
+ *	alloc	the allocator to use, or 0 for malloc and free
+ *
+ * Returns:
+ *	a pointer to the new reader, or 0 on error.
+ */
+struct psf_reader *psf_reader_open_ex(FILE *file, const struct psf_allocator *alloc);
+
+/* psf_reader_next
+ *
+ * reads the next glyph.
+ *
+ * Arguments:
+ *	rd		the reader
+ *
+ * Returns:
+ *	a pointer to the glyph, which stays valid until the next call, or 0
+ *	after the last glyph or on error. If rd->next is less than the number of
+ *	glyphs then, there was an error.
+ */
+struct psf_glyph *psf_reader_next(struct psf_reader *rd);
+
+/* psf_reader_close
+ *
+ * frees a reader. Does not close the file handle it reads from.
+ *
+ * Arguments:
+ *	rd		the reader
+ *
+ * Returns:
+ *	-
+ */
+void psf_reader_close(struct psf_reader *rd);
+
 /* psf_save_tofile
  *
  * saves a psf_font structure to a psf font file handle
@@ -165,7 +463,15 @@ int psf_save_tofile(FILE *file, struct psf_font *psf);
 
 /* psf_save
  *
- * saves a psf_font structure to a psf font file
+ * saves a psf_font structure to a psf font file. If filename ends in .gz,
+ * the font is gzip compressed on the fly. This requires the library to be
+ * built with PSF_WITH_ZLIB defined, and fails otherwise.
+ * On POSIX systems, the font is written to a temp file in the same directory
+ * which is then renamed to filename, so readers never see a partially
+ * written font. The new file keeps the mode and, if permitted, the owner of
+ * the file it replaces, and a symlink is followed to the file it points to.
+ * Existing files that are not regular files (like /dev/stdout) are written
+ * to directly.
  *
  * Arguments:
  *	filename	the name of the file to save to
@@ -176,6 +482,51 @@ int psf_save_tofile(FILE *file, struct psf_font *psf);
  */
 int psf_save(const char *filename, struct psf_font *psf);
 
+/* psf_save_compressed_tofile
+ *
+ * saves a psf_font structure to a file handle in the compressed container
+ * format described above. The psf_load* functions read such files.
+ *
+ * Arguments:
+ *	file	the file handle to save to
+ *	psf		the psf_font structure to save
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_save_compressed_tofile(FILE *file, struct psf_font *psf);
+
+/* psf_save_compressed
+ *
+ * saves a psf_font structure to a file in the compressed container format.
+ * Otherwise works like psf_save.
+ *
+ * Arguments:
+ *	filename	the name of the file to save to
+ *	psf		the psf_font structure to save
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_save_compressed(const char *filename, struct psf_font *psf);
+
+/* psf_zglyph
+ *
+ * decodes a single glyph from a compressed font in memory, for example one
+ * that is mapped from flash, without loading the whole font.
+ *
+ * Arguments:
+ *	image	the compressed font file contents
+ *	size	size of image in bytes
+ *	no		glyph number
+ *	out		buffer for the bitmap, charsize bytes of packed rows as in a
+ *			psf font
+ *
+ * Returns:
+ *	1 on success, 0 if there is no such glyph or the data is broken.
+ */
+int psf_zglyph(const unsigned char *image, size_t size, unsigned int no, unsigned char *out);
+
 /* psf_delete
  *
  * clean up and delete a psf_font structure. This also calls free() on the
@@ -219,6 +570,40 @@ struct psf_glyph *psf_getglyph(struct psf_font *psf, unsigned int no);
  */
 struct psf_glyph *psf_addglyph(struct psf_font *psf, unsigned int no);
 
+/* psf_reserve
+ *
+ * makes room for num glyphs in a font without changing the number of glyphs
+ * in it. Use this if you know how many glyphs you will add with
+ * psf_addglyph, so that the glyph table needs to be allocated only once.
+ * The glyph table grows geometrically anyway, so this is only a hint. For
+ * psf1 fonts, this only checks that num is at most 512.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	num		the number of glyphs to make room for
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_reserve(struct psf_font *psf, unsigned int num);
+
+/* psf_resize
+ *
+ * changes the glyph size of a font. All bitmaps are replaced with blank
+ * ones of the new size, which come from the allocator of the font. psf1
+ * fonts must stay 8 pixels wide and at most 255 pixels high. Fails for
+ * shared fonts.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	width	new width in pixels
+ *	height	new height in pixels
+ *
+ * Returns:
+ *	1 on success, 0 on failure, then the font is unchanged.
+ */
+int psf_resize(struct psf_font *psf, unsigned int width, unsigned int height);
+
 /* psf_glyph_init
  *
  * (re-)initializes a glyph.
@@ -303,4 +688,495 @@ unsigned int psf_numglyphs(struct psf_font *psf);
  */
 unsigned int psf_hasunicodetable(struct psf_font *psf);
 
+/* psf_lookup
+ *
+ * finds the glyph for a unicode codepoint. Only single codepoints are looked
+ * up, not sequences. If the font has no unicode table, the codepoint is used
+ * as glyph number. The first call builds a lookup index unless the font was
+ * loaded with one (see psf_buildindex), after that lookups take constant
+ * time. Changing the font discards the index.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	cp		the unicode codepoint
+ *
+ * Returns:
+ *	the number of the glyph for cp, or -1 if there is none.
+ */
+int psf_lookup(struct psf_font *psf, unsigned int cp);
+
+/* psf_buildindex
+ *
+ * (re-)builds the codepoint lookup index for a font. If persist is set, the
+ * index is also written when the font is saved, so that loading the font
+ * later needs no index building. Fonts loaded with an index keep it when
+ * saved again, unless they are changed. Only psf2 fonts with a unicode table
+ * can store an index. When loaded with psf_load from an uncompressed file,
+ * the stored index is mmap()ed where available.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	persist	1 to save the index with the font, 0 to not do so
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_buildindex(struct psf_font *psf, int persist);
+
+/* psf_dropindex
+ *
+ * discards the lookup index of a font, so it will not be saved with the
+ * font any more.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *
+ * Returns:
+ *	-
+ */
+void psf_dropindex(struct psf_font *psf);
+
+/* psf_hasindex
+ *
+ * checks whether a font has a lookup index that will be saved with it
+ *
+ * Arguments:
+ *	psf		the psf font
+ *
+ * Returns:
+ *	1 if the font has a persistent lookup index, 0 if not.
+ */
+unsigned int psf_hasindex(struct psf_font *psf);
+
+/* a run of consecutive codepoints mapped to consecutive glyphs: codepoint
+ * cp + i has glyph glyph + i for all i < len.
+ */
+struct psf_run {
+	uint32_t cp;
+	uint32_t glyph;
+	uint32_t len;
+};
+
+/* psf_runs
+ *
+ * returns the runs of at least two codepoints in the unicode table of a
+ * font. A renderer can keep the run of the last character and resolve the
+ * next one with a subtraction if it falls into the same run. After
+ * psf_sort, most text stays within a few runs. The runs are part of the
+ * lookup index, which is built if the font has none, and stored with it.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	nruns	set to the number of runs
+ *
+ * Returns:
+ *	the runs, sorted by codepoint, valid until the font is changed, or 0
+ *	with *nruns = 0 if there are none or on error. Fonts without a unicode
+ *	table have no runs.
+ */
+const struct psf_run *psf_runs(struct psf_font *psf, unsigned int *nruns);
+
+/* psf_permute
+ *
+ * reorders the glyphs of a font, together with their unicode values.
+ * Discards the lookup index.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	order	for each new glyph number, the old number of the glyph. Must
+ *			have psf_numglyphs(psf) entries, each glyph exactly once.
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_permute(struct psf_font *psf, const unsigned int *order);
+
+/* psf_sort
+ *
+ * reorders the glyphs of a font with a unicode table by their lowest single
+ * codepoint, so that runs of consecutive codepoints get consecutive glyph
+ * numbers and neighbouring characters are next to each other in memory.
+ * Glyphs without a single codepoint go to the end, in their previous order.
+ * The lookup index is rebuilt with the runs (see psf_runs), and stays
+ * persistent if it was.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_sort(struct psf_font *psf);
+
+/* glyph usage histogram, counts per codepoint. Saved as text, a line
+ * "psfusage 1" followed by one line "U+<hex> <count>" per codepoint that
+ * was counted.
+ */
+struct psf_usage;
+
+/* psf_usage_new
+ *
+ * allocates an empty usage histogram. Counters are allocated in pages of
+ * PSFI_PAGESIZE codepoints when they are first used.
+ *
+ * Arguments:
+ *	-
+ *
+ * Returns:
+ *	the histogram, or 0 on error.
+ */
+struct psf_usage *psf_usage_new(void);
+
+/* psf_usage_delete
+ *
+ * frees a usage histogram.
+ *
+ * Arguments:
+ *	usage	the histogram
+ *
+ * Returns:
+ *	-
+ */
+void psf_usage_delete(struct psf_usage *usage);
+
+/* psf_usage_count
+ *
+ * adds to the counter for a codepoint. Renderers call this for every
+ * character they draw, see the usage member of struct vt.
+ *
+ * Arguments:
+ *	usage	the histogram
+ *	cp		the codepoint
+ *	n		the number to add
+ *
+ * Returns:
+ *	1 on success, 0 if cp is out of range or there is not enough memory.
+ */
+int psf_usage_count(struct psf_usage *usage, unsigned int cp, unsigned long long n);
+
+/* psf_usage_get
+ *
+ * returns the counter for a codepoint.
+ *
+ * Arguments:
+ *	usage	the histogram
+ *	cp		the codepoint
+ *
+ * Returns:
+ *	the counter.
+ */
+unsigned long long psf_usage_get(struct psf_usage *usage, unsigned int cp);
+
+/* psf_usage_load
+ *
+ * reads a saved histogram and adds it to one in memory.
+ *
+ * Arguments:
+ *	usage	the histogram
+ *	file	the file to read from
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_usage_load(struct psf_usage *usage, FILE *file);
+
+/* psf_usage_save
+ *
+ * writes a histogram to a file.
+ *
+ * Arguments:
+ *	usage	the histogram
+ *	file	the file to write to
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int psf_usage_save(struct psf_usage *usage, FILE *file);
+
+/* psf_layout
+ *
+ * reorders the glyphs of a font with a unicode table so that the glyphs
+ * used most are at the start of the bitmap data, and a renderer touches as
+ * few pages and cache lines as possible. The hot glyphs are the fewest that
+ * make up percent of all uses. They come first, sorted by codepoint like
+ * psf_sort does, followed by the others, also sorted by codepoint. The
+ * number of glyphs does not change, so psf1 fonts keep their 256 or 512.
+ * The lookup index is rebuilt, and stays persistent if it was.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	usage	how often each codepoint was used
+ *	percent	share of all uses the hot glyphs make up, 1 to 100
+ *
+ * Returns:
+ *	the number of hot glyphs, or -1 on failure.
+ */
+int psf_layout(struct psf_font *psf, struct psf_usage *usage, unsigned int percent);
+
+/* a font set stacks several fonts of the same cell size in priority order.
+ * Codepoints are resolved through one merged lookup index, so a codepoint
+ * missing in one font falls through to the next one in constant time.
+ */
+struct psf_fontset;
+
+/* psf_fontset_new
+ *
+ * allocates a new, empty font set.
+ *
+ * Arguments:
+ *	-
+ *
+ * Returns:
+ *	a pointer to the new font set, or 0 on error.
+ */
+struct psf_fontset *psf_fontset_new(void);
+
+/* psf_fontset_add
+ *
+ * adds a font to a font set, with lower priority than all fonts added
+ * before. All fonts in a set must have the same width and height. The set
+ * takes ownership of the font, and the font must not be changed while it is
+ * in the set. A set can hold up to 255 fonts with up to 2^24 glyphs each.
+ *
+ * Arguments:
+ *	set		the font set
+ *	psf		the font to add
+ *
+ * Returns:
+ *	1 on success, 0 on failure. On failure, the font is not added and the
+ *	caller still owns it.
+ */
+int psf_fontset_add(struct psf_fontset *set, struct psf_font *psf);
+
+/* psf_fontset_lookup
+ *
+ * finds the glyph for a unicode codepoint in the first font of a set that
+ * has one. See psf_lookup.
+ *
+ * Arguments:
+ *	set		the font set
+ *	cp		the unicode codepoint
+ *	font	if not 0, the font the glyph is from is stored here
+ *
+ * Returns:
+ *	the number of the glyph for cp within *font, or -1 if none of the fonts
+ *	has a glyph for cp.
+ */
+int psf_fontset_lookup(struct psf_fontset *set, unsigned int cp, struct psf_font **font);
+
+/* psf_fontset_font
+ *
+ * returns a font from a font set.
+ *
+ * Arguments:
+ *	set		the font set
+ *	no		the number of the font, in the order they were added
+ *
+ * Returns:
+ *	the font, or 0 if the set has less than no + 1 fonts.
+ */
+struct psf_font *psf_fontset_font(struct psf_fontset *set, unsigned int no);
+
+/* psf_fontset_delete
+ *
+ * deletes a font set and all fonts in it.
+ *
+ * Arguments:
+ *	set		the font set
+ *
+ * Returns:
+ *	-
+ */
+void psf_fontset_delete(struct psf_fontset *set);
+
+/* number of unicode codepoints, and size of a coverage bitset in words */
+#define PSF_MAXUNICODE     0x110000
+#define PSF_COVERAGE_WORDS (PSF_MAXUNICODE / 32)
+
+/* psf_coverage
+ *
+ * computes the set of codepoints a font has glyphs for, as a bitset where
+ * codepoint cp is bit (cp % 32) of bits[cp / 32]. Only single codepoints
+ * count, not sequences. For fonts without a unicode table, every glyph
+ * number counts as a codepoint.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *	bits	array of PSF_COVERAGE_WORDS words to store the bitset in
+ *
+ * Returns:
+ *	the number of codepoints covered by the font.
+ */
+unsigned int psf_coverage(struct psf_font *psf, uint32_t *bits);
+
+/* psf_charsize (macro)
+ *
+ * return the number of bytes used for the bitmap of a single glyph
+ *
+ * Arguments:
+ *	psf		the psf font
+ *
+ * Returns:
+ *	the size of a glyph bitmap in bytes
+ */
+#define psf_charsize(psf) (((psf)->version == 1) ? (psf)->header.psf1.charsize : (psf)->header.psf2.charsize)
+
+/* PSF_HASH_SEED
+ *
+ * initial value for a hash computed with psf_hash_data
+ */
+#define PSF_HASH_SEED 0x2f2b2d5f70736621ULL
+
+/* psf_hash_data
+ *
+ * feeds a block of data into a 64 bit hash. Start with PSF_HASH_SEED and
+ * pass the result of each call as h to the next one. The result depends on
+ * how the data is split into blocks, so always hash the same pieces. The
+ * hash is fast but not cryptographically secure, and it is the same on all
+ * platforms.
+ *
+ * Arguments:
+ *	h		hash value so far
+ *	data	data to add to the hash
+ *	len		length of data in bytes
+ *
+ * Returns:
+ *	the new hash value
+ */
+uint64_t psf_hash_data(uint64_t h, const void *data, size_t len);
+
+/* PSF_VARINT_MAX
+ *
+ * longest encoding of a 64 bit value written by psf_putvarint
+ */
+#define PSF_VARINT_MAX 10
+
+/* psf_putvarint
+ *
+ * encodes an unsigned value as a varint: 7 bits per byte, least
+ * significant group first, the high bit set on all bytes but the last.
+ * This is the encoding used in PSFZ glyph headers and PSFX deltas.
+ *
+ * Arguments:
+ *	buf		where to store the encoding, at least PSF_VARINT_MAX bytes
+ *	val		value to encode
+ *
+ * Returns:
+ *	the number of bytes written
+ */
+unsigned int psf_putvarint(unsigned char *buf, uint64_t val);
+
+/* psf_getvarint
+ *
+ * decodes a varint written by psf_putvarint.
+ *
+ * Arguments:
+ *	ptr		start of the varint, advanced past it on success
+ *	end		end of the available data
+ *	val		where to store the value
+ *
+ * Returns:
+ *	1 on success, 0 if the varint runs past end or does not fit in 64 bits
+ */
+int psf_getvarint(const unsigned char **ptr, const unsigned char *end, uint64_t *val);
+
+/* psf_hash
+ *
+ * computes a 64 bit digest of a font, covering the version and geometry,
+ * all glyph bitmaps and the unicode table. Two fonts with the same hash
+ * can be considered identical. How the font is stored in a file (e.g.
+ * gzip compressed or not) does not change the hash.
+ *
+ * Arguments:
+ *	psf		the psf font
+ *
+ * Returns:
+ *	the hash value
+ */
+uint64_t psf_hash(struct psf_font *psf);
+
+/* psf_diff
+ *
+ * encodes the changes from one font to another as a delta (see PSFX_MAGIC).
+ * Glyphs are compared by number, changed bitmaps are stored as xor with the
+ * old bitmap, so a few changed pixels take a few bytes. Glyphs added at or
+ * removed from the end, new unicode values and a new glyph size are also
+ * covered.
+ *
+ * Arguments:
+ *	old		the old font
+ *	new		the new font
+ *	size	set to the size of the delta in bytes
+ *
+ * Returns:
+ *	the delta, allocated with the allocator of old, so to be freed with
+ *	free() if old has the default one, or 0 on error.
+ */
+unsigned char *psf_diff(struct psf_font *old, struct psf_font *new, size_t *size);
+
+/* psf_patch
+ *
+ * applies a delta made by psf_diff to a font. The font must have the hash
+ * the delta was made from, and the result is checked against the hash of
+ * the new font. The new font uses the allocator of the old one. If the old
+ * font has a persistent lookup index (see psf_buildindex), the new one gets
+ * one too, unless it is no psf2 font with a unicode table any more.
+ *
+ * Arguments:
+ *	old		the old font, which is not changed
+ *	delta	the delta
+ *	size	size of the delta in bytes
+ *
+ * Returns:
+ *	the new font, or 0 on error.
+ */
+struct psf_font *psf_patch(struct psf_font *old, const unsigned char *delta, size_t size);
+
+/* psf_share
+ *
+ * copies a font into a new POSIX shared memory segment, from which other
+ * processes can use it with psf_attach_shared. An existing segment of the
+ * same name is removed first; processes attached to it keep the old font.
+ * The segment stays until it is removed with psf_unshare, even when the
+ * process that made it ends. Only available on POSIX systems.
+ *
+ * Arguments:
+ *	psf		the font
+ *	name	name of the segment, starting with a /
+ *
+ * Returns:
+ *	1 on success, 0 on error.
+ */
+int psf_share(struct psf_font *psf, const char *name);
+
+/* psf_attach_shared
+ *
+ * maps a font made by psf_share. Bitmaps, unicode values and the lookup
+ * index are used straight from the segment, only the table of glyph pointers
+ * is allocated. The font is read only: functions that change it fail, and
+ * the bitmaps and unicode values must not be written to. If the shared font
+ * had a persistent lookup index, psf_hasindex is true for the attached one,
+ * so saving it keeps the index. psf_delete detaches from the segment.
+ *
+ * Arguments:
+ *	name	name of the segment, as given to psf_share
+ *
+ * Returns:
+ *	the font, or 0 on error.
+ */
+struct psf_font *psf_attach_shared(const char *name);
+
+/* psf_unshare
+ *
+ * removes a shared memory segment made by psf_share. Processes attached to
+ * it keep the font until they delete it.
+ *
+ * Arguments:
+ *	name	name of the segment
+ *
+ * Returns:
+ *	1 on success, 0 on error.
+ */
+int psf_unshare(const char *name);
+
 #endif /* psf_h */
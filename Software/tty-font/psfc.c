@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/stat.h>
 #include "psf.h"
 #include "psftools_version.h"
 
@@ -70,7 +71,60 @@ static int readunichar(char *line, int *ppos, unsigned int lineno)
 	return res;
 }
 
-static int psfc_compile_char(struct psf_font *psf, char pixel, char *spec, FILE *in, unsigned int *plineno)
+/* state for incremental compilation (psfc --update). Every glyph block in
+ * the text input is fingerprinted, and glyphs whose block is unchanged
+ * since the last compilation are copied from the old font instead of being
+ * parsed again.
+ */
+struct psfc_update {
+	struct psf_font *old;	/* previously compiled font */
+	uint64_t oldheader;		/* header fingerprint of the old font */
+	uint64_t *oldfp;		/* glyph fingerprints of the old font, 0 = unknown */
+	unsigned int noldfp;
+	uint64_t header;		/* header fingerprint of the new font */
+	uint64_t *fp;			/* glyph fingerprints of the new font */
+	unsigned int nfp;
+};
+
+static int psfc_update_setfp(struct psfc_update *upd, unsigned int no, uint64_t fp)
+{
+	if (no >= upd->nfp) {
+		unsigned int nnfp = upd->nfp ? upd->nfp : 256;
+		while (nnfp <= no) { nnfp *= 2; }
+		uint64_t *newfp = realloc(upd->fp, nnfp * sizeof(uint64_t));
+		if (!newfp) {
+			perror("psfc");
+			return 0;
+		}
+		memset(&newfp[upd->nfp], 0, (nnfp - upd->nfp) * sizeof(uint64_t));
+		upd->fp = newfp;
+		upd->nfp = nnfp;
+	}
+	upd->fp[no] = fp;
+	return 1;
+}
+
+/* copies glyph <no> from the old font if its fingerprint did not change.
+ * Returns 1 if the glyph was copied, 0 if it must be compiled.
+ */
+static int psfc_update_reuse(struct psf_font *psf, struct psfc_update *upd, unsigned int no, uint64_t fp)
+{
+	if (!upd->old || upd->oldheader != upd->header || psf_charsize(upd->old) != psf_charsize(psf)) { return 0; }
+	if (no >= upd->noldfp || upd->oldfp[no] != fp || fp == 0) { return 0; }
+	struct psf_glyph *oldglyph = psf_getglyph(upd->old, no);
+	if (!oldglyph || !oldglyph->data) { return 0; }
+
+	struct psf_glyph *glyph = psf_addglyph(psf, no);
+	if (!glyph) { return 0; }
+	memcpy(glyph->data, oldglyph->data, psf_charsize(psf));
+	unsigned int ucv;
+	for (ucv = 0; ucv < oldglyph->nucvals; ++ucv) {
+		if (!psf_glyph_adducval(psf, glyph, oldglyph->ucvals[ucv])) { return 0; }
+	}
+	return 1;
+}
+
+static int psfc_compile_char(struct psf_font *psf, char pixel, char *spec, FILE *in, unsigned int *plineno, char *rows, struct psfc_update *upd)
 {
 	int pos = 0;
 	unsigned int x, y, lineno = *plineno;
@@ -83,6 +137,28 @@ static int psfc_compile_char(struct psf_font *psf, char pixel, char *spec, FILE
 	int no = readnum(spec, &pos);
 	pos = skipws(spec, pos);
 
+	/* read glyph data first, so that the whole block can be fingerprinted */
+	char *line;
+	for (y = 0; y < psf_height(psf); ++y) {
+		line = fgets(&rows[y * LINEBUFSIZE], LINEBUFSIZE, in);
+		if (!line) {
+			fprintf(stderr, "psfc: unexpected end of file in line %u\n", lineno + y);
+			return 0;
+		}
+	}
+	if (upd) {
+		uint64_t fp = psf_hash_data(upd->header, spec, strlen(spec));
+		for (y = 0; y < psf_height(psf); ++y) {
+			line = &rows[y * LINEBUFSIZE];
+			fp = psf_hash_data(fp, line, strlen(line));
+		}
+		if (!psfc_update_setfp(upd, no, fp)) { return 0; }
+		if (psfc_update_reuse(psf, upd, no, fp)) {
+			*plineno = lineno + psf_height(psf);
+			return 1;
+		}
+	}
+
 	/* unicode tables */
 	struct psf_glyph *glyph = psf_addglyph(psf, no);
 	if (spec[pos] == ':') {
@@ -106,13 +182,8 @@ static int psfc_compile_char(struct psf_font *psf, char pixel, char *spec, FILE
 	}
 
 	/* glyph data */
-	char lnbuf[LINEBUFSIZE], *line;
 	for (y = 0; y < psf_height(psf); ++y) {
-		line = fgets(lnbuf, LINEBUFSIZE, in);
-		if (!line) {
-			fprintf(stderr, "psfc: unexpected end of file in line %u\n", lineno);
-			return 0;
-		}
+		line = &rows[y * LINEBUFSIZE];
 		++lineno;
 		pos = 0;
 		for (x = 0; x < psf_width(psf); ++x) {
@@ -132,11 +203,11 @@ static int psfc_compile_char(struct psf_font *psf, char pixel, char *spec, FILE
 	return 1;
 }
 
-static struct psf_font *psfc_compile(FILE *in)
+static struct psf_font *psfc_compile(FILE *in, struct psfc_update *upd)
 {
 	char lnbuf[LINEBUFSIZE], *line;
 	int pos;
-	unsigned int version = 0, width = 0, height = 0, lineno = 0;
+	unsigned int version = 0, width = 0, height = 0, length = 0, lineno = 0;
 	char pixel = '\0';
 
 	/* read header */
@@ -181,6 +252,18 @@ static struct psf_font *psfc_compile(FILE *in)
 				fprintf(stderr, "psfc: invalid height spec in line %u\n", lineno);
 				return 0;
 			}
+		} else if (strncmp(&line[pos], "length:", 7) == 0) {
+			if (length != 0) {
+				fprintf(stderr, "psfc: duplicate length spec in line %u\n", lineno);
+				return 0;
+			}
+			pos = skipws(line, pos + 7);
+			length = readnum(line, &pos);
+			pos = skipws(line, pos);
+			if (length == 0 || (line[pos] && line[pos] != '#')) {
+				fprintf(stderr, "psfc: invalid length spec in line %u\n", lineno);
+				return 0;
+			}
 		} else if (strncmp(&line[pos], "pixel:", 6) == 0) {
 			if (pixel != 0) {
 				fprintf(stderr, "psfc: duplicate pixel spec in line %u\n", lineno);
@@ -216,12 +299,31 @@ static struct psf_font *psfc_compile(FILE *in)
 		pixel = '#';
 	}
 
+	if (upd) {
+		char hdr[64];
+		snprintf(hdr, sizeof(hdr), "%s %u %u %u %d", PSFTOOLS_VERSION, version, width, height, pixel);
+		upd->header = psf_hash_data(PSF_HASH_SEED, hdr, strlen(hdr));
+	}
+
 	struct psf_font *psf = psf_new(version, width, height);
 	if (!psf) { return 0; }
+	/* Length: is only a hint, the glyph table grows as needed */
+	if (length > PSF_MAXUNICODE) { length = PSF_MAXUNICODE; }
+	if (length && !psf_reserve(psf, length)) {
+		psf_delete(psf);
+		return 0;
+	}
+	char *rows = malloc(height * LINEBUFSIZE);
+	if (!rows) {
+		perror("psfc");
+		psf_delete(psf);
+		return 0;
+	}
 
 	while (line) {
 		lowercasify(line);
-		if (!psfc_compile_char(psf, pixel, line, in, &lineno)) {
+		if (!psfc_compile_char(psf, pixel, line, in, &lineno, rows, upd)) {
+			free(rows);
 			psf_delete(psf);
 			return 0;
 		}
@@ -233,34 +335,271 @@ static struct psf_font *psfc_compile(FILE *in)
 			}
 		} while (line && (*line == 0 || *line == '#'));
 	}
+	free(rows);
 	return psf;
 }
 
+/* reads the glyph fingerprints stored with a font by a previous run of
+ * psfc --update. A missing or broken fingerprint file is not an error, it
+ * just means that all glyphs are compiled. Neither is a fingerprint file
+ * that belongs to another font, like when old.psf was changed by another
+ * tool since.
+ */
+static void psfc_update_readfp(struct psfc_update *upd, const char *fpfile)
+{
+	FILE *file = fopen(fpfile, "r");
+	if (!file) { return; }
+	unsigned long long fp, hash;
+	unsigned int no, fmt, width, height, charsize;
+	int valid = fscanf(file, "psfc-fp %u header %llx font %llx %u %u %u", &fmt, &fp, &hash, &width, &height, &charsize) == 6
+		&& fmt == 2 && hash == psf_hash(upd->old) && width == psf_width(upd->old)
+		&& height == psf_height(upd->old) && charsize == psf_charsize(upd->old);
+	if (valid) {
+		upd->oldheader = fp;
+		while (fscanf(file, "%u %llx", &no, &fp) == 2) {
+			if (no >= psf_numglyphs(upd->old) || no >= PSF_MAXUNICODE) {
+				valid = 0;
+				break;
+			}
+			if (no >= upd->noldfp) {
+				unsigned int nnfp = upd->noldfp ? upd->noldfp : 256;
+				while (nnfp <= no) { nnfp *= 2; }
+				uint64_t *newfp = realloc(upd->oldfp, nnfp * sizeof(uint64_t));
+				if (!newfp) { break; }
+				memset(&newfp[upd->noldfp], 0, (nnfp - upd->noldfp) * sizeof(uint64_t));
+				upd->oldfp = newfp;
+				upd->noldfp = nnfp;
+			}
+			upd->oldfp[no] = fp;
+		}
+	}
+	if (!valid) {
+		free(upd->oldfp);
+		upd->oldfp = 0;
+		upd->noldfp = 0;
+	}
+	fclose(file);
+}
+
+static int psfc_update_writefp(struct psfc_update *upd, struct psf_font *psf, const char *fpfile)
+{
+	FILE *file = fopen(fpfile, "w");
+	if (!file) {
+		perror("psfc: could not write fingerprint file");
+		return 0;
+	}
+	unsigned int no;
+	fprintf(file, "psfc-fp 2\nheader %016llx\n", (unsigned long long) upd->header);
+	fprintf(file, "font %016llx %u %u %u\n", (unsigned long long) psf_hash(psf), psf_width(psf), psf_height(psf), psf_charsize(psf));
+	for (no = 0; no < upd->nfp; ++no) {
+		if (upd->fp[no]) {
+			fprintf(file, "%u %016llx\n", no, (unsigned long long) upd->fp[no]);
+		}
+	}
+	return fclose(file) == 0;
+}
+
+/* reads all of a file into a 0 terminated buffer and normalizes line ends
+ * (\r\n -> \n) on the way.
+ */
+static char *psfc_readall(FILE *in, size_t *psize)
+{
+	char *buf = 0;
+	size_t size = 0, alloced = 0, nrd;
+	do {
+		if (alloced - size < BUFSIZ + 1) {
+			alloced = alloced ? alloced * 2 : 65536;
+			char *newbuf = realloc(buf, alloced);
+			if (!newbuf) {
+				perror("psfc");
+				free(buf);
+				return 0;
+			}
+			buf = newbuf;
+		}
+		nrd = fread(&buf[size], 1, alloced - size - 1, in);
+		size += nrd;
+	} while (nrd > 0);
+	if (ferror(in)) {
+		perror("psfc");
+		free(buf);
+		return 0;
+	}
+
+	size_t rd, wr = 0;
+	for (rd = 0; rd < size; ++rd) {
+		if (buf[rd] == '\r' && rd + 1 < size && buf[rd + 1] == '\n') { continue; }
+		buf[wr++] = buf[rd];
+	}
+	buf[wr] = '\0';
+	*psize = wr;
+	return buf;
+}
+
+/* writes a font to outfile or stdout, compressed if asked to */
+static int psfc_output(struct psf_font *psf, const char *outfile, int compress)
+{
+	if (outfile) {
+		return compress ? psf_save_compressed(outfile, psf) : psf_save(outfile, psf);
+	}
+	return compress ? psf_save_compressed_tofile(stdout, psf) : psf_save_tofile(stdout, psf);
+}
+
+/* psf_save replaces regular files atomically, so a failed save leaves
+ * nothing behind in them. Anything else may already hold part of a font.
+ */
+static int psfc_isregular(const char *outfile)
+{
+	struct stat st;
+	if (!outfile) { return 0; }
+	return stat(outfile, &st) != 0 || S_ISREG(st.st_mode);
+}
+
+/* looks up a text font in the compile cache. Returns 1 and writes the font
+ * to outfile (or stdout) on a hit, 0 on a miss or a broken entry, and -1 if
+ * writing the font failed in a way that can not be undone.
+ */
+static int psfc_cache_fetch(const char *cachefile, const char *outfile, int compress)
+{
+	FILE *cached = fopen(cachefile, "rb");
+	if (!cached) { return 0; }
+	/* only entries that load as a font are used */
+	struct psf_font *psf = psf_load_fromfile(cached);
+	fclose(cached);
+	if (!psf) {
+		fprintf(stderr, "psfc: warning: ignoring broken cache entry %s\n", cachefile);
+		return 0;
+	}
+	int ok = psfc_output(psf, outfile, compress);
+	psf_delete(psf);
+	if (ok) { return 1; }
+	return psfc_isregular(outfile) ? 0 : -1;
+}
+
+/* stores a compiled font in the compile cache. psf_save replaces files
+ * atomically, so concurrent runs never see partial entries.
+ */
+static void psfc_cache_store(const char *cachefile, struct psf_font *psf)
+{
+	if (!psf_save(cachefile, psf)) {
+		fprintf(stderr, "psfc: warning: could not write cache entry %s\n", cachefile);
+	}
+}
+
+/* psfc --update old.psf new.txt out.psf
+ */
+static int psfc_update(const char *oldfile, const char *infile, const char *outfile)
+{
+	struct psfc_update upd;
+	memset(&upd, 0, sizeof(upd));
+	char fpfile[FILENAME_MAX];
+
+	/* without an old font or its fingerprints, everything is compiled */
+	FILE *old = fopen(oldfile, "rb");
+	if (old) {
+		upd.old = psf_load_fromfile(old);
+		fclose(old);
+		snprintf(fpfile, FILENAME_MAX, "%s.fp", oldfile);
+		if (upd.old) { psfc_update_readfp(&upd, fpfile); }
+	}
+
+	FILE *in = strcmp(infile, "-") != 0 ? fopen(infile, "r") : stdin;
+	if (!in) {
+		perror("psfc: could not open input file");
+		return 0;
+	}
+	struct psf_font *psf = psfc_compile(in, &upd);
+	if (in != stdin) { fclose(in); }
+
+	int ok = 0;
+	if (psf) {
+		/* write the fingerprints only once the font is in place */
+		snprintf(fpfile, FILENAME_MAX, "%s.fp", outfile);
+		remove(fpfile);
+		ok = psf_save(outfile, psf) && psfc_update_writefp(&upd, psf, fpfile);
+		psf_delete(psf);
+	}
+	if (upd.old) { psf_delete(upd.old); }
+	free(upd.oldfp);
+	free(upd.fp);
+	return ok;
+}
+
 int main(int argc, char **argv)
 {
-	if (argc < 1 || argc > 3 || (argv[1] && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")))) {
-		fprintf(stderr, "%s [file.txt [file.psf]]\n", argv[0]);
+	if (argc >= 2 && !strcmp(argv[1], "--update")) {
+		if (argc != 5) {
+			fprintf(stderr, "%s --update old.psf file.txt file.psf\n", argv[0]);
+			exit(1);
+		}
+		exit(psfc_update(argv[2], argv[3], argv[4]) == 0);
+	}
+
+	const char *cachedir = 0;
+	int arg = 1, compress = 0;
+	while (arg < argc) {
+		if (arg + 1 < argc && !strcmp(argv[arg], "-c")) {
+			cachedir = argv[arg + 1];
+			arg += 2;
+		} else if (!strcmp(argv[arg], "--compress")) {
+			compress = 1;
+			++arg;
+		} else {
+			break;
+		}
+	}
+	if (argc - arg > 2 || (argv[arg] && (!strcmp(argv[arg], "-h") || !strcmp(argv[arg], "--help")))) {
+		fprintf(stderr, "%s [-c cachedir] [--compress] [file.txt [file.psf]]\n", argv[0]);
+		fprintf(stderr, "%s --update old.psf file.txt file.psf\n", argv[0]);
 		fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
 		exit(1);
 	}
-	const char* infile = argc >= 2 ? argv[1] : 0;
-	const char* outfile = argc == 3 ? argv[2] : 0;
+	const char* infile = argc > arg ? argv[arg] : 0;
+	const char* outfile = argc > arg + 1 ? argv[arg + 1] : 0;
 
 	FILE *in = (infile && strcmp(infile, "-") != 0) ? fopen(infile, "r") : stdin;
 	if (!in) {
 		perror("psfc: could not open input file");
 		exit(1);
 	}
-	struct psf_font *psf = psfc_compile(in);
-	if (in != stdin) { fclose(in); }
 
-	if (!psf) { exit(1); }
-	int ok = 0;
-	if (outfile) {
-		ok = psf_save(outfile, psf);
+	struct psf_font *psf = 0;
+	if (cachedir) {
+		/* key the cache on the normalized input and the compiler version */
+		size_t size = 0;
+		char *text = psfc_readall(in, &size);
+		if (in != stdin) { fclose(in); }
+		if (!text) { exit(1); }
+		if (size == 0) {
+			fprintf(stderr, "psfc: empty input\n");
+			exit(1);
+		}
+		uint64_t h = psf_hash_data(PSF_HASH_SEED, PSFTOOLS_VERSION, strlen(PSFTOOLS_VERSION));
+		h = psf_hash_data(h, text, size);
+		char cachefile[FILENAME_MAX];
+		snprintf(cachefile, FILENAME_MAX, "%s/%016llx.psf", cachedir, (unsigned long long) h);
+		int hit = psfc_cache_fetch(cachefile, outfile, compress);
+		if (hit != 0) {
+			free(text);
+			exit(hit < 0);
+		}
+
+		in = fmemopen(text, size, "r");
+		if (!in) {
+			perror("psfc");
+			exit(1);
+		}
+		psf = psfc_compile(in, 0);
+		fclose(in);
+		free(text);
+		if (psf) { psfc_cache_store(cachefile, psf); }
 	} else {
-		ok = psf_save_tofile(stdout, psf);
+		psf = psfc_compile(in, 0);
+		if (in != stdin) { fclose(in); }
 	}
+
+	if (!psf) { exit(1); }
+	int ok = psfc_output(psf, outfile, compress);
 	psf_delete(psf);
 
 	exit(ok == 0);
@@ -0,0 +1,655 @@
+/* psfcat
+ *
+ * keeps a catalog of the fonts in some directories, with the codepoints
+ * every font covers, and answers queries for fonts from it.
+ * part of a simple textfile based psf font editor suite.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ *
+ * The catalog is a binary file, all numbers in it are varints (7 bits per
+ * byte, least significant first, high bit set on all but the last byte):
+ *
+ *	"PCAT", version byte
+ *	number of directories, then for each its name length and name
+ *	number of files, then for each, sorted by name:
+ *		name length, name
+ *		mtime in nanoseconds, size in bytes
+ *		psf version (0 for files that are not fonts, nothing else follows)
+ *		width, height, number of glyphs, flags (bit 0: unicode table,
+ *		bits 1-2: container)
+ *		content hash (see psf_hash)
+ *		number of covered codepoints
+ *		number of runs of covered codepoints, then for each the distance of
+ *		its first codepoint from the end of the previous run, and its length
+ *		minus 1
+ *
+ * Files that are not fonts are kept, so that they are not looked at again
+ * until they change.
+ */
+
+#define _DEFAULT_SOURCE		/* for st_mtim, mkstemp */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "psf.h"
+#include "fontdir.h"
+#include "psftools_version.h"
+
+#define PSFCAT_VERSION 1
+
+struct psfcat_font {
+	char *path;
+	uint64_t mtime, size;
+	struct psf_info info;		/* version 0 for files that are not fonts */
+	uint64_t hash;
+	unsigned int ncodepoints;
+	unsigned int nruns;
+	uint32_t *run;				/* first and last codepoint of every run */
+};
+
+struct psfcat {
+	char **dir;
+	unsigned int ndirs;
+	struct psfcat_font *font;
+	size_t nfonts, capacity;
+};
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s [-f <catalog>] cmd [opts]\n", cmd);
+	fputs(	"  keep a catalog of the fonts in some directories, and query it.\n"
+			"  The catalog defaults to $HOME/.psfcat.\n"
+			"cmd is one of\n"
+			"  update [dir]...\n"
+			"    scan the directories and their subdirectories for fonts and\n"
+			"    store them in the catalog. Only new and changed files are\n"
+			"    read. If no dirs are given, the dirs from the last update\n"
+			"    are scanned again.\n"
+			"  list\n"
+			"    list all fonts in the catalog, with version, width, height,\n"
+			"    number of glyphs, unicode table and number of codepoints.\n"
+			"  query [-v <version>] [-w <width>] [-h <height>] [-u] [range]...\n"
+			"    list the fonts that match the given version, width and height,\n"
+			"    have a unicode table if -u is given and cover all codepoints in\n"
+			"    the ranges. A range is a codepoint like U+2500 or two of them\n"
+			"    like U+2500..U+257F.\n"
+		, stderr);
+	fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
+	exit(1);
+}
+
+static void psfcat_clear(struct psfcat *cat)
+{
+	size_t i;
+	for (i = 0; i < cat->ndirs; ++i) {
+		free(cat->dir[i]);
+	}
+	for (i = 0; i < cat->nfonts; ++i) {
+		free(cat->font[i].path);
+		free(cat->font[i].run);
+	}
+	free(cat->dir);
+	free(cat->font);
+	memset(cat, 0, sizeof(struct psfcat));
+}
+
+static struct psfcat_font *psfcat_addfont(struct psfcat *cat)
+{
+	if (cat->nfonts == cat->capacity) {
+		size_t ncap = cat->capacity ? cat->capacity * 2 : 64;
+		struct psfcat_font *newfont = realloc(cat->font, ncap * sizeof(struct psfcat_font));
+		if (!newfont) {
+			perror("psfcat");
+			return 0;
+		}
+		cat->font = newfont;
+		cat->capacity = ncap;
+	}
+	struct psfcat_font *font = &cat->font[cat->nfonts++];
+	memset(font, 0, sizeof(struct psfcat_font));
+	return font;
+}
+
+/* reading the catalog */
+
+struct psfcat_reader {
+	const unsigned char *ptr, *end;
+	int ok;
+};
+
+static uint64_t psfcat_getvarint(struct psfcat_reader *rd)
+{
+	uint64_t val = 0;
+	if (rd->ok && !psf_getvarint(&rd->ptr, rd->end, &val)) { rd->ok = 0; }
+	return rd->ok ? val : 0;
+}
+
+static unsigned int psfcat_getuint(struct psfcat_reader *rd, unsigned int max)
+{
+	uint64_t val = psfcat_getvarint(rd);
+	if (val > max) { rd->ok = 0; }
+	return rd->ok ? (unsigned int) val : 0;
+}
+
+static char *psfcat_getstring(struct psfcat_reader *rd)
+{
+	size_t len = psfcat_getuint(rd, FILENAME_MAX);
+	if (!rd->ok || (size_t) (rd->end - rd->ptr) < len) {
+		rd->ok = 0;
+		return 0;
+	}
+	char *str = malloc(len + 1);
+	if (!str) {
+		perror("psfcat");
+		rd->ok = 0;
+		return 0;
+	}
+	memcpy(str, rd->ptr, len);
+	str[len] = 0;
+	rd->ptr += len;
+	return str;
+}
+
+static int psfcat_parse(struct psfcat *cat, struct psfcat_reader *rd)
+{
+	unsigned int i, j;
+	if (rd->end - rd->ptr < 5 || memcmp(rd->ptr, "PCAT", 4) || rd->ptr[4] != PSFCAT_VERSION) { return 0; }
+	rd->ptr += 5;
+	unsigned int ndirs = psfcat_getuint(rd, 0xffff);
+	if (rd->ok && !(cat->dir = calloc(ndirs + 1, sizeof(char*)))) {
+		perror("psfcat");
+		return 0;
+	}
+	for (i = 0; rd->ok && i < ndirs; ++i) {
+		if ((cat->dir[i] = psfcat_getstring(rd)) != 0) { ++cat->ndirs; }
+	}
+	unsigned int nfonts = psfcat_getuint(rd, 0xffffffffU);
+	for (i = 0; rd->ok && i < nfonts; ++i) {
+		struct psfcat_font *font = psfcat_addfont(cat);
+		if (!font) { return 0; }
+		font->path = psfcat_getstring(rd);
+		font->mtime = psfcat_getvarint(rd);
+		font->size = psfcat_getvarint(rd);
+		font->info.version = psfcat_getuint(rd, 2);
+		if (!rd->ok || font->info.version == 0) { continue; }
+		font->info.width = psfcat_getuint(rd, 0xffff);
+		font->info.height = psfcat_getuint(rd, 0xffff);
+		font->info.length = psfcat_getuint(rd, 0xffffffffU);
+		unsigned int flags = psfcat_getuint(rd, 7);
+		font->info.hasunicodetable = flags & 1;
+		font->info.container = flags >> 1;
+		font->hash = psfcat_getvarint(rd);
+		font->ncodepoints = psfcat_getuint(rd, PSF_MAXUNICODE);
+		font->nruns = psfcat_getuint(rd, PSF_MAXUNICODE / 2);
+		if (!rd->ok) { break; }
+		if (font->nruns && !(font->run = malloc(font->nruns * 2 * sizeof(uint32_t)))) {
+			perror("psfcat");
+			return 0;
+		}
+		uint64_t next = 0;
+		for (j = 0; rd->ok && j < font->nruns; ++j) {
+			uint64_t first = next + psfcat_getvarint(rd);
+			uint64_t last = first + psfcat_getvarint(rd);
+			if (first < next || last < first || last >= PSF_MAXUNICODE) { rd->ok = 0; }
+			font->run[2 * j] = (uint32_t) first;
+			font->run[2 * j + 1] = (uint32_t) last;
+			next = last + 1;
+		}
+	}
+	return rd->ok && rd->ptr == rd->end;
+}
+
+/* loads the catalog. Returns 1 if it was loaded, 0 if it does not exist and
+ * -1 on error.
+ */
+static int psfcat_load(struct psfcat *cat, const char *filename)
+{
+	memset(cat, 0, sizeof(struct psfcat));
+	FILE *file = fopen(filename, "rb");
+	if (!file) { return 0; }
+	unsigned char *buf = 0;
+	size_t size = 0, capacity = 0, got;
+	int ok = 1;
+	do {
+		if (size == capacity) {
+			unsigned char *newbuf = realloc(buf, capacity = capacity ? capacity * 2 : 65536);
+			if (!newbuf) {
+				perror("psfcat");
+				ok = 0;
+				break;
+			}
+			buf = newbuf;
+		}
+		got = fread(buf + size, 1, capacity - size, file);
+		size += got;
+	} while (got > 0);
+	if (ferror(file)) {
+		perror(filename);
+		ok = 0;
+	}
+	fclose(file);
+	struct psfcat_reader rd = { buf, buf + size, 1 };
+	if (ok && !psfcat_parse(cat, &rd)) {
+		fprintf(stderr, "psfcat: %s is not a valid catalog\n", filename);
+		ok = 0;
+	}
+	free(buf);
+	if (!ok) { psfcat_clear(cat); }
+	return ok ? 1 : -1;
+}
+
+/* writing the catalog */
+
+static void psfcat_putvarint(FILE *file, uint64_t val)
+{
+	unsigned char buf[PSF_VARINT_MAX];
+	fwrite(buf, 1, psf_putvarint(buf, val), file);
+}
+
+static void psfcat_putstring(FILE *file, const char *str)
+{
+	size_t len = strlen(str);
+	psfcat_putvarint(file, len);
+	fwrite(str, 1, len, file);
+}
+
+/* writes the catalog to a temporary file and renames that, so that a query
+ * never sees half a catalog.
+ */
+static int psfcat_save(struct psfcat *cat, const char *filename)
+{
+	char tmpname[FILENAME_MAX];
+	size_t i;
+	unsigned int j;
+	if (snprintf(tmpname, FILENAME_MAX, "%s.XXXXXX", filename) >= FILENAME_MAX) {
+		fprintf(stderr, "psfcat: catalog name too long\n");
+		return 0;
+	}
+	/* a unique temp file, so concurrent updates do not write into each other */
+	int fd = mkstemp(tmpname);
+	if (fd < 0) {
+		perror(tmpname);
+		return 0;
+	}
+	/* mkstemp creates the file as 0600, use what fopen would have used */
+	mode_t mask = umask(0);
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
+	FILE *file = fdopen(fd, "wb");
+	if (!file) {
+		perror(tmpname);
+		close(fd);
+		remove(tmpname);
+		return 0;
+	}
+	fwrite("PCAT", 1, 4, file);
+	putc(PSFCAT_VERSION, file);
+	psfcat_putvarint(file, cat->ndirs);
+	for (i = 0; i < cat->ndirs; ++i) {
+		psfcat_putstring(file, cat->dir[i]);
+	}
+	psfcat_putvarint(file, cat->nfonts);
+	for (i = 0; i < cat->nfonts; ++i) {
+		struct psfcat_font *font = &cat->font[i];
+		psfcat_putstring(file, font->path);
+		psfcat_putvarint(file, font->mtime);
+		psfcat_putvarint(file, font->size);
+		psfcat_putvarint(file, font->info.version);
+		if (font->info.version == 0) { continue; }
+		psfcat_putvarint(file, font->info.width);
+		psfcat_putvarint(file, font->info.height);
+		psfcat_putvarint(file, font->info.length);
+		psfcat_putvarint(file, font->info.hasunicodetable | font->info.container << 1);
+		psfcat_putvarint(file, font->hash);
+		psfcat_putvarint(file, font->ncodepoints);
+		psfcat_putvarint(file, font->nruns);
+		uint32_t next = 0;
+		for (j = 0; j < font->nruns; ++j) {
+			psfcat_putvarint(file, font->run[2 * j] - next);
+			psfcat_putvarint(file, font->run[2 * j + 1] - font->run[2 * j]);
+			next = font->run[2 * j + 1] + 1;
+		}
+	}
+	int ok = fflush(file) == 0 && !ferror(file);
+	if (fclose(file) != 0) { ok = 0; }
+	if (!ok || rename(tmpname, filename) != 0) {
+		perror(tmpname);
+		remove(tmpname);
+		return 0;
+	}
+	return 1;
+}
+
+/* updating the catalog */
+
+struct psfcat_file {
+	char *path;
+	uint64_t mtime, size;
+};
+
+struct psfcat_files {
+	struct psfcat_file *file;
+	size_t nfiles, capacity;
+};
+
+static int psfcat_addfile(void *ctx, char *path, const struct stat *st)
+{
+	struct psfcat_files *files = ctx;
+	if (files->nfiles == files->capacity) {
+		size_t ncap = files->capacity ? files->capacity * 2 : 256;
+		struct psfcat_file *newfile = realloc(files->file, ncap * sizeof(struct psfcat_file));
+		if (!newfile) {
+			perror("psfcat");
+			free(path);
+			return 0;
+		}
+		files->file = newfile;
+		files->capacity = ncap;
+	}
+	struct psfcat_file *file = &files->file[files->nfiles++];
+	file->path = path;
+	file->mtime = (uint64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+	file->size = st->st_size;
+	return 1;
+}
+
+static int psfcat_cmpfile(const void *a, const void *b)
+{
+	return strcmp(((const struct psfcat_file*) a)->path, ((const struct psfcat_file*) b)->path);
+}
+
+/* turns a coverage bitset into runs of codepoints. Empty words are skipped
+ * 32 codepoints at a time.
+ */
+static int psfcat_runs(struct psfcat_font *font, const uint32_t *bits)
+{
+	unsigned int cp = 0, n = 0, capacity = 0;
+	while (cp < PSF_MAXUNICODE) {
+		if ((cp & 31) == 0 && bits[cp / 32] == 0) {
+			cp += 32;
+			continue;
+		}
+		if (!(bits[cp / 32] & (1U << (cp & 31)))) {
+			++cp;
+			continue;
+		}
+		unsigned int first = cp;
+		while (cp < PSF_MAXUNICODE && (bits[cp / 32] & (1U << (cp & 31)))) {
+			cp += ((cp & 31) == 0 && bits[cp / 32] == 0xffffffffU) ? 32 : 1;
+		}
+		if (n == capacity) {
+			uint32_t *newrun = realloc(font->run, (capacity = capacity ? capacity * 2 : 64) * 2 * sizeof(uint32_t));
+			if (!newrun) {
+				perror("psfcat");
+				return 0;
+			}
+			font->run = newrun;
+		}
+		font->run[2 * n] = first;
+		font->run[2 * n + 1] = cp - 1;
+		++n;
+	}
+	font->nruns = n;
+	return 1;
+}
+
+/* reads a new or changed file. Files that are not fonts or can not be
+ * loaded are stored with version 0.
+ */
+static int psfcat_readfont(struct psfcat_font *font, uint32_t *bits)
+{
+	if (!psf_probe(font->path, &font->info)) {
+		font->info.version = 0;
+		return 1;
+	}
+	struct psf_font *psf = psf_load(font->path);
+	if (!psf) {
+		fprintf(stderr, "psfcat: %s: could not be loaded\n", font->path);
+		font->info.version = 0;
+		return 1;
+	}
+	font->hash = psf_hash(psf);
+	font->ncodepoints = psf_coverage(psf, bits);
+	psf_delete(psf);
+	return psfcat_runs(font, bits);
+}
+
+static int psfcat_update(struct psfcat *cat, const char *catfile, int ndirs, char **dirs)
+{
+	struct psfcat old;
+	struct psfcat_files files = { 0, 0, 0 };
+	size_t i, o = 0, nchanged = 0, nfonts = 0;
+	int ok = psfcat_load(&old, catfile) >= 0;
+	int d;
+	if (!ok) {
+		fprintf(stderr, "psfcat: starting a new catalog\n");
+		ok = 1;
+	}
+	memset(cat, 0, sizeof(struct psfcat));
+	if (ndirs > 0) {
+		if (!(cat->dir = calloc(ndirs, sizeof(char*)))) {
+			perror("psfcat");
+			psfcat_clear(&old);
+			return 0;
+		}
+		for (d = 0; d < ndirs; ++d) {
+			size_t len = strlen(dirs[d]);
+			while (len > 1 && dirs[d][len - 1] == '/') { --len; }
+			if (!(cat->dir[d] = malloc(len + 1))) {
+				perror("psfcat");
+				ok = 0;
+				break;
+			}
+			memcpy(cat->dir[d], dirs[d], len);
+			cat->dir[d][len] = 0;
+			++cat->ndirs;
+		}
+	} else {
+		cat->dir = old.dir;
+		cat->ndirs = old.ndirs;
+		old.dir = 0;
+		old.ndirs = 0;
+		if (cat->ndirs == 0) {
+			fprintf(stderr, "psfcat: no directories to scan\n");
+			ok = 0;
+		}
+	}
+	for (i = 0; ok && i < cat->ndirs; ++i) {
+		ok = fontdir_walk(cat->dir[i], psfcat_addfile, &files);
+	}
+
+	uint32_t *bits = ok ? malloc(PSF_COVERAGE_WORDS * sizeof(uint32_t)) : 0;
+	if (ok && !bits) {
+		perror("psfcat");
+		ok = 0;
+	}
+	if (ok) { qsort(files.file, files.nfiles, sizeof(struct psfcat_file), psfcat_cmpfile); }
+	/* both lists are sorted by name, so unchanged entries are found by
+	 * walking them side by side.
+	 */
+	for (i = 0; ok && i < files.nfiles; ++i) {
+		struct psfcat_file *file = &files.file[i];
+		/* the same file may be found through two dirs */
+		if (cat->nfonts > 0 && !strcmp(file->path, cat->font[cat->nfonts - 1].path)) { continue; }
+		while (o < old.nfonts && strcmp(old.font[o].path, file->path) < 0) { ++o; }
+		struct psfcat_font *font = psfcat_addfont(cat);
+		if (!font) {
+			ok = 0;
+			break;
+		}
+		if (o < old.nfonts && !strcmp(old.font[o].path, file->path) && old.font[o].mtime == file->mtime && old.font[o].size == file->size) {
+			*font = old.font[o];
+			memset(&old.font[o], 0, sizeof(struct psfcat_font));
+			++o;
+		} else {
+			font->path = file->path;
+			file->path = 0;
+			font->mtime = file->mtime;
+			font->size = file->size;
+			ok = psfcat_readfont(font, bits);
+			++nchanged;
+		}
+		if (font->info.version) { ++nfonts; }
+	}
+	if (ok) {
+		ok = psfcat_save(cat, catfile);
+	}
+	if (ok) {
+		printf("%lu fonts in %lu files, %lu new or changed\n", (unsigned long) nfonts, (unsigned long) cat->nfonts, (unsigned long) nchanged);
+	}
+
+	free(bits);
+	for (i = 0; i < files.nfiles; ++i) {
+		free(files.file[i].path);
+	}
+	free(files.file);
+	psfcat_clear(&old);
+	return ok;
+}
+
+/* queries */
+
+struct psfcat_query {
+	unsigned int version, width, height, unicode;
+	unsigned int nranges;
+	uint32_t *range;			/* first and last codepoint of every range */
+};
+
+/* finds the run containing first by binary search, and checks that it
+ * reaches last.
+ */
+static int psfcat_covers(const struct psfcat_font *font, uint32_t first, uint32_t last)
+{
+	unsigned int lo = 0, hi = font->nruns;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (font->run[2 * mid + 1] < first) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo < font->nruns && font->run[2 * lo] <= first && font->run[2 * lo + 1] >= last;
+}
+
+static int psfcat_matches(const struct psfcat_font *font, const struct psfcat_query *q)
+{
+	unsigned int i;
+	if (font->info.version == 0) { return 0; }
+	if ((q->version && font->info.version != q->version) || (q->width && font->info.width != q->width)
+		|| (q->height && font->info.height != q->height) || (q->unicode && !font->info.hasunicodetable)) {
+		return 0;
+	}
+	for (i = 0; i < q->nranges; ++i) {
+		if (!psfcat_covers(font, q->range[2 * i], q->range[2 * i + 1])) { return 0; }
+	}
+	return 1;
+}
+
+static void psfcat_print(const struct psfcat_font *font)
+{
+	printf("%s v:%u w:%u h:%u n:%u u:%u cps:%u\n", font->path, font->info.version, font->info.width,
+		font->info.height, font->info.length, font->info.hasunicodetable, font->ncodepoints);
+}
+
+/* parses U+2500, 2500, U+2500..U+257F or U+2500-U+257F */
+static int psfcat_parserange(const char *str, uint32_t *first, uint32_t *last)
+{
+	char *end;
+	if (!strncmp(str, "U+", 2) || !strncmp(str, "u+", 2)) { str += 2; }
+	unsigned long a = strtoul(str, &end, 16), b = a;
+	if (end == str) { return 0; }
+	str = end;
+	if (*str == '-' || !strncmp(str, "..", 2)) {
+		str += *str == '-' ? 1 : 2;
+		if (!strncmp(str, "U+", 2) || !strncmp(str, "u+", 2)) { str += 2; }
+		b = strtoul(str, &end, 16);
+		if (end == str) { return 0; }
+		str = end;
+	}
+	if (*str || a > b || b >= PSF_MAXUNICODE) { return 0; }
+	*first = a;
+	*last = b;
+	return 1;
+}
+
+static int psfcat_querycmd(struct psfcat *cat, int argc, char **argv)
+{
+	struct psfcat_query q;
+	int arg, ok = 1;
+	size_t i;
+	memset(&q, 0, sizeof(q));
+	if (!(q.range = malloc((argc + 1) * 2 * sizeof(uint32_t)))) {
+		perror("psfcat");
+		return 0;
+	}
+	for (arg = 0; ok && arg < argc; ++arg) {
+		const char *opt = argv[arg];
+		if (!strcmp(opt, "-u")) {
+			q.unicode = 1;
+		} else if ((!strcmp(opt, "-v") || !strcmp(opt, "-w") || !strcmp(opt, "-h")) && arg + 1 < argc) {
+			unsigned int val = (unsigned int) strtoul(argv[++arg], 0, 10);
+			switch (opt[1]) {
+				case 'v': q.version = val; break;
+				case 'w': q.width = val; break;
+				case 'h': q.height = val; break;
+			}
+		} else if (psfcat_parserange(opt, &q.range[2 * q.nranges], &q.range[2 * q.nranges + 1])) {
+			++q.nranges;
+		} else {
+			fprintf(stderr, "psfcat: invalid query argument: %s\n", opt);
+			ok = 0;
+		}
+	}
+	for (i = 0; ok && i < cat->nfonts; ++i) {
+		if (psfcat_matches(&cat->font[i], &q)) { psfcat_print(&cat->font[i]); }
+	}
+	free(q.range);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	char catfile[FILENAME_MAX];
+	int arg = 1, ok = 0;
+	const char *home = getenv("HOME");
+
+	if (argc > 2 && !strcmp(argv[1], "-f")) {
+		snprintf(catfile, FILENAME_MAX, "%s", argv[2]);
+		arg = 3;
+	} else if (home) {
+		snprintf(catfile, FILENAME_MAX, "%s/.psfcat", home);
+	} else {
+		fprintf(stderr, "psfcat: HOME is not set, use -f.\n");
+		exit(1);
+	}
+	if (arg >= argc) {
+		usage(argv[0]);
+	}
+
+	const char *cmd = argv[arg++];
+	struct psfcat cat;
+	if (!strcmp(cmd, "update")) {
+		ok = psfcat_update(&cat, catfile, argc - arg, argv + arg);
+	} else if (!strcmp(cmd, "list") || !strcmp(cmd, "query")) {
+		int res = psfcat_load(&cat, catfile);
+		if (res == 0) {
+			fprintf(stderr, "psfcat: %s does not exist, run psfcat update first.\n", catfile);
+		} else if (res > 0 && !strcmp(cmd, "list")) {
+			size_t i;
+			for (i = 0; i < cat.nfonts; ++i) {
+				if (cat.font[i].info.version) { psfcat_print(&cat.font[i]); }
+			}
+			ok = arg == argc;
+			if (!ok) { usage(argv[0]); }
+		} else if (res > 0) {
+			ok = psfcat_querycmd(&cat, argc - arg, argv + arg);
+		}
+	} else {
+		usage(argv[0]);
+	}
+	psfcat_clear(&cat);
+	exit(ok == 0);
+}
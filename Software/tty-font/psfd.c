@@ -28,10 +28,8 @@ static int psfd_print_header(struct psf_font *psf, FILE *out)
 	return 1;
 }
 
-static int psfd_print_glyph(struct psf_font *psf, unsigned int n, FILE *out)
+static void psfd_print_glyph(struct psf_font *psf, unsigned int n, struct psf_glyph *glyph, FILE *out)
 {
-	struct psf_glyph *glyph = psf_getglyph(psf, n);
-	if (!glyph) { return 0; }
 	unsigned int x, y, i;
 	int hasseq = 0, inseq = 0;
 	fprintf(out, "@%d", n);
@@ -59,18 +57,18 @@ static int psfd_print_glyph(struct psf_font *psf, unsigned int n, FILE *out)
 		}
 		fputc('\n', out);
 	}
-	return 1;
 }
 
-static int psfd_print_glyphs(struct psf_font *psf, FILE *out)
+/* the glyphs are printed as they are read, so that only one of them is in
+ * memory, see psf_reader_open.
+ */
+static int psfd_print_glyphs(struct psf_reader *rd, FILE *out)
 {
-	unsigned int i;
-	for (i = 0; i < psf_numglyphs(psf); ++i) {
-		if (!psfd_print_glyph(psf, i, out)) {
-			return 0;
-		}
+	struct psf_glyph *glyph;
+	while ((glyph = psf_reader_next(rd))) {
+		psfd_print_glyph(rd->psf, rd->next - 1, glyph, out);
 	}
-	return 1;
+	return rd->next == psf_numglyphs(rd->psf);
 }
 
 int main(int argc, char **argv)
@@ -84,25 +82,31 @@ int main(int argc, char **argv)
 	const char* infile = argc >= 2 ? argv[1] : 0;
 	const char* outfile = argc == 3 ? argv[2] : 0;
 
-	struct psf_font *psf = (infile && strcmp(infile, "-") != 0) ? psf_load(infile) : psf_load_fromfile(stdin);
-	if (!psf) {
+	FILE *in = (infile && strcmp(infile, "-") != 0) ? fopen(infile, "rb") : stdin;
+	if (!in) {
+		perror("psfd: could not open input file");
+		exit(1);
+	}
+	struct psf_reader *rd = psf_reader_open(in);
+	if (!rd) {
 		exit(1);
 	}
 	FILE *out = outfile ? fopen(outfile, "w") : stdout;
 	if (!out) {
 		perror("psfd: could not open output file");
-		psf_delete(psf);
+		psf_reader_close(rd);
 		exit(1);
 	}
 
-	if (!psfd_print_header(psf, out)) {
+	if (!psfd_print_header(rd->psf, out)) {
 		exit(1);
 	}
-	if (!psfd_print_glyphs(psf, out)) {
+	if (!psfd_print_glyphs(rd, out)) {
 		exit(1);
 	}
 	if (out != stdout) { fclose(out); }
-	psf_delete(psf);
+	psf_reader_close(rd);
+	if (in != stdin) { fclose(in); }
 
 	exit(0);
 }
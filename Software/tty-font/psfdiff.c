@@ -0,0 +1,59 @@
+/* psfdiff
+ *
+ * Writes the changes from one psf font to another as a delta for psfpatch.
+ * part of a simple textfile based psf font editor suite.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psf.h"
+#include "psftools_version.h"
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s old.psf new.psf [delta]\n", cmd);
+	fputs(	"  write the changes from old.psf to new.psf as a delta, which\n"
+			"  psfpatch applies to old.psf. Only changed bitmaps, added or\n"
+			"  removed glyphs and changed unicode values are stored. If delta\n"
+			"  is omitted, defaults to stdout.\n"
+		, stderr);
+	fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3 || argc > 4 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+		usage(argv[0]);
+	}
+
+	struct psf_font *old = psf_load(argv[1]);
+	struct psf_font *new = old ? psf_load(argv[2]) : 0;
+	unsigned char *delta = 0;
+	size_t size = 0;
+	int ok = old && new && (delta = psf_diff(old, new, &size)) != 0;
+	if (ok) {
+		FILE *out = argc > 3 ? fopen(argv[3], "wb") : stdout;
+		if (!out) {
+			perror(argv[3]);
+			ok = 0;
+		} else {
+			if (fwrite(delta, 1, size, out) != size || fflush(out) != 0) {
+				perror("psfdiff");
+				ok = 0;
+			}
+			if (out != stdout && fclose(out) != 0) {
+				perror(argv[3]);
+				ok = 0;
+			}
+		}
+	}
+
+	free(delta);
+	if (new) { psf_delete(new); }
+	if (old) { psf_delete(old); }
+	exit(ok == 0);
+}
@@ -0,0 +1,277 @@
+/* psfmerge
+ *
+ * Merges several psf files with identical glyph sizes into one.
+ * part of a simple textfile based psf font editor suite.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psf.h"
+#include "psftools_version.h"
+
+/* unicode values collected for a glyph of the merged font. Single values
+ * must come before sequences in a glyph, so they are kept apart until the
+ * font is complete.
+ */
+struct psfmerge_ucvals {
+	unsigned int *singles, nsingles;
+	unsigned int *seqs, nseqs;
+};
+
+struct psfmerge {
+	struct psf_font *out;
+	struct psfmerge_ucvals *uc;		/* one per glyph in out */
+	unsigned int ucalloced;
+	uint32_t *claimed;				/* codepoints already taken */
+	uint32_t *dedup;				/* bitmap hash table: glyph + 1, or 0 */
+	unsigned int dedupsize, ndedup;
+};
+
+static int psfmerge_append(unsigned int **vals, unsigned int *nvals, const unsigned int *add, unsigned int nadd)
+{
+	if (nadd == 0) { return 1; }
+	unsigned int *newvals = realloc(*vals, (*nvals + nadd) * sizeof(unsigned int));
+	if (!newvals) {
+		perror("psfmerge");
+		return 0;
+	}
+	memcpy(&newvals[*nvals], add, nadd * sizeof(unsigned int));
+	*vals = newvals;
+	*nvals += nadd;
+	return 1;
+}
+
+static uint64_t psfmerge_bitmaphash(struct psf_font *psf, const unsigned char *data)
+{
+	return psf_hash_data(PSF_HASH_SEED, data, psf_charsize(psf));
+}
+
+static int psfmerge_dedup_insert(struct psfmerge *m, unsigned int no);
+
+/* the dedup table is open addressed with linear probing, and grown to keep
+ * it at most half full.
+ */
+static int psfmerge_dedup_grow(struct psfmerge *m)
+{
+	uint32_t *old = m->dedup;
+	unsigned int oldsize = m->dedupsize, i;
+	m->dedupsize = oldsize ? oldsize * 2 : 1024;
+	m->dedup = calloc(m->dedupsize, sizeof(uint32_t));
+	if (!m->dedup) {
+		perror("psfmerge");
+		m->dedup = old;
+		m->dedupsize = oldsize;
+		return 0;
+	}
+	m->ndedup = 0;
+	for (i = 0; i < oldsize; ++i) {
+		if (old[i]) { psfmerge_dedup_insert(m, old[i] - 1); }
+	}
+	free(old);
+	return 1;
+}
+
+static int psfmerge_dedup_insert(struct psfmerge *m, unsigned int no)
+{
+	if ((m->ndedup + 1) * 2 > m->dedupsize && !psfmerge_dedup_grow(m)) { return 0; }
+	unsigned int pos = psfmerge_bitmaphash(m->out, m->out->glyph[no].data) & (m->dedupsize - 1);
+	while (m->dedup[pos]) {
+		pos = (pos + 1) & (m->dedupsize - 1);
+	}
+	m->dedup[pos] = no + 1;
+	++m->ndedup;
+	return 1;
+}
+
+/* returns the glyph in the merged font with the same bitmap as data, or -1 */
+static int psfmerge_dedup_find(struct psfmerge *m, const unsigned char *data)
+{
+	if (m->dedupsize == 0) { return -1; }
+	unsigned int pos = psfmerge_bitmaphash(m->out, data) & (m->dedupsize - 1);
+	while (m->dedup[pos]) {
+		unsigned int no = m->dedup[pos] - 1;
+		if (memcmp(m->out->glyph[no].data, data, psf_charsize(m->out)) == 0) {
+			return no;
+		}
+		pos = (pos + 1) & (m->dedupsize - 1);
+	}
+	return -1;
+}
+
+/* adds the glyphs of psf that provide codepoints not yet in the merged font */
+static int psfmerge_add(struct psfmerge *m, struct psf_font *psf)
+{
+	unsigned int numglyphs = psf_numglyphs(psf), i, ucv;
+	unsigned int *singles = 0;
+	unsigned int maxucvals = 1;
+
+	for (i = 0; i < numglyphs; ++i) {
+		if (psf->glyph[i].nucvals > maxucvals) { maxucvals = psf->glyph[i].nucvals; }
+	}
+	singles = malloc(maxucvals * sizeof(unsigned int));
+	if (!singles) {
+		perror("psfmerge");
+		return 0;
+	}
+
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &psf->glyph[i];
+		unsigned int nsingles = 0, first = 0;
+		if (!psf_hasunicodetable(psf)) {
+			singles[nsingles++] = i;
+		} else {
+			for (first = 0; first < glyph->nucvals && glyph->ucvals[first] != PSF1_STARTSEQ; ++first) {
+				singles[nsingles++] = glyph->ucvals[first];
+			}
+		}
+		/* drop codepoints a font with higher priority already provides */
+		unsigned int nkeep = 0;
+		for (ucv = 0; ucv < nsingles; ++ucv) {
+			unsigned int cp = singles[ucv];
+			if (cp < PSF_MAXUNICODE && !(m->claimed[cp / 32] & ((uint32_t) 1 << (cp % 32)))) {
+				m->claimed[cp / 32] |= (uint32_t) 1 << (cp % 32);
+				singles[nkeep++] = cp;
+			}
+		}
+		if (nkeep == 0) { continue; }
+
+		const unsigned char *data = glyph->data;
+		unsigned char *blank = 0;
+		if (!data) {
+			blank = calloc(1, psf_charsize(psf));
+			if (!blank) {
+				perror("psfmerge");
+				break;
+			}
+			data = blank;
+		}
+
+		int no = psfmerge_dedup_find(m, data);
+		if (no < 0) {
+			no = psf_numglyphs(m->out);
+			struct psf_glyph *outglyph = psf_addglyph(m->out, no);
+			if (!outglyph || !outglyph->data) {
+				perror("psfmerge");
+				free(blank);
+				break;
+			}
+			memcpy(outglyph->data, data, psf_charsize(psf));
+			if (!psfmerge_dedup_insert(m, no)) {
+				free(blank);
+				break;
+			}
+			if (m->ucalloced <= (unsigned int) no) {
+				unsigned int nalloc = m->ucalloced ? m->ucalloced * 2 : 256;
+				struct psfmerge_ucvals *newuc = realloc(m->uc, nalloc * sizeof(struct psfmerge_ucvals));
+				if (!newuc) {
+					perror("psfmerge");
+					free(blank);
+					break;
+				}
+				memset(&newuc[m->ucalloced], 0, (nalloc - m->ucalloced) * sizeof(struct psfmerge_ucvals));
+				m->uc = newuc;
+				m->ucalloced = nalloc;
+			}
+		}
+		free(blank);
+		struct psfmerge_ucvals *uc = &m->uc[no];
+		if (!psfmerge_append(&uc->singles, &uc->nsingles, singles, nkeep)) { break; }
+		if (!psfmerge_append(&uc->seqs, &uc->nseqs, &glyph->ucvals[first], glyph->nucvals - first)) { break; }
+	}
+	free(singles);
+	return i == numglyphs;
+}
+
+/* stores the collected unicode values in the merged font */
+static int psfmerge_finish(struct psfmerge *m)
+{
+	unsigned int numglyphs = psf_numglyphs(m->out), i, ucv;
+	for (i = 0; i < numglyphs; ++i) {
+		struct psf_glyph *glyph = &m->out->glyph[i];
+		struct psfmerge_ucvals *uc = &m->uc[i];
+		for (ucv = 0; ucv < uc->nsingles; ++ucv) {
+			if (!psf_glyph_adducval(m->out, glyph, uc->singles[ucv])) { return 0; }
+		}
+		for (ucv = 0; ucv < uc->nseqs; ++ucv) {
+			if (!psf_glyph_adducval(m->out, glyph, uc->seqs[ucv])) { return 0; }
+		}
+	}
+	return 1;
+}
+
+static void psfmerge_cleanup(struct psfmerge *m)
+{
+	unsigned int i;
+	for (i = 0; i < m->ucalloced; ++i) {
+		free(m->uc[i].singles);
+		free(m->uc[i].seqs);
+	}
+	free(m->uc);
+	free(m->claimed);
+	free(m->dedup);
+	if (m->out) { psf_delete(m->out); }
+}
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s [-o outfile] font.psf [font.psf ...]\n", cmd);
+	fputs(	"  merge psf fonts with identical glyph sizes into one psf2 font.\n"
+			"  If a codepoint is in several fonts, the glyph from the first\n"
+			"  one is used. Identical bitmaps are stored only once. If outfile\n"
+			"  is omitted, defaults to stdout.\n"
+		, stderr);
+	fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *outfile = 0;
+	int arg = 1;
+	if (argc >= 3 && !strcmp(argv[1], "-o")) {
+		outfile = argv[2];
+		arg = 3;
+	}
+	if (arg >= argc || !strcmp(argv[arg], "-h") || !strcmp(argv[arg], "--help")) {
+		usage(argv[0]);
+	}
+
+	struct psfmerge m;
+	memset(&m, 0, sizeof(m));
+	m.claimed = calloc(PSF_COVERAGE_WORDS, sizeof(uint32_t));
+	if (!m.claimed) {
+		perror("psfmerge");
+		exit(1);
+	}
+
+	/* only one input font is in memory at any time */
+	int ok = 1;
+	for (; ok && arg < argc; ++arg) {
+		struct psf_font *psf = psf_load(argv[arg]);
+		if (!psf) {
+			ok = 0;
+			break;
+		}
+		if (!m.out) {
+			m.out = psf_new(2, psf_width(psf), psf_height(psf));
+			ok = m.out != 0;
+		} else if (psf_width(psf) != psf_width(m.out) || psf_height(psf) != psf_height(m.out)) {
+			fprintf(stderr, "psfmerge: %s: glyph size %ux%u does not match %ux%u\n", argv[arg],
+				psf_width(psf), psf_height(psf), psf_width(m.out), psf_height(m.out));
+			ok = 0;
+		}
+		ok = ok && psfmerge_add(&m, psf);
+		psf_delete(psf);
+	}
+
+	ok = ok && psfmerge_finish(&m);
+	if (ok) {
+		ok = outfile ? psf_save(outfile, m.out) : psf_save_tofile(stdout, m.out);
+	}
+	psfmerge_cleanup(&m);
+
+	exit(ok == 0);
+}
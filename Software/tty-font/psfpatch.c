@@ -0,0 +1,198 @@
+/* psfpatch
+ *
+ * Applies a delta written by psfdiff to a psf font.
+ * part of a simple textfile based psf font editor suite.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "psf.h"
+#include "psftools_version.h"
+
+#define CHUNKSIZE 65536
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s [-s] [-o outfile] font.psf [delta]\n", cmd);
+	fputs(	"  apply a delta written by psfdiff to font.psf. The delta is only\n"
+			"  applied to the font it was made from, and the result is checked\n"
+			"  against the font it was made to. Without -o, font.psf is updated,\n"
+			"  in place if only bitmaps changed. That is not atomic, with -s\n"
+			"  the whole font is saved to a new file that replaces font.psf.\n"
+			"  If delta is omitted or -, defaults to stdin.\n"
+		, stderr);
+	fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
+	exit(1);
+}
+
+static unsigned char *psfpatch_readall(FILE *in, size_t *len)
+{
+	size_t size = CHUNKSIZE, n;
+	unsigned char *buf = malloc(size);
+	*len = 0;
+	while (buf && (n = fread(buf + *len, 1, size - *len, in)) > 0) {
+		*len += n;
+		if (*len == size) {
+			unsigned char *newbuf = realloc(buf, size * 2);
+			if (!newbuf) { free(buf); }
+			buf = newbuf;
+			size *= 2;
+		}
+	}
+	if (!buf || ferror(in)) {
+		perror("psfpatch");
+		free(buf);
+		return 0;
+	}
+	return buf;
+}
+
+/* checks whether new differs from old only in its bitmaps */
+static int psfpatch_samelayout(struct psf_font *old, struct psf_font *new)
+{
+	unsigned int i;
+	if (old->version != new->version || psf_width(old) != psf_width(new) || psf_height(old) != psf_height(new)
+		|| psf_numglyphs(old) != psf_numglyphs(new) || psf_hasunicodetable(old) != psf_hasunicodetable(new)) {
+		return 0;
+	}
+	if (old->version == 1 ? old->header.psf1.mode != new->header.psf1.mode : old->header.psf2.flags != new->header.psf2.flags) {
+		return 0;
+	}
+	for (i = 0; i < psf_numglyphs(old); ++i) {
+		struct psf_glyph *og = &old->glyph[i], *ng = &new->glyph[i];
+		if (og->nucvals != ng->nucvals || (og->nucvals > 0 && memcmp(og->ucvals, ng->ucvals, og->nucvals * sizeof(unsigned int)) != 0)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* writes the changed bitmaps straight into an uncompressed font file through
+ * a shared mapping, so only the pages holding them are written back. Returns
+ * 1 if done, 0 if the file is not an uncompressed psf file, -1 on error.
+ * Unlike psf_save, this is not atomic: a reader may see some glyphs patched
+ * and others not, and a crash can leave the file like that. psfpatch -s
+ * saves the whole font instead.
+ */
+static int psfpatch_inplace(const char *filename, struct psf_font *old, struct psf_font *new)
+{
+	int fd = open(filename, O_RDWR);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(filename);
+		if (fd >= 0) { close(fd); }
+		return -1;
+	}
+	size_t hdrsize = old->version == 1 ? sizeof(struct psf1_header) : old->header.psf2.headersize;
+	size_t charsize = psf_charsize(old), nglyphs = psf_numglyphs(old), i;
+	size_t end = hdrsize + nglyphs * charsize;
+	if (!S_ISREG(st.st_mode) || (size_t) st.st_size < end) {
+		close(fd);
+		return 0;
+	}
+	unsigned char *map = mmap(0, end, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror(filename);
+		return -1;
+	}
+	int res = 1;
+	if (old->version == 1) {
+		res = map[0] == PSF1_MAGIC0 && map[1] == PSF1_MAGIC1;
+	} else {
+		res = map[0] == PSF2_MAGIC0 && map[1] == PSF2_MAGIC1 && map[2] == PSF2_MAGIC2 && map[3] == PSF2_MAGIC3;
+	}
+	/* the file was opened again after it was loaded. If its bitmaps are not
+	 * those of old any more, somebody changed it in between, and writing
+	 * into it would mix both changes. A change after this check is still
+	 * not noticed, psfpatch -s does not have this window.
+	 */
+	for (i = 0; res && i < nglyphs; ++i) {
+		if (memcmp(map + hdrsize + i * charsize, old->glyph[i].data, charsize) != 0) {
+			fprintf(stderr, "psfpatch: %s has changed since it was read\n", filename);
+			res = -1;
+		}
+	}
+	for (i = 0; res > 0 && i < nglyphs; ++i) {
+		unsigned char *dst = map + hdrsize + i * charsize;
+		if (memcmp(dst, new->glyph[i].data, charsize) != 0) {
+			memcpy(dst, new->glyph[i].data, charsize);
+		}
+	}
+	if (res > 0 && msync(map, end, MS_SYNC) != 0) {
+		perror(filename);
+		res = -1;
+	}
+	munmap(map, end);
+	return res;
+}
+
+/* checks whether a file is a compressed container */
+static int psfpatch_iscompressed(const char *filename)
+{
+	unsigned char magic[4] = { 0 };
+	FILE *in = fopen(filename, "rb");
+	if (in) {
+		if (fread(magic, 1, 4, in) != 4) { magic[0] = 0; }
+		fclose(in);
+	}
+	return magic[0] == PSFZ_MAGIC0 && magic[1] == PSFZ_MAGIC1 && magic[2] == PSFZ_MAGIC2 && magic[3] == PSFZ_MAGIC3;
+}
+
+int main(int argc, char **argv)
+{
+	const char *outfile = 0, *fontfile, *deltafile = 0;
+	int arg = 1, safe = 0;
+	if (arg < argc && !strcmp(argv[arg], "-s")) {
+		safe = 1;
+		++arg;
+	}
+	if (arg + 1 < argc && !strcmp(argv[arg], "-o")) {
+		outfile = argv[arg + 1];
+		arg += 2;
+	}
+	if (arg >= argc || argc - arg > 2 || !strcmp(argv[arg], "-h") || !strcmp(argv[arg], "--help")) {
+		usage(argv[0]);
+	}
+	fontfile = argv[arg];
+	if (argc > arg + 1 && strcmp(argv[arg + 1], "-") != 0) {
+		deltafile = argv[arg + 1];
+	}
+
+	FILE *in = deltafile ? fopen(deltafile, "rb") : stdin;
+	if (!in) {
+		perror(deltafile);
+		exit(1);
+	}
+	size_t size = 0;
+	unsigned char *delta = psfpatch_readall(in, &size);
+	if (in != stdin) { fclose(in); }
+	if (!delta) { exit(1); }
+
+	struct psf_font *old = psf_load(fontfile);
+	struct psf_font *new = old ? psf_patch(old, delta, size) : 0;
+	int ok = new != 0;
+	if (ok && outfile) {
+		ok = psf_save(outfile, new);
+	} else if (ok) {
+		int done = !safe && psfpatch_samelayout(old, new) ? psfpatch_inplace(fontfile, old, new) : 0;
+		if (done == 0) {
+			ok = psfpatch_iscompressed(fontfile) ? psf_save_compressed(fontfile, new) : psf_save(fontfile, new);
+		} else {
+			ok = done > 0;
+		}
+	}
+
+	free(delta);
+	if (new) { psf_delete(new); }
+	if (old) { psf_delete(old); }
+	exit(ok == 0);
+}
@@ -0,0 +1,72 @@
+/* psfshm
+ *
+ * puts fonts into shared memory, so that processes can use them without
+ * loading them each.
+ * part of a simple textfile based psf font editor suite.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psf.h"
+#include "psftools_version.h"
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s cmd [opts]\n", cmd);
+	fputs(	"  manage fonts in POSIX shared memory, see psf_share().\n"
+			"cmd is one of\n"
+			"  share <name> <font.psf>\n"
+			"    load font.psf and put it into the shared memory segment\n"
+			"    name. A segment of that name is replaced, processes using it\n"
+			"    keep the old font.\n"
+			"  info <name>\n"
+			"    print version, width, height, number of glyphs, unicode\n"
+			"    table, content hash and size of a shared font.\n"
+			"  get <name> [outfile]\n"
+			"    write a shared font to outfile. If outfile is omitted or -,\n"
+			"    defaults to stdout.\n"
+			"  rm <name>\n"
+			"    remove a shared font.\n"
+			"  name is the name of the segment, a leading / is added if it is\n"
+			"  missing.\n"
+		, stderr);
+	fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char name[FILENAME_MAX];
+	int ok = 0;
+
+	if (argc < 3) {
+		usage(argv[0]);
+	}
+	const char *cmd = argv[1];
+	snprintf(name, FILENAME_MAX, "%s%s", argv[2][0] == '/' ? "" : "/", argv[2]);
+
+	if (!strcmp(cmd, "share") && argc == 4) {
+		struct psf_font *psf = psf_load(argv[3]);
+		ok = psf && psf_share(psf, name);
+		if (psf) { psf_delete(psf); }
+	} else if ((!strcmp(cmd, "info") && argc == 3) || (!strcmp(cmd, "get") && argc <= 4)) {
+		struct psf_font *psf = psf_attach_shared(name);
+		ok = psf != 0;
+		if (ok && cmd[0] == 'i') {
+			printf("%s v:%d w:%d h:%d n:%d u:%d c:%016llx size:%lu\n", name, psf->version, psf_width(psf), psf_height(psf),
+				psf_numglyphs(psf), psf_hasunicodetable(psf), (unsigned long long) psf_hash(psf), (unsigned long) psf->sharedsize);
+		} else if (ok) {
+			const char *outfile = argc > 3 ? argv[3] : "-";
+			ok = strcmp(outfile, "-") ? psf_save(outfile, psf) : psf_save_tofile(stdout, psf);
+		}
+		if (psf) { psf_delete(psf); }
+	} else if (!strcmp(cmd, "rm") && argc == 3) {
+		ok = psf_unshare(name);
+	} else {
+		usage(argv[0]);
+	}
+	exit(ok == 0);
+}
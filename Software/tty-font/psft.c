@@ -2,7 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
 
+#include "psf.h"
+#include "mini_utf8.h"
 #include "psftools_version.h"
 
 #define LINEBUFSIZE 1024
@@ -39,6 +42,9 @@ static int psft_generate(const char* outfile, unsigned int version, unsigned int
 	fprintf(out, "@psf%u\n", version);
 	fprintf(out, "Width: %u\n", width);
 	fprintf(out, "Height: %u\n", height);
+	if (version == 2) {
+		fprintf(out, "Length: %u\n", nchars);
+	}
 	fprintf(out, "Pixel: #\n");
 
 	unsigned int ch, x, y;
@@ -123,6 +129,469 @@ static int psft_renumber(const char *infile, const char *outfile)
 	return 1;
 }
 
+/* adds a persistent lookup index to a binary font, or removes it
+ */
+static int psft_index(const char *infile, const char *outfile, int remove)
+{
+	struct psf_font *psf = infile ? psf_load(infile) : psf_load_fromfile(stdin);
+	if (!psf) { return 0; }
+
+	int ok = 1;
+	if (remove) {
+		psf_dropindex(psf);
+	} else {
+		ok = psf_buildindex(psf, 1);
+	}
+	if (ok) {
+		ok = outfile ? psf_save(outfile, psf) : psf_save_tofile(stdout, psf);
+	}
+	psf_delete(psf);
+	return ok;
+}
+
+/* sorts the glyphs of a binary font by codepoint, the binary counterpart
+ * of renumber
+ */
+static int psft_sort(const char *infile, const char *outfile, int index)
+{
+	struct psf_font *psf = infile ? psf_load(infile) : psf_load_fromfile(stdin);
+	if (!psf) { return 0; }
+
+	int ok = psf_sort(psf);
+	if (ok && index) {
+		ok = psf_buildindex(psf, 1);
+	}
+	if (ok) {
+		ok = outfile ? psf_save(outfile, psf) : psf_save_tofile(stdout, psf);
+	}
+	psf_delete(psf);
+	return ok;
+}
+
+/* counts the characters in a utf8 text file. Blanks and control chars are
+ * not drawn from a glyph, so they do not count. Invalid bytes are skipped.
+ */
+static int psft_counttext(struct psf_usage *usage, const char *textfile)
+{
+	FILE *in = fopen(textfile, "rb");
+	if (!in) {
+		perror(textfile);
+		return 0;
+	}
+	char buf[LINEBUFSIZE + 4];
+	size_t len = 0;
+	int ok = 1, done = 0;
+	/* buf is nul terminated after len bytes, so the decoder stops at the end
+	 * of a chunk. A char that may be cut off there is moved to the start for
+	 * the next one.
+	 */
+	while (ok && !done) {
+		size_t n = fread(buf + len, 1, LINEBUFSIZE - len, in);
+		done = n == 0;
+		len += n;
+		buf[len] = '\0';
+		const char *ptr = buf, *end = buf + len;
+		while (ok && ptr < end) {
+			if (!done && end - ptr < 4 && (unsigned char) *ptr >= 0xc0) { break; }
+			int cp = mini_utf8_decode(&ptr);
+			if (cp < 0) {
+				++ptr;
+			} else if (cp > ' ' && cp != 0x7f) {
+				ok = psf_usage_count(usage, cp, 1);
+			}
+		}
+		len = end - ptr;
+		memmove(buf, ptr, len);
+	}
+	if (ferror(in)) {
+		perror(textfile);
+		ok = 0;
+	}
+	fclose(in);
+	return ok;
+}
+
+/* moves the glyphs used most in a text corpus or a usage histogram to the
+ * start of a binary font
+ */
+static int psft_layout(const char *infile, const char *outfile, char **textfile, unsigned int ntext, char **usagefile, unsigned int nusage, unsigned int percent)
+{
+	struct psf_usage *usage = psf_usage_new();
+	if (!usage) { return 0; }
+	int ok = 1;
+	unsigned int i;
+	for (i = 0; ok && i < ntext; ++i) {
+		ok = psft_counttext(usage, textfile[i]);
+	}
+	for (i = 0; ok && i < nusage; ++i) {
+		FILE *in = fopen(usagefile[i], "r");
+		if (!in) {
+			perror(usagefile[i]);
+			ok = 0;
+		} else {
+			ok = psf_usage_load(usage, in);
+			fclose(in);
+		}
+	}
+	struct psf_font *psf = 0;
+	if (ok) {
+		psf = infile ? psf_load(infile) : psf_load_fromfile(stdin);
+		ok = psf != 0;
+	}
+	ok = ok && psf_layout(psf, usage, percent) >= 0;
+	if (ok) {
+		ok = outfile ? psf_save(outfile, psf) : psf_save_tofile(stdout, psf);
+	}
+	if (psf) { psf_delete(psf); }
+	psf_usage_delete(usage);
+	return ok;
+}
+
+/* spreads the bits of a tile number for morton order: even bits give the
+ * column, odd bits the row.
+ */
+static unsigned int psft_unshuffle(unsigned int v)
+{
+	v &= 0x55555555;
+	v = (v | (v >> 1)) & 0x33333333;
+	v = (v | (v >> 2)) & 0x0f0f0f0f;
+	v = (v | (v >> 4)) & 0x00ff00ff;
+	v = (v | (v >> 8)) & 0x0000ffff;
+	return v;
+}
+
+/* writes all glyphs of a binary font into one pbm (1 bit per pixel) or pgm
+ * (8 bit per pixel) image, with a text index giving the position of each
+ * glyph. Tiles are padded to whole bytes (1bpp) or to the simd width (8bpp),
+ * and image rows to a multiple of the cache line size. In morton order,
+ * glyph numbers are laid out along a z-curve in blocks of cols x cols tiles,
+ * so neighbouring glyphs are close in both directions.
+ */
+static int psft_atlas(const char *infile, const char *outfile, const char *idxfile, unsigned int bpp, unsigned int cols, unsigned int simd, unsigned int line, int morton)
+{
+	if (cols == 0 || simd == 0 || line == 0 || (morton && (cols & (cols - 1)))) {
+		fprintf(stderr, "psft: invalid atlas layout%s\n", morton ? ", morton order needs a power of 2 columns" : "");
+		return 0;
+	}
+	struct psf_font *psf = infile ? psf_load(infile) : psf_load_fromfile(stdin);
+	if (!psf) { return 0; }
+
+	unsigned int width = psf_width(psf), height = psf_height(psf), numglyphs = psf_numglyphs(psf);
+	unsigned int tilebytes = bpp == 1 ? (width + 7) / 8 : (width + simd - 1) / simd * simd;
+	unsigned int tilew = bpp == 1 ? tilebytes * 8 : tilebytes;
+	unsigned int stride = (cols * tilebytes + line - 1) / line * line;
+	unsigned int rows = (numglyphs + cols - 1) / cols;
+	if (morton) { rows = (rows + cols - 1) / cols * cols; }
+	if (rows == 0) { rows = 1; }
+	size_t size = (size_t) stride * rows * height;
+
+	unsigned char *img = calloc(1, size);
+	FILE *out = 0, *idx = 0;
+	int ok = 0;
+	if (!img) {
+		perror("psft");
+		goto out;
+	}
+	out = outfile ? fopen(outfile, "wb") : stdout;
+	if (!out) {
+		perror(outfile);
+		goto out;
+	}
+	if (idxfile) {
+		idx = fopen(idxfile, "w");
+		if (!idx) {
+			perror(idxfile);
+			goto out;
+		}
+		fprintf(idx, "psfatlas 1\nglyphs %u width %u height %u tile %ux%u cols %u stride %u bpp %u order %s\n",
+			numglyphs, width, height, tilew, height, cols, stride, bpp, morton ? "morton" : "linear");
+	}
+
+	unsigned int no, x, y, ucv;
+	for (no = 0; no < numglyphs; ++no) {
+		struct psf_glyph *glyph = psf_getglyph(psf, no);
+		unsigned int col = no % cols, row = no / cols;
+		if (morton) {
+			unsigned int block = no / (cols * cols), pos = no % (cols * cols);
+			col = psft_unshuffle(pos);
+			row = block * cols + psft_unshuffle(pos >> 1);
+		}
+		unsigned char *tile = img + (size_t) row * height * stride + col * tilebytes;
+		const unsigned char *src = glyph->data;
+		unsigned int srcbytes = (width + 7) / 8;
+		for (y = 0; src && y < height; ++y, src += srcbytes) {
+			unsigned char *dst = tile + (size_t) y * stride;
+			/* psf rows are msb first and byte padded, just like pbm rows */
+			if (bpp == 1) {
+				memcpy(dst, src, srcbytes);
+			} else {
+				for (x = 0; x < width; ++x) {
+					dst[x] = (src[x / 8] & (0x80 >> (x % 8))) ? 255 : 0;
+				}
+			}
+		}
+		if (idx) {
+			fprintf(idx, "%u %u %u", no, col * tilew, row * height);
+			for (ucv = 0; ucv < glyph->nucvals; ++ucv) {
+				if (glyph->ucvals[ucv] == PSF1_STARTSEQ) {
+					fputs(" ;", idx);
+				} else {
+					fprintf(idx, " U+%04x", glyph->ucvals[ucv]);
+				}
+			}
+			fputc('\n', idx);
+		}
+	}
+
+	if (bpp == 1) {
+		fprintf(out, "P4\n%u %u\n", stride * 8, rows * height);
+	} else {
+		fprintf(out, "P5\n%u %u\n255\n", stride, rows * height);
+	}
+	ok = fwrite(img, 1, size, out) == size;
+	if (fflush(out) != 0 || (idx && ferror(idx))) { ok = 0; }
+	if (!ok) { perror("psft"); }
+
+out:
+	if (idx) { fclose(idx); }
+	if (out && out != stdout) { fclose(out); }
+	free(img);
+	psf_delete(psf);
+	return ok;
+}
+
+/* whole font transforms. All glyph rows are loaded into one array of 64 bit
+ * words, one per row with the leftmost pixel in the top bit, so that every
+ * transform is a simple loop over that array the compiler can vectorize.
+ */
+
+#define PSFT_MAXWIDTH 64
+
+struct psft_rows {
+	uint64_t *row;
+	size_t nglyphs;
+	unsigned int width, height;
+};
+
+static uint64_t psft_rowmask(unsigned int width)
+{
+	return width >= 64 ? ~(uint64_t) 0 : ~(~(uint64_t) 0 >> width);
+}
+
+static int psft_rows_load(struct psft_rows *rows, struct psf_font *psf)
+{
+	unsigned int rowbytes = (psf_width(psf) + 7) / 8, y, b;
+	size_t no;
+	rows->nglyphs = psf_numglyphs(psf);
+	rows->width = psf_width(psf);
+	rows->height = psf_height(psf);
+	rows->row = calloc(rows->nglyphs * rows->height + 1, sizeof(uint64_t));
+	if (!rows->row) {
+		perror("psft");
+		return 0;
+	}
+	for (no = 0; no < rows->nglyphs; ++no) {
+		const unsigned char *src = psf->glyph[no].data;
+		uint64_t *dst = &rows->row[no * rows->height];
+		for (y = 0; src && y < rows->height; ++y, src += rowbytes) {
+			uint64_t r = 0;
+			for (b = 0; b < rowbytes; ++b) {
+				r |= (uint64_t) src[b] << (56 - 8 * b);
+			}
+			dst[y] = r;
+		}
+	}
+	return 1;
+}
+
+static int psft_rows_store(struct psft_rows *rows, struct psf_font *psf)
+{
+	unsigned int rowbytes = (rows->width + 7) / 8, y, b;
+	size_t no;
+	/* the bitmaps belong to the font, so they are replaced through it */
+	if (!psf_resize(psf, rows->width, rows->height)) { return 0; }
+	for (no = 0; no < rows->nglyphs; ++no) {
+		unsigned char *dst = psf->glyph[no].data;
+		const uint64_t *src = &rows->row[no * rows->height];
+		for (y = 0; y < rows->height; ++y, dst += rowbytes) {
+			for (b = 0; b < rowbytes; ++b) {
+				dst[b] = src[y] >> (56 - 8 * b);
+			}
+		}
+	}
+	return 1;
+}
+
+static void psft_invert(struct psft_rows *rows)
+{
+	uint64_t mask = psft_rowmask(rows->width);
+	size_t i, n = rows->nglyphs * rows->height;
+	for (i = 0; i < n; ++i) {
+		rows->row[i] = ~rows->row[i] & mask;
+	}
+}
+
+/* shifts right by n pixels, or left for negative n */
+static void psft_shiftx(struct psft_rows *rows, int n)
+{
+	uint64_t mask = psft_rowmask(rows->width);
+	size_t i, count = rows->nglyphs * rows->height;
+	unsigned int by = n < 0 ? -n : n;
+	if (by >= 64) {
+		memset(rows->row, 0, count * sizeof(uint64_t));
+	} else if (n > 0) {
+		for (i = 0; i < count; ++i) { rows->row[i] = (rows->row[i] >> by) & mask; }
+	} else {
+		for (i = 0; i < count; ++i) { rows->row[i] = (rows->row[i] << by) & mask; }
+	}
+}
+
+/* shifts down by n rows, or up for negative n */
+static void psft_shifty(struct psft_rows *rows, int n)
+{
+	unsigned int height = rows->height, by = n < 0 ? -n : n;
+	size_t no;
+	if (by > height) { by = height; }
+	for (no = 0; no < rows->nglyphs; ++no) {
+		uint64_t *glyph = &rows->row[no * height];
+		if (n > 0) {
+			memmove(glyph + by, glyph, (height - by) * sizeof(uint64_t));
+			memset(glyph, 0, by * sizeof(uint64_t));
+		} else {
+			memmove(glyph, glyph + by, (height - by) * sizeof(uint64_t));
+			memset(glyph + height - by, 0, by * sizeof(uint64_t));
+		}
+	}
+}
+
+static void psft_mirrorx(struct psft_rows *rows)
+{
+	size_t i, n = rows->nglyphs * rows->height;
+	unsigned int by = 64 - rows->width;
+	for (i = 0; i < n; ++i) {
+		uint64_t r = rows->row[i];
+		r = ((r >> 1) & 0x5555555555555555ULL) | ((r & 0x5555555555555555ULL) << 1);
+		r = ((r >> 2) & 0x3333333333333333ULL) | ((r & 0x3333333333333333ULL) << 2);
+		r = ((r >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((r & 0x0f0f0f0f0f0f0f0fULL) << 4);
+		r = ((r >> 8) & 0x00ff00ff00ff00ffULL) | ((r & 0x00ff00ff00ff00ffULL) << 8);
+		r = ((r >> 16) & 0x0000ffff0000ffffULL) | ((r & 0x0000ffff0000ffffULL) << 16);
+		r = (r >> 32) | (r << 32);
+		rows->row[i] = by < 64 ? r << by : 0;
+	}
+}
+
+static void psft_mirrory(struct psft_rows *rows)
+{
+	unsigned int height = rows->height, y;
+	size_t no;
+	for (no = 0; no < rows->nglyphs; ++no) {
+		uint64_t *glyph = &rows->row[no * height];
+		for (y = 0; y < height / 2; ++y) {
+			uint64_t t = glyph[y];
+			glyph[y] = glyph[height - 1 - y];
+			glyph[height - 1 - y] = t;
+		}
+	}
+}
+
+/* synthetic bold: every set pixel also sets the one to its right */
+static void psft_bold(struct psft_rows *rows)
+{
+	uint64_t mask = psft_rowmask(rows->width);
+	size_t i, n = rows->nglyphs * rows->height;
+	for (i = 0; i < n; ++i) {
+		rows->row[i] = (rows->row[i] | (rows->row[i] >> 1)) & mask;
+	}
+}
+
+/* adds left, top, right and bottom pixels around the glyphs, or crops them
+ * off if negative.
+ */
+static int psft_pad(struct psft_rows *rows, int left, int top, int right, int bottom)
+{
+	long width = (long) rows->width + left + right, height = (long) rows->height + top + bottom;
+	if (width < 1 || width > PSFT_MAXWIDTH || height < 1 || height > 0xffff) {
+		fprintf(stderr, "psft: invalid glyph size %ldx%ld after padding\n", width, height);
+		return 0;
+	}
+	uint64_t *row = calloc(rows->nglyphs * height + 1, sizeof(uint64_t));
+	if (!row) {
+		perror("psft");
+		return 0;
+	}
+	size_t no;
+	long y;
+	for (no = 0; no < rows->nglyphs; ++no) {
+		const uint64_t *src = &rows->row[no * rows->height];
+		uint64_t *dst = &row[no * height];
+		for (y = 0; y < height; ++y) {
+			long sy = y - top;
+			if (sy >= 0 && sy < (long) rows->height) { dst[y] = src[sy]; }
+		}
+	}
+	free(rows->row);
+	rows->row = row;
+	rows->height = height;
+	rows->width = width;
+	uint64_t mask = psft_rowmask(width);
+	size_t i, n = rows->nglyphs * height;
+	long by = left < 0 ? -(long) left : left;
+	for (i = 0; i < n; ++i) {
+		/* left and right may cancel out, so by can be any size */
+		if (by >= 64) {
+			row[i] = 0;
+		} else {
+			row[i] = (left >= 0 ? row[i] >> by : row[i] << by) & mask;
+		}
+	}
+	return 1;
+}
+
+/* one transform step, as given on the command line */
+struct psft_op {
+	char op;		/* i, x, y, m, b or p */
+	int arg[4];
+};
+
+static int psft_transform(const char *infile, const char *outfile, const struct psft_op *ops, unsigned int nops)
+{
+	struct psf_font *psf = infile ? psf_load(infile) : psf_load_fromfile(stdin);
+	if (!psf) { return 0; }
+	struct psft_rows rows;
+	rows.row = 0;
+	int ok = 1;
+	unsigned int i;
+	if (psf_width(psf) > PSFT_MAXWIDTH) {
+		fprintf(stderr, "psft: transforms work on fonts up to %u pixels wide\n", PSFT_MAXWIDTH);
+		ok = 0;
+	}
+	ok = ok && psft_rows_load(&rows, psf);
+	for (i = 0; ok && i < nops; ++i) {
+		const struct psft_op *op = &ops[i];
+		switch (op->op) {
+		case 'i': psft_invert(&rows); break;
+		case 'x': psft_shiftx(&rows, op->arg[0]); break;
+		case 'y': psft_shifty(&rows, op->arg[0]); break;
+		case 'm': if (op->arg[0] == 'h') { psft_mirrorx(&rows); } else { psft_mirrory(&rows); } break;
+		case 'b': psft_bold(&rows); break;
+		case 'p': ok = psft_pad(&rows, op->arg[0], op->arg[1], op->arg[2], op->arg[3]); break;
+		}
+	}
+	if (ok && psf->version == 1 && (rows.width != 8 || rows.height > 255)) {
+		fprintf(stderr, "psft: psf1 fonts must be 8 pixels wide and at most 255 high\n");
+		ok = 0;
+	}
+	if (ok) {
+		ok = psft_rows_store(&rows, psf);
+	}
+	if (ok) {
+		ok = outfile ? psf_save(outfile, psf) : psf_save_tofile(stdout, psf);
+	}
+	free(rows.row);
+	psf_delete(psf);
+	return ok;
+}
+
 static void usage(const char *cmd)
 {
 	fprintf(stderr, "Usage: %s cmd [opts]\n", cmd);
@@ -136,6 +605,36 @@ static void usage(const char *cmd)
 			"    to 8, and num (the amount of chars in the font) defaults to 256.\n"
 			"    Specify -u to add sample unicode values to the template.\n"
 			"    If outfile is omitted, defaults to stdout.\n"
+			"  index [-r] [infile [outfile]]\n"
+			"    add a lookup index to a binary psf2 font, or remove it with -r.\n"
+			"    If infile is omitted or -, defaults to stdin. If outfile is\n"
+			"    omitted, defaults to stdout.\n"
+			"  sort [-i] [infile [outfile]]\n"
+			"    sort the glyphs of a binary font by codepoint, so that runs of\n"
+			"    consecutive codepoints have consecutive glyph numbers. -i adds\n"
+			"    a lookup index with the runs to a psf2 font. If infile is omitted\n"
+			"    or -, defaults to stdin. If outfile is omitted, defaults to stdout.\n"
+			"  layout [-t <textfile>]... [-u <usagefile>]... [-p <percent>] [infile [outfile]]\n"
+			"    move the glyphs used most in the text files and usage histograms\n"
+			"    to the start of a binary font. The hot glyphs are the fewest that\n"
+			"    make up percent (default 99) of all uses. If infile is omitted\n"
+			"    or -, defaults to stdin. If outfile is omitted, defaults to stdout.\n"
+			"  atlas [-8] [-m] [-c <cols>] [-s <simd>] [-l <line>] [-i <idxfile>] [infile [outfile]]\n"
+			"    write all glyphs of a binary font into one pbm image, or a pgm\n"
+			"    image with -8. cols (default 16) is the number of glyphs per row,\n"
+			"    -m lays them out in morton order. 8 bit tiles are padded to simd\n"
+			"    (default 16) bytes, rows to line (default 64) bytes. The glyph\n"
+			"    positions are written to idxfile, by default outfile.idx.\n"
+			"    If infile is omitted or -, defaults to stdin. If outfile is\n"
+			"    omitted, defaults to stdout.\n"
+			"  transform [-i] [-x <n>] [-y <n>] [-m h|v] [-b] [-p <l>,<t>,<r>,<b>]... [infile [outfile]]\n"
+			"    transform all glyphs of a binary font, in the order the options\n"
+			"    are given: -i inverts, -x and -y shift right and down by n pixels\n"
+			"    (left and up if negative), -m mirrors horizontally or vertically,\n"
+			"    -b makes bold by smearing one pixel to the right, and -p adds\n"
+			"    pixels to the left, top, right and bottom, or crops them if\n"
+			"    negative. If infile is omitted or -, defaults to stdin. If outfile\n"
+			"    is omitted, defaults to stdout.\n"
 			"  -h|--help|help\n"
 			"    print this help\n"
 		, stderr);
@@ -197,6 +696,159 @@ int main(int argc, char **argv)
 		if (!psft_generate(outfile, version, width, height, num, uni)) {
 			exit(1);
 		}
+	} else if (strcmp(argv[1], "index") == 0) {
+		int arg = 2, remove = 0;
+		if (argc > arg && strcmp(argv[arg], "-r") == 0) {
+			remove = 1;
+			++arg;
+		}
+		if (argc - arg > 2) {
+			usage(argv[0]);
+		}
+		const char *infile = 0, *outfile = 0;
+		if (argc > arg && strcmp(argv[arg], "-") != 0) {
+			infile = argv[arg];
+		}
+		if (argc > arg + 1) {
+			outfile = argv[arg + 1];
+		}
+		if (!psft_index(infile, outfile, remove)) {
+			exit(1);
+		}
+	} else if (strcmp(argv[1], "sort") == 0) {
+		int arg = 2, index = 0;
+		if (argc > arg && strcmp(argv[arg], "-i") == 0) {
+			index = 1;
+			++arg;
+		}
+		if (argc - arg > 2) {
+			usage(argv[0]);
+		}
+		const char *infile = 0, *outfile = 0;
+		if (argc > arg && strcmp(argv[arg], "-") != 0) {
+			infile = argv[arg];
+		}
+		if (argc > arg + 1) {
+			outfile = argv[arg + 1];
+		}
+		if (!psft_sort(infile, outfile, index)) {
+			exit(1);
+		}
+	} else if (strcmp(argv[1], "layout") == 0) {
+		char **textfile = calloc(argc, sizeof(char*)), **usagefile = calloc(argc, sizeof(char*));
+		unsigned int ntext = 0, nusage = 0, percent = 99;
+		const char *infile = 0, *outfile = 0;
+		int arg = 2;
+		if (!textfile || !usagefile) {
+			perror("psft");
+			exit(1);
+		}
+		while (argc > arg && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+			if (argc > arg + 1 && !strcmp(argv[arg], "-t")) {
+				textfile[ntext++] = argv[++arg];
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-u")) {
+				usagefile[nusage++] = argv[++arg];
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-p")) {
+				percent = (unsigned int) strtoul(argv[++arg], 0, 10);
+			} else {
+				usage(argv[0]);
+			}
+			++arg;
+		}
+		if (argc - arg > 2) {
+			usage(argv[0]);
+		}
+		if (argc > arg && strcmp(argv[arg], "-") != 0) {
+			infile = argv[arg];
+		}
+		if (argc > arg + 1) {
+			outfile = argv[arg + 1];
+		}
+		int ok = psft_layout(infile, outfile, textfile, ntext, usagefile, nusage, percent);
+		free(textfile);
+		free(usagefile);
+		if (!ok) {
+			exit(1);
+		}
+	} else if (strcmp(argv[1], "atlas") == 0) {
+		unsigned int bpp = 1, cols = 16, simd = 16, line = 64;
+		const char *infile = 0, *outfile = 0, *idxfile = 0;
+		char idxbuf[LINEBUFSIZE];
+		int arg = 2, morton = 0;
+		while (argc > arg && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+			if (!strcmp(argv[arg], "-8")) {
+				bpp = 8;
+			} else if (!strcmp(argv[arg], "-m")) {
+				morton = 1;
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-c")) {
+				cols = (unsigned int) strtoul(argv[++arg], 0, 10);
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-s")) {
+				simd = (unsigned int) strtoul(argv[++arg], 0, 10);
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-l")) {
+				line = (unsigned int) strtoul(argv[++arg], 0, 10);
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-i")) {
+				idxfile = argv[++arg];
+			} else {
+				usage(argv[0]);
+			}
+			++arg;
+		}
+		if (argc - arg > 2) {
+			usage(argv[0]);
+		}
+		if (argc > arg && strcmp(argv[arg], "-") != 0) {
+			infile = argv[arg];
+		}
+		if (argc > arg + 1) {
+			outfile = argv[arg + 1];
+			if (!idxfile) {
+				snprintf(idxbuf, sizeof(idxbuf), "%s.idx", outfile);
+				idxfile = idxbuf;
+			}
+		}
+		if (!psft_atlas(infile, outfile, idxfile, bpp, cols, simd, line, morton)) {
+			exit(1);
+		}
+	} else if (strcmp(argv[1], "transform") == 0) {
+		struct psft_op *ops = calloc(argc, sizeof(struct psft_op));
+		unsigned int nops = 0;
+		const char *infile = 0, *outfile = 0;
+		int arg = 2;
+		if (!ops) {
+			perror("psft");
+			exit(1);
+		}
+		while (argc > arg && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+			struct psft_op *op = &ops[nops++];
+			op->op = argv[arg][1];
+			if (!strcmp(argv[arg], "-i") || !strcmp(argv[arg], "-b")) {
+				/* no argument */
+			} else if (argc > arg + 1 && (!strcmp(argv[arg], "-x") || !strcmp(argv[arg], "-y"))) {
+				op->arg[0] = (int) strtol(argv[++arg], 0, 10);
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-m") && (!strcmp(argv[arg + 1], "h") || !strcmp(argv[arg + 1], "v"))) {
+				op->arg[0] = argv[++arg][0];
+			} else if (argc > arg + 1 && !strcmp(argv[arg], "-p")
+				&& sscanf(argv[arg + 1], "%d,%d,%d,%d", &op->arg[0], &op->arg[1], &op->arg[2], &op->arg[3]) == 4) {
+				++arg;
+			} else {
+				usage(argv[0]);
+			}
+			++arg;
+		}
+		if (argc - arg > 2) {
+			usage(argv[0]);
+		}
+		if (argc > arg && strcmp(argv[arg], "-") != 0) {
+			infile = argv[arg];
+		}
+		if (argc > arg + 1) {
+			outfile = argv[arg + 1];
+		}
+		int ok = psft_transform(infile, outfile, ops, nops);
+		free(ops);
+		if (!ok) {
+			exit(1);
+		}
 	} else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "help") == 0) {
 		usage(argv[0]);
 	} else {
@@ -0,0 +1,383 @@
+/* psfterm
+ *
+ * Runs terminal output through the vt emulation and dumps the resulting
+ * screen, as text or as an image drawn with psf fonts.
+ * part of a simple textfile based psf font editor suite.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "psf.h"
+#include "vt.h"
+#include "cellcache.h"
+#include "scrollback.h"
+#include "panel.h"
+#include "mini_utf8.h"
+#include "psftools_version.h"
+
+/* output is fed to the terminal, and optionally drawn, in chunks this big */
+#define CHUNKSIZE 65536
+
+#define MAXFONTS 16
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s [-s <cols>x<rows>] [-f font.psf]... [-o image.ppm] [-b <n>] [-c <KiB>] [-k <KiB> [-g <text>]] [-p <dmasize> [-w <file>]] [-u <usagefile>] [infile]\n", cmd);
+	fputs(	"  feed terminal output through a vt100 emulation and print the\n"
+			"  resulting screen as text. The screen size defaults to 80x25.\n"
+			"  -f adds a font, glyphs missing in one font are taken from the\n"
+			"     next one. With -o, the screen is drawn with the fonts and\n"
+			"     written as a ppm image instead of printed. shm:/name uses\n"
+			"     a font shared with psfshm.\n"
+			"  -b feeds the input n times and prints the throughput to\n"
+			"     stderr. If fonts are given, the screen is drawn after every\n"
+			"     chunk of input, like a terminal would between frames.\n"
+			"  -c draws through a cache of rendered cells of the given size,\n"
+			"     and prints its hit rate with -b.\n"
+			"  -k keeps lines scrolled off the screen in a compressed buffer of\n"
+			"     the given size, and prints them before the screen.\n"
+			"  -g prints only the lines in the scrollback that contain text.\n"
+			"  -p sends the screen to a simulated spi panel after every chunk\n"
+			"     of input, with dma buffers of the given size, checks it\n"
+			"     against the screen and prints statistics to stderr.\n"
+			"  -w writes the spi traffic to file instead of simulating a panel.\n"
+			"  -u draws the screen after every chunk of input and counts the\n"
+			"     glyphs drawn in usagefile, for psft layout. Counts already in\n"
+			"     the file are added to.\n"
+			"  If infile is omitted or -, defaults to stdin.\n"
+		, stderr);
+	fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
+	exit(1);
+}
+
+/* prints a line of cells like vt_dump does */
+static void psfterm_printline(const struct vt_cell *line, unsigned int cols, FILE *out)
+{
+	char buf[4];
+	unsigned int x;
+	while (cols > 0 && line[cols - 1].ch == ' ') { --cols; }
+	for (x = 0; x < cols; ++x) {
+		int n = mini_utf8_encode(line[x].ch, buf, sizeof(buf));
+		if (n > 0) { fwrite(buf, 1, n, out); }
+	}
+	fputc('\n', out);
+}
+
+/* prints the lines of the scrollback containing text, or all of them */
+static int psfterm_printscrollback(struct scrollback *sb, unsigned int cols, const char *text)
+{
+	struct vt_cell *line = calloc(cols, sizeof(struct vt_cell));
+	uint32_t *str = calloc(strlen(text ? text : "") + 1, sizeof(uint32_t));
+	unsigned int len = 0;
+	int no;
+	if (!line || !str) {
+		perror("psfterm");
+		free(line);
+		free(str);
+		return 0;
+	}
+	if (text) {
+		const char *ptr = text;
+		while (*ptr) {
+			int cp = mini_utf8_decode(&ptr);
+			if (cp < 0) {
+				fprintf(stderr, "psfterm: invalid utf8 in search text\n");
+				free(line);
+				free(str);
+				return 0;
+			}
+			str[len++] = cp;
+		}
+		/* matches are found from newest to oldest, print them in order */
+		unsigned int nmatches = 0, i;
+		int *match = malloc((scrollback_lines(sb) + 1) * sizeof(int));
+		for (no = 0; match && (no = scrollback_search(sb, str, len, no)) >= 0; ++no) {
+			match[nmatches++] = no;
+		}
+		for (i = nmatches; i-- > 0;) {
+			scrollback_line(sb, match[i], line, cols);
+			psfterm_printline(line, cols, stdout);
+		}
+		free(match);
+	} else {
+		for (no = scrollback_lines(sb); no-- > 0;) {
+			scrollback_line(sb, no, line, cols);
+			psfterm_printline(line, cols, stdout);
+		}
+	}
+	free(line);
+	free(str);
+	return !ferror(stdout);
+}
+
+/* prints what was sent to the panel, and compares what is on the simulated
+ * panel with the screen drawn in one go.
+ */
+static int psfterm_checkpanel(struct panel *panel, struct vt *vt, struct psf_fontset *set, unsigned char *fb, int check)
+{
+	size_t npx = panel->stride * panel->rows * panel->cellh, i;
+	double full = (double) panel->updates * (npx * 2 + PANEL_WINDOW_COST);
+	fprintf(stderr, "psfterm: %llu panel updates, %llu windows, %llu bytes, %.1f%% of full frames\n",
+		panel->updates, panel->windows, panel->bytes, full > 0 ? panel->bytes * 100.0 / full : 0);
+	if (!check) { return 1; }
+
+	memset(vt->dirty, 1, vt->rows);
+	vt_render(vt, set, fb, panel->stride);
+	const uint16_t *pixels = panel_memory_pixels(panel->transport);
+	for (i = 0; i < npx; ++i) {
+		if (pixels[i] != panel->color[fb[i]]) {
+			fprintf(stderr, "psfterm: panel differs from screen at pixel %zu\n", i);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* reads a whole file into memory */
+static unsigned char *psfterm_readall(FILE *in, size_t *len)
+{
+	size_t size = CHUNKSIZE, n;
+	unsigned char *buf = malloc(size);
+	*len = 0;
+	while (buf && (n = fread(buf + *len, 1, size - *len, in)) > 0) {
+		*len += n;
+		if (*len == size) {
+			unsigned char *newbuf = realloc(buf, size * 2);
+			if (!newbuf) { free(buf); }
+			buf = newbuf;
+			size *= 2;
+		}
+	}
+	if (!buf || ferror(in)) {
+		perror("psfterm");
+		free(buf);
+		return 0;
+	}
+	return buf;
+}
+
+static int psfterm_writeppm(const char *filename, const unsigned char *fb, unsigned int width, unsigned int height)
+{
+	FILE *out = fopen(filename, "wb");
+	if (!out) {
+		perror(filename);
+		return 0;
+	}
+	fprintf(out, "P6\n%u %u\n255\n", width, height);
+	size_t i, npx = (size_t) width * height;
+	for (i = 0; i < npx; ++i) {
+		uint32_t rgb = vt_palette(fb[i]);
+		fputc(rgb >> 16, out);
+		fputc((rgb >> 8) & 0xff, out);
+		fputc(rgb & 0xff, out);
+	}
+	int ok = !ferror(out);
+	if (fclose(out) != 0) { ok = 0; }
+	if (!ok) { perror(filename); }
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int cols = 80, rows = 25, bench = 0, i;
+	const char *fontfile[MAXFONTS], *imagefile = 0, *infile = 0;
+	unsigned int nfonts = 0;
+	size_t sbsize = 0, cachesize = 0;
+	const char *search = 0, *spifile = 0, *usagefile = 0;
+	size_t dmasize = 0;
+	int arg = 1;
+
+	while (arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+		if (arg + 1 >= argc) {
+			usage(argv[0]);
+		}
+		if (!strcmp(argv[arg], "-s")) {
+			if (sscanf(argv[arg + 1], "%ux%u", &cols, &rows) != 2) {
+				usage(argv[0]);
+			}
+		} else if (!strcmp(argv[arg], "-f") && nfonts < MAXFONTS) {
+			fontfile[nfonts++] = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "-o")) {
+			imagefile = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "-c")) {
+			cachesize = (size_t) strtoul(argv[arg + 1], 0, 10) * 1024;
+		} else if (!strcmp(argv[arg], "-k")) {
+			sbsize = (size_t) strtoul(argv[arg + 1], 0, 10) * 1024;
+		} else if (!strcmp(argv[arg], "-g")) {
+			search = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "-p")) {
+			dmasize = (size_t) strtoul(argv[arg + 1], 0, 10);
+		} else if (!strcmp(argv[arg], "-w")) {
+			spifile = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "-u")) {
+			usagefile = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "-b")) {
+			bench = (unsigned int) strtoul(argv[arg + 1], 0, 10);
+		} else {
+			usage(argv[0]);
+		}
+		arg += 2;
+	}
+	if (arg + 1 < argc) {
+		usage(argv[0]);
+	}
+	if (arg < argc && strcmp(argv[arg], "-") != 0) {
+		infile = argv[arg];
+	}
+	if ((imagefile || dmasize || usagefile) && nfonts == 0) {
+		fprintf(stderr, "psfterm: %s needs a font\n", imagefile ? "-o" : dmasize ? "-p" : "-u");
+		exit(1);
+	}
+
+	struct psf_fontset *set = 0;
+	unsigned char *fb = 0;
+	unsigned int fbwidth = 0, fbheight = 0;
+	if (nfonts > 0) {
+		set = psf_fontset_new();
+		if (!set) { exit(1); }
+		for (i = 0; i < nfonts; ++i) {
+			/* shm:/name attaches a font shared with psfshm */
+			struct psf_font *psf = strncmp(fontfile[i], "shm:", 4) ? psf_load(fontfile[i]) : psf_attach_shared(fontfile[i] + 4);
+			if (!psf || !psf_fontset_add(set, psf)) {
+				if (psf) { psf_delete(psf); }
+				psf_fontset_delete(set);
+				exit(1);
+			}
+		}
+		fbwidth = cols * psf_width(psf_fontset_font(set, 0));
+		fbheight = rows * psf_height(psf_fontset_font(set, 0));
+		fb = malloc((size_t) fbwidth * fbheight);
+		if (!fb) {
+			perror("psfterm");
+			psf_fontset_delete(set);
+			exit(1);
+		}
+	}
+
+	struct vt *vt = vt_new(cols, rows);
+	if (!vt) { exit(1); }
+	if (cachesize > 0 && set) {
+		struct psf_font *first = psf_fontset_font(set, 0);
+		vt->cache = cellcache_new(psf_width(first), psf_height(first), cachesize, 0);
+		if (!vt->cache) { exit(1); }
+	}
+	if (usagefile) {
+		vt->usage = psf_usage_new();
+		if (!vt->usage) { exit(1); }
+		FILE *uf = fopen(usagefile, "r");
+		if (uf) {
+			int loaded = psf_usage_load(vt->usage, uf);
+			fclose(uf);
+			if (!loaded) { exit(1); }
+		}
+	}
+	struct scrollback *sb = 0;
+	if (sbsize > 0) {
+		sb = scrollback_new(sbsize);
+		if (!sb) { exit(1); }
+		vt->scrolled = scrollback_push;
+		vt->ctx = sb;
+	} else if (search) {
+		fprintf(stderr, "psfterm: -g needs -k\n");
+		exit(1);
+	}
+
+	struct panel *panel = 0;
+	FILE *spi = 0;
+	if (dmasize) {
+		spi = spifile ? fopen(spifile, "wb") : 0;
+		if (spifile && !spi) {
+			perror(spifile);
+			exit(1);
+		}
+		struct panel_transport *tp = spi ? panel_file_transport(spi) : panel_memory_transport(fbwidth, fbheight);
+		if (!tp || !(panel = panel_new(vt, set, tp, dmasize))) { exit(1); }
+	}
+
+	FILE *in = infile ? fopen(infile, "rb") : stdin;
+	if (!in) {
+		perror(infile);
+		exit(1);
+	}
+	size_t len = 0, pos;
+	unsigned char *buf = psfterm_readall(in, &len);
+	if (in != stdin) { fclose(in); }
+	if (!buf) { exit(1); }
+
+	struct timespec start, end;
+	unsigned int round, nrounds = bench ? bench : 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < nrounds; ++round) {
+		for (pos = 0; pos < len; pos += CHUNKSIZE) {
+			vt_write(vt, buf + pos, len - pos < CHUNKSIZE ? len - pos : CHUNKSIZE);
+			if (panel) {
+				if (!panel_update(panel, vt, set)) { exit(1); }
+			} else if ((bench || usagefile) && set) {
+				vt_render(vt, set, fb, fbwidth);
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (bench) {
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		double mb = (double) len * nrounds / (1024 * 1024);
+		fprintf(stderr, "psfterm: %.1f MB in %.3f s, %.1f MB/s\n", mb, secs, secs > 0 ? mb / secs : 0);
+		if (sb) {
+			fprintf(stderr, "psfterm: %u lines of scrollback in %zu bytes\n", scrollback_lines(sb), scrollback_size(sb));
+		}
+		if (vt->cache) {
+			struct cellcache *cache = vt->cache;
+			unsigned long long total = cache->hits + cache->misses;
+			fprintf(stderr, "psfterm: %u cells in %zu bytes of cache, %.1f%% hits, %llu evictions\n",
+				cache->nentries, cache->used, total ? cache->hits * 100.0 / total : 0, cache->evictions);
+		}
+	}
+
+	int ok = 1;
+	if (panel) {
+		ok = psfterm_checkpanel(panel, vt, set, fb, spi == 0);
+		panel_delete(panel);
+		if (spi && fclose(spi) != 0) {
+			perror(spifile);
+			ok = 0;
+		}
+	}
+	if (imagefile) {
+		memset(vt->dirty, 1, vt->rows);
+		vt_render(vt, set, fb, fbwidth);
+		ok = psfterm_writeppm(imagefile, fb, fbwidth, fbheight) && ok;
+	} else if (search) {
+		ok = psfterm_printscrollback(sb, cols, search) && ok;
+	} else if (!bench) {
+		ok = (!sb || psfterm_printscrollback(sb, cols, 0)) && vt_dump(vt, stdout) && ok;
+	}
+
+	if (vt->usage) {
+		FILE *uf = fopen(usagefile, "w");
+		if (!uf) {
+			perror(usagefile);
+			ok = 0;
+		} else {
+			ok = psf_usage_save(vt->usage, uf) && ok;
+			if (fclose(uf) != 0) {
+				perror(usagefile);
+				ok = 0;
+			}
+		}
+		psf_usage_delete(vt->usage);
+	}
+
+	free(buf);
+	free(fb);
+	if (vt->cache) { cellcache_delete(vt->cache); }
+	vt_delete(vt);
+	if (sb) { scrollback_delete(sb); }
+	if (set) { psf_fontset_delete(set); }
+
+	exit(ok == 0);
+}
@@ -9,6 +9,6 @@
 #ifndef psftools_version_h
 #define psftools_version_h
 
-#define PSFTOOLS_VERSION "0.5.1"
+#define PSFTOOLS_VERSION "0.6"
 
 #endif /* psftools_version_h */
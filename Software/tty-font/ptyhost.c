@@ -0,0 +1,470 @@
+/* ptyhost
+ *
+ * Runs a program on a pseudo terminal, feeds its output through the vt
+ * emulation and forwards keyboard input to it. Linux only, uses epoll.
+ * part of a simple textfile based psf font editor suite.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include "psf.h"
+#include "vt.h"
+#include "psftools_version.h"
+
+/* output is read in chunks this big */
+#define CHUNKSIZE 65536
+
+/* keyboard input is buffered up to CHUNKSIZE bytes, status replies may use
+ * the rest
+ */
+#define INBUFSIZE (2 * CHUNKSIZE)
+
+/* the screen is drawn at most once per frame */
+#define FRAME_NS 16666666LL
+
+#define MAXFONTS 16
+
+struct ptyhost {
+	int master;
+	pid_t child;
+	struct vt *vt;
+	struct psf_fontset *set;
+	unsigned char *fb;
+	size_t stride;
+	int passthrough;		/* copy output to stdout */
+	int pending;			/* output arrived since the last frame */
+	long long nextframe;
+	const char *expect;		/* output the latency test waits for */
+	size_t expectlen, matched;
+	unsigned char buf[CHUNKSIZE];
+	unsigned char in[INBUFSIZE];	/* input the program has not taken yet */
+	size_t nin;
+};
+
+static struct termios ptyhost_savedtio;
+static int ptyhost_rawstdin = 0;
+
+static long long ptyhost_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void ptyhost_restoretty(void)
+{
+	if (ptyhost_rawstdin) {
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &ptyhost_savedtio);
+		ptyhost_rawstdin = 0;
+	}
+}
+
+/* writes all of buf to a non blocking fd */
+static int ptyhost_writeall(int fd, const void *buf, size_t len)
+{
+	const unsigned char *ptr = buf;
+	while (len > 0) {
+		ssize_t n = write(fd, ptr, len);
+		if (n < 0) {
+			if (errno == EINTR) { continue; }
+			if (errno == EAGAIN) {
+				struct timespec ts = { 0, 100000 };
+				nanosleep(&ts, 0);
+				continue;
+			}
+			perror("ptyhost");
+			return 0;
+		}
+		ptr += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/* writes as much of the buffered input to the program as the pty takes.
+ * This never waits: while the pty is full, the event loop waits for it with
+ * EPOLLOUT and keeps reading output in the meantime. Otherwise the echo of
+ * the input could fill up the other direction, and both sides would wait
+ * for each other.
+ */
+static int ptyhost_flush(struct ptyhost *host)
+{
+	size_t done = 0;
+	while (done < host->nin) {
+		ssize_t n = write(host->master, host->in + done, host->nin - done);
+		if (n < 0) {
+			if (errno == EINTR) { continue; }
+			if (errno == EAGAIN) { break; }
+			/* the program is gone, its input with it */
+			perror("ptyhost");
+			host->nin = 0;
+			return 0;
+		}
+		done += n;
+	}
+	memmove(host->in, host->in + done, host->nin - done);
+	host->nin -= done;
+	return 1;
+}
+
+/* status replies of the terminal go back to the program. They are small,
+ * and only dropped if a program does not read its input at all.
+ */
+static void ptyhost_reply(void *ctx, const char *buf, size_t len)
+{
+	struct ptyhost *host = ctx;
+	if (len > sizeof(host->in) - host->nin) { return; }
+	memcpy(host->in + host->nin, buf, len);
+	host->nin += len;
+	ptyhost_flush(host);
+}
+
+/* starts argv on a new pseudo terminal of the size of the vt */
+static int ptyhost_spawn(struct ptyhost *host, char **argv)
+{
+	int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+		perror("ptyhost: posix_openpt");
+		if (master >= 0) { close(master); }
+		return 0;
+	}
+	const char *slavename = ptsname(master);
+	struct winsize ws;
+	memset(&ws, 0, sizeof(ws));
+	ws.ws_col = host->vt->cols;
+	ws.ws_row = host->vt->rows;
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("ptyhost: fork");
+		close(master);
+		return 0;
+	}
+	if (pid == 0) {
+		setsid();
+		int slave = open(slavename, O_RDWR);
+		if (slave < 0) {
+			perror(slavename);
+			_exit(127);
+		}
+		ioctl(slave, TIOCSCTTY, 0);
+		ioctl(slave, TIOCSWINSZ, &ws);
+		dup2(slave, STDIN_FILENO);
+		dup2(slave, STDOUT_FILENO);
+		dup2(slave, STDERR_FILENO);
+		if (slave > STDERR_FILENO) { close(slave); }
+		setenv("TERM", "vt100", 1);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+	host->master = master;
+	host->child = pid;
+	return 1;
+}
+
+/* advances the match of the output the latency test waits for */
+static void ptyhost_match(struct ptyhost *host, const unsigned char *buf, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len && host->matched < host->expectlen; ++i) {
+		if (buf[i] == (unsigned char) host->expect[host->matched]) { ++host->matched; }
+	}
+}
+
+/* reads all output that is available. Returns the number of bytes read, or
+ * -1 when the program has closed the terminal.
+ */
+static ssize_t ptyhost_drain(struct ptyhost *host)
+{
+	ssize_t total = 0;
+	for (;;) {
+		ssize_t n = read(host->master, host->buf, sizeof(host->buf));
+		if (n > 0) {
+			vt_write(host->vt, host->buf, n);
+			ptyhost_match(host, host->buf, n);
+			if (host->passthrough) { ptyhost_writeall(STDOUT_FILENO, host->buf, n); }
+			host->pending = 1;
+			total += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) { continue; }
+		if (n < 0 && errno == EAGAIN) { return total; }
+		/* EIO once the last slave fd is closed */
+		return total > 0 ? total : -1;
+	}
+}
+
+static void ptyhost_frame(struct ptyhost *host)
+{
+	if (host->set) {
+		vt_render(host->vt, host->set, host->fb, host->stride);
+	}
+	host->pending = 0;
+}
+
+/* forwards keyboard input and draws the screen until the program exits */
+static int ptyhost_run(struct ptyhost *host)
+{
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev;
+	if (epfd < 0) {
+		perror("ptyhost: epoll_create1");
+		return 0;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = host->master;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, host->master, &ev);
+	unsigned int masterevents = EPOLLIN;
+	/* fails if stdin is a regular file, then there is no input to forward */
+	ev.data.fd = STDIN_FILENO;
+	int stdinopen = epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0, stdinwatched = stdinopen;
+
+	int running = 1;
+	while (running) {
+		/* wait for room in the pty while input is left, and stop reading
+		 * input while the buffer is full
+		 */
+		unsigned int want = EPOLLIN | (host->nin > 0 ? EPOLLOUT : 0);
+		if (want != masterevents) {
+			ev.events = want;
+			ev.data.fd = host->master;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, host->master, &ev);
+			masterevents = want;
+		}
+		int wantstdin = stdinopen && host->nin < CHUNKSIZE;
+		if (wantstdin != stdinwatched) {
+			ev.events = EPOLLIN;
+			ev.data.fd = STDIN_FILENO;
+			epoll_ctl(epfd, wantstdin ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, STDIN_FILENO, &ev);
+			stdinwatched = wantstdin;
+		}
+
+		int timeout = -1;
+		if (host->pending) {
+			long long wait = host->nextframe - ptyhost_now();
+			timeout = wait > 0 ? (int) ((wait + 999999) / 1000000) : 0;
+		}
+		struct epoll_event events[2];
+		int nev = epoll_wait(epfd, events, 2, timeout), i;
+		if (nev < 0 && errno != EINTR) {
+			perror("ptyhost: epoll_wait");
+			break;
+		}
+		for (i = 0; i < nev; ++i) {
+			if (events[i].data.fd == STDIN_FILENO) {
+				ssize_t n = read(STDIN_FILENO, host->in + host->nin, CHUNKSIZE - host->nin);
+				if (n > 0) {
+					host->nin += n;
+					ptyhost_flush(host);
+				} else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+					stdinopen = 0;
+				}
+			} else {
+				if (events[i].events & EPOLLOUT) { ptyhost_flush(host); }
+				if ((events[i].events & ~EPOLLOUT) && ptyhost_drain(host) < 0) { running = 0; }
+			}
+		}
+		long long now = ptyhost_now();
+		if (host->pending && now >= host->nextframe) {
+			ptyhost_frame(host);
+			host->nextframe = now + FRAME_NS;
+		}
+	}
+	if (host->pending) { ptyhost_frame(host); }
+	close(epfd);
+	return 1;
+}
+
+static int ptyhost_cmp(const void *a, const void *b)
+{
+	long long x = *(const long long*) a, y = *(const long long*) b;
+	return (x > y) - (x < y);
+}
+
+/* types keys into the program and waits until expect has come back. The
+ * bytes of expect must come in order, but other output may come in between,
+ * like the escape sequences of a line editor.
+ */
+static int ptyhost_type(struct ptyhost *host, int epfd, const char *keys, size_t len, const char *expect)
+{
+	struct epoll_event ev;
+	host->expect = expect;
+	host->expectlen = strlen(expect);
+	host->matched = 0;
+	int ok = ptyhost_writeall(host->master, keys, len);
+	while (ok && host->matched < host->expectlen) {
+		if (epoll_wait(epfd, &ev, 1, 1000) <= 0) {
+			fprintf(stderr, "ptyhost: no echo\n");
+			ok = 0;
+		} else if (ptyhost_drain(host) < 0) {
+			ok = 0;
+		}
+	}
+	host->expectlen = 0;
+	return ok;
+}
+
+/* types nkeys keys into the program and measures how long it takes until
+ * their echo is on the screen. Every 64 keys the line is ended, the echo of
+ * that and the line the program prints back are not timed.
+ */
+static int ptyhost_latency(struct ptyhost *host, unsigned int nkeys)
+{
+	long long *lat = calloc(nkeys ? nkeys : 1, sizeof(long long));
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev;
+	if (!lat || epfd < 0) {
+		perror("ptyhost");
+		free(lat);
+		if (epfd >= 0) { close(epfd); }
+		return 0;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = host->master;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, host->master, &ev);
+
+	unsigned int i;
+	int ok = 1;
+	for (i = 0; ok && i < nkeys; ++i) {
+		char key[2] = { (char) ('a' + i % 26), 0 };
+		long long start = ptyhost_now();
+		ok = ptyhost_type(host, epfd, key, 1, key);
+		ptyhost_frame(host);
+		lat[i] = ptyhost_now() - start;
+		if (ok && i % 64 == 63) {
+			ok = ptyhost_type(host, epfd, "\r", 1, "\n\n");
+		}
+	}
+	close(epfd);
+	if (ok && nkeys > 0) {
+		qsort(lat, nkeys, sizeof(long long), ptyhost_cmp);
+		printf("ptyhost: %u keys, echo latency min %.1f us, median %.1f us, 99%% %.1f us, max %.1f us\n",
+			nkeys, lat[0] / 1e3, lat[nkeys / 2] / 1e3, lat[(nkeys * 99) / 100] / 1e3, lat[nkeys - 1] / 1e3);
+	}
+	free(lat);
+	return ok;
+}
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s [-s <cols>x<rows>] [-f font.psf]... [-q] [-d] [-l <n>] [cmd [args]]\n", cmd);
+	fputs(	"  run cmd, by default $SHELL or /bin/sh, on a pseudo terminal.\n"
+			"  Its output is fed through a vt100 emulation and copied to\n"
+			"  stdout, keyboard input is forwarded to it. The screen size\n"
+			"  defaults to 80x25.\n"
+			"  -f adds a font to draw the screen with, at most once per frame.\n"
+			"  -q does not copy the output to stdout.\n"
+			"  -d prints the screen as text when cmd exits.\n"
+			"  -l types n keys into cmd, by default cat, and prints how long\n"
+			"     it takes until their echo is on the screen.\n"
+		, stderr);
+	fprintf(stderr, "psftools version %s\n", PSFTOOLS_VERSION);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int cols = 80, rows = 25, nkeys = 0, nfonts = 0, i;
+	const char *fontfile[MAXFONTS];
+	int arg = 1, dump = 0, latency = 0, quiet = 0;
+
+	while (arg < argc && argv[arg][0] == '-') {
+		if (!strcmp(argv[arg], "-q")) {
+			quiet = 1;
+		} else if (!strcmp(argv[arg], "-d")) {
+			dump = 1;
+		} else if (arg + 1 < argc && !strcmp(argv[arg], "-s")) {
+			if (sscanf(argv[++arg], "%ux%u", &cols, &rows) != 2) {
+				usage(argv[0]);
+			}
+		} else if (arg + 1 < argc && !strcmp(argv[arg], "-f") && nfonts < MAXFONTS) {
+			fontfile[nfonts++] = argv[++arg];
+		} else if (arg + 1 < argc && !strcmp(argv[arg], "-l")) {
+			nkeys = (unsigned int) strtoul(argv[++arg], 0, 10);
+			latency = 1;
+		} else {
+			usage(argv[0]);
+		}
+		++arg;
+	}
+
+	char *shell[] = { getenv("SHELL") ? getenv("SHELL") : "/bin/sh", 0 };
+	char *cat[] = { "cat", 0 };
+	char **cmd = arg < argc ? &argv[arg] : latency ? cat : shell;
+
+	struct ptyhost *host = calloc(1, sizeof(struct ptyhost));
+	if (!host) {
+		perror("ptyhost");
+		exit(1);
+	}
+	host->passthrough = !quiet && !latency;
+	host->vt = vt_new(cols, rows);
+	if (!host->vt) { exit(1); }
+	host->vt->reply = ptyhost_reply;
+	host->vt->ctx = host;
+
+	if (nfonts > 0) {
+		host->set = psf_fontset_new();
+		if (!host->set) { exit(1); }
+		for (i = 0; i < nfonts; ++i) {
+			struct psf_font *psf = psf_load(fontfile[i]);
+			if (!psf || !psf_fontset_add(host->set, psf)) {
+				exit(1);
+			}
+		}
+		struct psf_font *first = psf_fontset_font(host->set, 0);
+		host->stride = (size_t) cols * psf_width(first);
+		host->fb = malloc(host->stride * rows * psf_height(first));
+		if (!host->fb) {
+			perror("ptyhost");
+			exit(1);
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	if (!ptyhost_spawn(host, cmd)) { exit(1); }
+
+	if (!latency && isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &ptyhost_savedtio) == 0) {
+		struct termios raw = ptyhost_savedtio;
+		cfmakeraw(&raw);
+		if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0) {
+			ptyhost_rawstdin = 1;
+			atexit(ptyhost_restoretty);
+		}
+	}
+
+	int ok = latency ? ptyhost_latency(host, nkeys) : ptyhost_run(host);
+	ptyhost_restoretty();
+
+	if (latency) { kill(host->child, SIGHUP); }
+	close(host->master);
+	int status = 0;
+	waitpid(host->child, &status, 0);
+
+	if (dump) { ok = vt_dump(host->vt, stdout) && ok; }
+
+	vt_delete(host->vt);
+	if (host->set) { psf_fontset_delete(host->set); }
+	free(host->fb);
+	free(host);
+
+	if (!ok) { exit(1); }
+	exit(!latency && WIFEXITED(status) ? WEXITSTATUS(status) : 0);
+}
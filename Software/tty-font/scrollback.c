@@ -0,0 +1,305 @@
+/* scrollback.c
+ *
+ * compressed scrollback buffer for the vt emulation.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ *
+ * Encoding of a line, all numbers are stored as varints (7 bits per byte,
+ * least significant first, high bit set on all but the last byte):
+ *	length of the rest of the line in bytes
+ *	number of cells, trailing blanks with default colors are not stored
+ *	runs until all cells are covered, each starting with
+ *		count << 2 | literal << 1 | newattr
+ *	if newattr is set, fg and bg as one byte each and attr follow, otherwise
+ *	the run has the attributes of the run before, or the default ones for
+ *	the first run of a line. A literal run is followed by count codepoints,
+ *	other runs by one codepoint that is repeated count times.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scrollback.h"
+
+/* runs of at least this many equal cells are not stored literally */
+#define SCROLLBACK_MINREPEAT 3
+
+/* longest varint, for 32 bit values */
+#define SCROLLBACK_MAXVARINT 5
+
+struct scrollback *scrollback_new(size_t size)
+{
+	struct scrollback *sb = calloc(1, sizeof(struct scrollback));
+	if (!sb) {
+		perror(__func__);
+		return 0;
+	}
+	sb->nblocks = (size + SCROLLBACK_BLOCKSIZE - 1) / SCROLLBACK_BLOCKSIZE;
+	if (sb->nblocks < 2) { sb->nblocks = 2; }
+	sb->block = calloc(sb->nblocks, sizeof(struct scrollback_block));
+	if (!sb->block) {
+		perror(__func__);
+		free(sb);
+		return 0;
+	}
+	sb->used = 1;
+	return sb;
+}
+
+void scrollback_delete(struct scrollback *sb)
+{
+	free(sb->block);
+	free(sb);
+}
+
+/* lines are only decoded from what scrollback_push encoded, so the
+ * varint length is the only bound needed
+ */
+static uint32_t scrollback_getvarint(const unsigned char **ptr)
+{
+	uint64_t val = 0;
+	psf_getvarint(ptr, *ptr + SCROLLBACK_MAXVARINT, &val);
+	return (uint32_t) val;
+}
+
+static int scrollback_sameattr(const struct vt_cell *a, const struct vt_cell *b)
+{
+	return a->fg == b->fg && a->bg == b->bg && a->attr == b->attr;
+}
+
+static int scrollback_samecell(const struct vt_cell *a, const struct vt_cell *b)
+{
+	return a->ch == b->ch && scrollback_sameattr(a, b);
+}
+
+static const struct vt_cell scrollback_blank = { ' ', VT_DEFAULT_FG, VT_DEFAULT_BG, 0 };
+
+/* encodes the runs of a line into buf, which has room for max bytes. Returns
+ * the number of bytes used, and stores the number of cells encoded.
+ */
+static unsigned int scrollback_encode(const struct vt_cell *line, unsigned int cols, unsigned char *buf, unsigned int max, unsigned int *ncells, uint64_t *chars)
+{
+	struct vt_cell attr = scrollback_blank;
+	unsigned int pos = 0, x = 0;
+
+	while (cols > 0 && scrollback_samecell(&line[cols - 1], &scrollback_blank)) { --cols; }
+	while (x < cols) {
+		const struct vt_cell *cell = &line[x];
+		unsigned int count = 1;
+		while (x + count < cols && scrollback_samecell(&line[x + count], cell)) { ++count; }
+		int literal = count < SCROLLBACK_MINREPEAT;
+		if (literal) {
+			/* extend up to the next repeated run or change of attributes */
+			count = 1;
+			while (x + count < cols && scrollback_sameattr(&line[x + count], cell)
+				&& !(x + count + 2 < cols && scrollback_samecell(&line[x + count], &line[x + count + 1])
+					&& scrollback_samecell(&line[x + count], &line[x + count + 2]))) {
+				++count;
+			}
+		}
+		int newattr = !scrollback_sameattr(cell, &attr);
+		/* stop if the worst case for this run does not fit */
+		unsigned int need = 2 * SCROLLBACK_MAXVARINT + 2 + (literal ? count : 1) * SCROLLBACK_MAXVARINT;
+		if (pos + need > max) {
+			if (!literal || max - pos < 3 * SCROLLBACK_MAXVARINT + 2) { break; }
+			count = (max - pos - 2 * SCROLLBACK_MAXVARINT - 2) / SCROLLBACK_MAXVARINT;
+			if (count == 0) { break; }
+		}
+		pos += psf_putvarint(&buf[pos], count << 2 | literal << 1 | newattr);
+		if (newattr) {
+			buf[pos++] = cell->fg;
+			buf[pos++] = cell->bg;
+			pos += psf_putvarint(&buf[pos], cell->attr);
+			attr = *cell;
+		}
+		unsigned int i;
+		for (i = 0; i < (literal ? count : 1); ++i) {
+			pos += psf_putvarint(&buf[pos], cell[i].ch);
+			*chars |= (uint64_t) 1 << (cell[i].ch % 64);
+		}
+		x += count;
+	}
+	*ncells = x;
+	return pos;
+}
+
+/* decodes a line starting at ptr into line, and returns a pointer behind it */
+static const unsigned char *scrollback_decode(const unsigned char *ptr, struct vt_cell *line, unsigned int cols)
+{
+	uint32_t len = scrollback_getvarint(&ptr);
+	const unsigned char *end = ptr + len;
+	uint32_t ncells = scrollback_getvarint(&ptr);
+	struct vt_cell attr = scrollback_blank;
+	unsigned int x = 0, i;
+
+	while (x < ncells && ptr < end) {
+		uint32_t head = scrollback_getvarint(&ptr);
+		unsigned int count = head >> 2;
+		if (head & 1) {
+			attr.fg = *ptr++;
+			attr.bg = *ptr++;
+			attr.attr = scrollback_getvarint(&ptr);
+		}
+		if (head & 2) {
+			for (i = 0; i < count; ++i, ++x) {
+				attr.ch = scrollback_getvarint(&ptr);
+				if (x < cols) { line[x] = attr; }
+			}
+		} else {
+			attr.ch = scrollback_getvarint(&ptr);
+			for (i = 0; i < count; ++i, ++x) {
+				if (x < cols) { line[x] = attr; }
+			}
+		}
+	}
+	for (; x < cols; ++x) {
+		line[x] = scrollback_blank;
+	}
+	return end;
+}
+
+void scrollback_push(void *ctx, const struct vt_cell *line, unsigned int cols)
+{
+	struct scrollback *sb = ctx;
+	unsigned char buf[SCROLLBACK_BLOCKSIZE];
+	unsigned char hdr[2 * SCROLLBACK_MAXVARINT];
+	unsigned int ncells;
+	uint64_t chars = 0;
+
+	unsigned int len = scrollback_encode(line, cols, buf, sizeof(buf) - sizeof(hdr), &ncells, &chars);
+	unsigned int hdrlen = psf_putvarint(&hdr[SCROLLBACK_MAXVARINT], ncells);
+	unsigned int lenlen = psf_putvarint(hdr, len + hdrlen);
+	memmove(&hdr[lenlen], &hdr[SCROLLBACK_MAXVARINT], hdrlen);
+	hdrlen += lenlen;
+
+	struct scrollback_block *block = &sb->block[sb->head];
+	if (block->used + hdrlen + len > SCROLLBACK_BLOCKSIZE) {
+		/* start a new block, dropping the oldest one if the ring is full */
+		sb->head = (sb->head + 1) % sb->nblocks;
+		if (sb->used < sb->nblocks) { ++sb->used; }
+		block = &sb->block[sb->head];
+		block->used = 0;
+		block->nlines = 0;
+		block->first = sb->next;
+		block->chars = 0;
+	}
+	memcpy(&block->data[block->used], hdr, hdrlen);
+	memcpy(&block->data[block->used + hdrlen], buf, len);
+	block->used += hdrlen + len;
+	block->chars |= chars;
+	if (ncells > sb->maxcells) { sb->maxcells = ncells; }
+	++block->nlines;
+	++sb->next;
+}
+
+static struct scrollback_block *scrollback_nth_block(struct scrollback *sb, unsigned int i)
+{
+	return &sb->block[(sb->head + sb->nblocks + 1 - sb->used + i) % sb->nblocks];
+}
+
+unsigned int scrollback_lines(struct scrollback *sb)
+{
+	return sb->next - scrollback_nth_block(sb, 0)->first;
+}
+
+size_t scrollback_size(struct scrollback *sb)
+{
+	size_t size = 0;
+	unsigned int i;
+	for (i = 0; i < sb->used; ++i) {
+		size += scrollback_nth_block(sb, i)->used;
+	}
+	return size;
+}
+
+/* returns the block a line is in, and a pointer to the line in it */
+static struct scrollback_block *scrollback_find(struct scrollback *sb, uint64_t lineno, const unsigned char **ptr)
+{
+	unsigned int lo = 0, hi = sb->used;
+	while (hi - lo > 1) {
+		unsigned int mid = (lo + hi) / 2;
+		if (scrollback_nth_block(sb, mid)->first <= lineno) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	struct scrollback_block *block = scrollback_nth_block(sb, lo);
+	const unsigned char *p = block->data;
+	uint64_t n;
+	for (n = block->first; n < lineno; ++n) {
+		uint32_t len = scrollback_getvarint(&p);
+		p += len;
+	}
+	*ptr = p;
+	return block;
+}
+
+int scrollback_line(struct scrollback *sb, unsigned int no, struct vt_cell *line, unsigned int cols)
+{
+	if (no >= scrollback_lines(sb)) { return 0; }
+	const unsigned char *ptr;
+	scrollback_find(sb, sb->next - 1 - no, &ptr);
+	scrollback_decode(ptr, line, cols);
+	return 1;
+}
+
+/* tests whether an encoded line contains str, decoding only codepoints */
+static int scrollback_match(const unsigned char *ptr, const uint32_t *str, unsigned int len, uint32_t *buf)
+{
+	uint32_t reclen = scrollback_getvarint(&ptr);
+	const unsigned char *end = ptr + reclen;
+	uint32_t ncells = scrollback_getvarint(&ptr);
+	unsigned int x = 0, i;
+
+	while (x < ncells && ptr < end) {
+		uint32_t head = scrollback_getvarint(&ptr);
+		unsigned int count = head >> 2;
+		if (head & 1) {
+			ptr += 2;
+			scrollback_getvarint(&ptr);
+		}
+		if (head & 2) {
+			for (i = 0; i < count; ++i) { buf[x++] = scrollback_getvarint(&ptr); }
+		} else {
+			uint32_t ch = scrollback_getvarint(&ptr);
+			for (i = 0; i < count; ++i) { buf[x++] = ch; }
+		}
+	}
+	for (i = 0; i + len <= x; ++i) {
+		if (memcmp(&buf[i], str, len * sizeof(uint32_t)) == 0) { return 1; }
+	}
+	return 0;
+}
+
+int scrollback_search(struct scrollback *sb, const uint32_t *str, unsigned int len, unsigned int from)
+{
+	unsigned int nlines = scrollback_lines(sb), b, i;
+	uint64_t need = 0;
+	if (from >= nlines || len == 0) { return -1; }
+	for (i = 0; i < len; ++i) {
+		need |= (uint64_t) 1 << (str[i] % 64);
+	}
+	uint32_t *buf = malloc((sb->maxcells + 1) * sizeof(uint32_t));
+	if (!buf) {
+		perror(__func__);
+		return -1;
+	}
+
+	uint64_t start = sb->next - 1 - from;
+	int found = -1;
+	for (b = sb->used; found < 0 && b-- > 0;) {
+		struct scrollback_block *block = scrollback_nth_block(sb, b);
+		if (block->first > start || block->nlines == 0 || (block->chars & need) != need) { continue; }
+		const unsigned char *ptr = block->data;
+		uint64_t n;
+		for (n = block->first; n < block->first + block->nlines && n <= start; ++n) {
+			const unsigned char *next = ptr;
+			next += scrollback_getvarint(&next);
+			if (scrollback_match(ptr, str, len, buf)) { found = sb->next - 1 - n; }
+			ptr = next;
+		}
+	}
+	free(buf);
+	return found;
+}
@@ -0,0 +1,138 @@
+/* scrollback.h
+ *
+ * compressed scrollback buffer for the vt emulation.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ *
+ * Lines are run length encoded and stored in a ring of fixed size blocks.
+ * When the ring is full, the block with the oldest lines is reused. Only
+ * lines that are asked for are decoded, and searching skips blocks that do
+ * not contain all chars of the search string.
+ */
+
+#ifndef scrollback_h
+#define scrollback_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vt.h"
+
+/* size of one block of the ring. Lines longer than fit into one block when
+ * encoded are cut off.
+ */
+#define SCROLLBACK_BLOCKSIZE 4096
+
+struct scrollback_block {
+	unsigned char data[SCROLLBACK_BLOCKSIZE];
+	unsigned int used;		/* bytes of data in use */
+	unsigned int nlines;
+	uint64_t first;			/* number of the first line in the block */
+	uint64_t chars;			/* bit ch % 64 is set for every char in the block */
+};
+
+struct scrollback {
+	struct scrollback_block *block;
+	unsigned int nblocks;
+	unsigned int head;		/* block new lines are added to */
+	unsigned int used;		/* blocks in use */
+	uint64_t next;			/* number the next line will get */
+	unsigned int maxcells;	/* most cells stored for a line */
+};
+
+/* scrollback_new
+ *
+ * allocates a new, empty scrollback buffer.
+ *
+ * Arguments:
+ *	size	memory to use for the ring in bytes, rounded up to whole blocks
+ *			and at least 2 blocks
+ *
+ * Returns:
+ *	a pointer to the new buffer, or 0 on error.
+ */
+struct scrollback *scrollback_new(size_t size);
+
+/* scrollback_delete
+ *
+ * frees a scrollback buffer.
+ *
+ * Arguments:
+ *	sb		the buffer
+ *
+ * Returns:
+ *	-
+ */
+void scrollback_delete(struct scrollback *sb);
+
+/* scrollback_push
+ *
+ * adds a line to the buffer. The signature matches the scrolled callback of
+ * struct vt, with the buffer as context.
+ *
+ * Arguments:
+ *	sb		the buffer
+ *	line	the cells of the line
+ *	cols	number of cells in the line
+ *
+ * Returns:
+ *	-
+ */
+void scrollback_push(void *sb, const struct vt_cell *line, unsigned int cols);
+
+/* scrollback_lines
+ *
+ * returns the number of lines in the buffer.
+ *
+ * Arguments:
+ *	sb		the buffer
+ *
+ * Returns:
+ *	the number of lines.
+ */
+unsigned int scrollback_lines(struct scrollback *sb);
+
+/* scrollback_line
+ *
+ * decodes a line from the buffer.
+ *
+ * Arguments:
+ *	sb		the buffer
+ *	no		the line, 0 is the most recent one
+ *	line	cells to decode the line into, cells after the end of the
+ *			stored line are blanked
+ *	cols	number of cells in line
+ *
+ * Returns:
+ *	1 on success, 0 if there is no such line.
+ */
+int scrollback_line(struct scrollback *sb, unsigned int no, struct vt_cell *line, unsigned int cols);
+
+/* scrollback_search
+ *
+ * finds the next line containing a string, going from newer to older lines.
+ *
+ * Arguments:
+ *	sb		the buffer
+ *	str		the codepoints to search for
+ *	len		number of codepoints in str
+ *	from	the line to start with, 0 is the most recent one
+ *
+ * Returns:
+ *	the number of the first line at or before from that contains str, or -1
+ *	if there is none.
+ */
+int scrollback_search(struct scrollback *sb, const uint32_t *str, unsigned int len, unsigned int from);
+
+/* scrollback_size
+ *
+ * returns the number of bytes used by encoded lines.
+ *
+ * Arguments:
+ *	sb		the buffer
+ *
+ * Returns:
+ *	the number of bytes.
+ */
+size_t scrollback_size(struct scrollback *sb);
+
+#endif /* scrollback_h */
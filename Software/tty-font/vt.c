@@ -0,0 +1,802 @@
+/* vt.c
+ *
+ * a small vt100 / ansi terminal emulation on top of the psf library.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vt.h"
+#include "cellcache.h"
+#include "mini_utf8.h"
+
+/* parser states */
+enum {
+	VT_GROUND, VT_ESCAPE, VT_ESCAPE_INT, VT_CSI_ENTRY, VT_CSI_PARAM, VT_CSI_INT,
+	VT_CSI_IGNORE, VT_STRING, VT_NSTATES
+};
+
+/* parser actions */
+enum {
+	VT_NONE, VT_PRINT, VT_EXECUTE, VT_CLEAR, VT_COLLECT, VT_PARAM, VT_PRIVATE,
+	VT_ESC_DISPATCH, VT_CSI_DISPATCH, VT_UTF8
+};
+
+/* transition table, entries are action << 4 | next state */
+static unsigned char vt_table[VT_NSTATES][256];
+
+static void vt_table_range(unsigned int state, unsigned int from, unsigned int to, unsigned int action, unsigned int next)
+{
+	unsigned int c;
+	for (c = from; c <= to; ++c) {
+		vt_table[state][c] = (action << 4) | next;
+	}
+}
+
+/* c0 controls are executed in all states but strings */
+static void vt_table_c0(unsigned int state)
+{
+	vt_table_range(state, 0x00, 0x17, VT_EXECUTE, state);
+	vt_table_range(state, 0x19, 0x19, VT_EXECUTE, state);
+	vt_table_range(state, 0x1c, 0x1f, VT_EXECUTE, state);
+}
+
+static void vt_table_init(void)
+{
+	static int initialized = 0;
+	unsigned int state;
+	if (initialized) { return; }
+
+	for (state = 0; state < VT_NSTATES; ++state) {
+		vt_table_range(state, 0x00, 0xff, VT_NONE, state);
+		if (state != VT_STRING) { vt_table_c0(state); }
+	}
+
+	vt_table_range(VT_GROUND, 0x20, 0x7e, VT_PRINT, VT_GROUND);
+	vt_table_range(VT_GROUND, 0x80, 0xff, VT_UTF8, VT_GROUND);
+
+	vt_table_range(VT_ESCAPE, 0x20, 0x2f, VT_COLLECT, VT_ESCAPE_INT);
+	vt_table_range(VT_ESCAPE, 0x30, 0x7e, VT_ESC_DISPATCH, VT_GROUND);
+	vt_table_range(VT_ESCAPE, '[', '[', VT_NONE, VT_CSI_ENTRY);
+	vt_table_range(VT_ESCAPE, ']', ']', VT_NONE, VT_STRING);
+	vt_table_range(VT_ESCAPE, 'P', 'P', VT_NONE, VT_STRING);
+	vt_table_range(VT_ESCAPE, 'X', 'X', VT_NONE, VT_STRING);
+	vt_table_range(VT_ESCAPE, '^', '_', VT_NONE, VT_STRING);
+
+	vt_table_range(VT_ESCAPE_INT, 0x20, 0x2f, VT_COLLECT, VT_ESCAPE_INT);
+	vt_table_range(VT_ESCAPE_INT, 0x30, 0x7e, VT_ESC_DISPATCH, VT_GROUND);
+
+	vt_table_range(VT_CSI_ENTRY, 0x20, 0x2f, VT_COLLECT, VT_CSI_INT);
+	vt_table_range(VT_CSI_ENTRY, 0x30, 0x39, VT_PARAM, VT_CSI_PARAM);
+	vt_table_range(VT_CSI_ENTRY, 0x3a, 0x3a, VT_NONE, VT_CSI_IGNORE);
+	vt_table_range(VT_CSI_ENTRY, 0x3b, 0x3b, VT_PARAM, VT_CSI_PARAM);
+	vt_table_range(VT_CSI_ENTRY, 0x3c, 0x3f, VT_PRIVATE, VT_CSI_PARAM);
+	vt_table_range(VT_CSI_ENTRY, 0x40, 0x7e, VT_CSI_DISPATCH, VT_GROUND);
+
+	vt_table_range(VT_CSI_PARAM, 0x20, 0x2f, VT_COLLECT, VT_CSI_INT);
+	vt_table_range(VT_CSI_PARAM, 0x30, 0x39, VT_PARAM, VT_CSI_PARAM);
+	vt_table_range(VT_CSI_PARAM, 0x3a, 0x3a, VT_NONE, VT_CSI_IGNORE);
+	vt_table_range(VT_CSI_PARAM, 0x3b, 0x3b, VT_PARAM, VT_CSI_PARAM);
+	vt_table_range(VT_CSI_PARAM, 0x3c, 0x3f, VT_NONE, VT_CSI_IGNORE);
+	vt_table_range(VT_CSI_PARAM, 0x40, 0x7e, VT_CSI_DISPATCH, VT_GROUND);
+
+	vt_table_range(VT_CSI_INT, 0x20, 0x2f, VT_COLLECT, VT_CSI_INT);
+	vt_table_range(VT_CSI_INT, 0x30, 0x3f, VT_NONE, VT_CSI_IGNORE);
+	vt_table_range(VT_CSI_INT, 0x40, 0x7e, VT_CSI_DISPATCH, VT_GROUND);
+
+	vt_table_range(VT_CSI_IGNORE, 0x40, 0x7e, VT_NONE, VT_GROUND);
+
+	vt_table_range(VT_STRING, 0x07, 0x07, VT_NONE, VT_GROUND);
+
+	/* transitions from anywhere */
+	for (state = 0; state < VT_NSTATES; ++state) {
+		vt_table_range(state, 0x18, 0x18, VT_EXECUTE, VT_GROUND);
+		vt_table_range(state, 0x1a, 0x1a, VT_EXECUTE, VT_GROUND);
+		vt_table_range(state, 0x1b, 0x1b, VT_CLEAR, VT_ESCAPE);
+	}
+	initialized = 1;
+}
+
+struct vt *vt_new(unsigned int cols, unsigned int rows)
+{
+	if (cols == 0 || rows == 0) {
+		fprintf(stderr, "%s: invalid size\n", __func__);
+		return 0;
+	}
+	vt_table_init();
+	struct vt *vt = calloc(1, sizeof(struct vt));
+	if (!vt) {
+		perror(__func__);
+		return 0;
+	}
+	vt->cols = cols;
+	vt->rows = rows;
+	vt->cells = calloc((size_t) cols * rows, sizeof(struct vt_cell));
+	vt->altcells = calloc((size_t) cols * rows, sizeof(struct vt_cell));
+	vt->line = calloc(rows, sizeof(struct vt_cell*));
+	vt->altline = calloc(rows, sizeof(struct vt_cell*));
+	vt->dirty = calloc(rows, 1);
+	vt->tabs = calloc(cols, 1);
+	if (!vt->cells || !vt->altcells || !vt->line || !vt->altline || !vt->dirty || !vt->tabs) {
+		perror(__func__);
+		vt_delete(vt);
+		return 0;
+	}
+	vt_reset(vt);
+	return vt;
+}
+
+void vt_delete(struct vt *vt)
+{
+	free(vt->cells);
+	free(vt->altcells);
+	free(vt->line);
+	free(vt->altline);
+	free(vt->dirty);
+	free(vt->tabs);
+	free(vt);
+}
+
+/* the cell erased parts of the screen are filled with */
+static struct vt_cell vt_blank(struct vt *vt)
+{
+	struct vt_cell blank = { ' ', vt->cur.pen.fg, vt->cur.pen.bg, 0 };
+	return blank;
+}
+
+static void vt_fill(struct vt_cell *cell, unsigned int n, struct vt_cell blank)
+{
+	while (n-- > 0) { *cell++ = blank; }
+}
+
+/* erases cells from..to - 1 of line y */
+static void vt_erase(struct vt *vt, unsigned int y, unsigned int from, unsigned int to)
+{
+	if (to > vt->cols) { to = vt->cols; }
+	if (from >= to) { return; }
+	vt_fill(&vt->line[y][from], to - from, vt_blank(vt));
+	vt->dirty[y] = 1;
+}
+
+static void vt_erase_lines(struct vt *vt, unsigned int from, unsigned int to)
+{
+	for (; from < to; ++from) {
+		vt_erase(vt, from, 0, vt->cols);
+	}
+}
+
+void vt_reset(struct vt *vt)
+{
+	unsigned int i;
+	for (i = 0; i < vt->rows; ++i) {
+		vt->line[i] = &vt->cells[(size_t) i * vt->cols];
+		vt->altline[i] = &vt->altcells[(size_t) i * vt->cols];
+	}
+	memset(&vt->cur, 0, sizeof(vt->cur));
+	vt->cur.pen.ch = ' ';
+	vt->cur.pen.fg = VT_DEFAULT_FG;
+	vt->cur.pen.bg = VT_DEFAULT_BG;
+	vt->saved = vt->cur;
+	vt->top = 0;
+	vt->bottom = vt->rows - 1;
+	vt->autowrap = 1;
+	vt->insert = 0;
+	vt->cursorvisible = 1;
+	vt->altscreen = 0;
+	vt->state = VT_GROUND;
+	vt->utf8left = 0;
+	for (i = 0; i < vt->cols; ++i) {
+		vt->tabs[i] = i > 0 && i % 8 == 0;
+	}
+	vt_fill(vt->altcells, vt->cols * vt->rows, vt_blank(vt));
+	vt_erase_lines(vt, 0, vt->rows);
+}
+
+/* scrolls lines top..bottom of the scroll region up by n lines. Only line
+ * pointers move, the lines coming in at the bottom are the ones that went
+ * out at the top, erased.
+ */
+static void vt_scrollup(struct vt *vt, unsigned int top, unsigned int n)
+{
+	unsigned int bottom = vt->bottom, i;
+	if (top > bottom) { return; }
+	if (n > bottom - top + 1) { n = bottom - top + 1; }
+	struct vt_cell *out[n > 0 ? n : 1];
+	for (i = 0; i < n; ++i) {
+		out[i] = vt->line[top + i];
+		if (top == 0 && !vt->altscreen && vt->scrolled) {
+			vt->scrolled(vt->ctx, out[i], vt->cols);
+		}
+	}
+	memmove(&vt->line[top], &vt->line[top + n], (bottom + 1 - top - n) * sizeof(struct vt_cell*));
+	memcpy(&vt->line[bottom + 1 - n], out, n * sizeof(struct vt_cell*));
+	memset(&vt->dirty[top], 1, bottom + 1 - top);
+	vt_erase_lines(vt, bottom + 1 - n, bottom + 1);
+}
+
+static void vt_scrolldown(struct vt *vt, unsigned int top, unsigned int n)
+{
+	unsigned int bottom = vt->bottom;
+	if (top > bottom) { return; }
+	if (n > bottom - top + 1) { n = bottom - top + 1; }
+	struct vt_cell *out[n > 0 ? n : 1];
+	memcpy(out, &vt->line[bottom + 1 - n], n * sizeof(struct vt_cell*));
+	memmove(&vt->line[top + n], &vt->line[top], (bottom + 1 - top - n) * sizeof(struct vt_cell*));
+	memcpy(&vt->line[top], out, n * sizeof(struct vt_cell*));
+	memset(&vt->dirty[top], 1, bottom + 1 - top);
+	vt_erase_lines(vt, top, top + n);
+}
+
+static void vt_linefeed(struct vt *vt)
+{
+	if (vt->cur.y == vt->bottom) {
+		vt_scrollup(vt, vt->top, 1);
+	} else if (vt->cur.y + 1 < vt->rows) {
+		++vt->cur.y;
+	}
+}
+
+static void vt_reverse_linefeed(struct vt *vt)
+{
+	if (vt->cur.y == vt->top) {
+		vt_scrolldown(vt, vt->top, 1);
+	} else if (vt->cur.y > 0) {
+		--vt->cur.y;
+	}
+}
+
+/* moves the cursor, y is relative to the scroll region in origin mode */
+static void vt_goto(struct vt *vt, int x, int y)
+{
+	int miny = 0, maxy = vt->rows - 1;
+	if (vt->cur.origin) {
+		miny = vt->top;
+		maxy = vt->bottom;
+		y += miny;
+	}
+	if (x < 0) { x = 0; }
+	if (x >= (int) vt->cols) { x = vt->cols - 1; }
+	if (y < miny) { y = miny; }
+	if (y > maxy) { y = maxy; }
+	vt->cur.x = x;
+	vt->cur.y = y;
+	vt->cur.wrapnext = 0;
+}
+
+/* moves the cursor vertically, stopping at the scroll region if it starts
+ * within it.
+ */
+static void vt_move(struct vt *vt, int dx, int dy)
+{
+	int y = vt->cur.y + dy, x = vt->cur.x + dx;
+	if (vt->cur.y >= vt->top && vt->cur.y <= vt->bottom) {
+		if (y < (int) vt->top) { y = vt->top; }
+		if (y > (int) vt->bottom) { y = vt->bottom; }
+	}
+	if (vt->cur.origin) { y -= vt->top; }
+	vt_goto(vt, x, y);
+}
+
+static void vt_print(struct vt *vt, uint32_t ch)
+{
+	if (vt->cur.wrapnext) {
+		vt->cur.x = 0;
+		vt_linefeed(vt);
+		vt->cur.wrapnext = 0;
+	}
+	struct vt_cell *line = vt->line[vt->cur.y];
+	if (vt->insert) {
+		memmove(&line[vt->cur.x + 1], &line[vt->cur.x], (vt->cols - vt->cur.x - 1) * sizeof(struct vt_cell));
+	}
+	line[vt->cur.x] = vt->cur.pen;
+	line[vt->cur.x].ch = ch;
+	vt->dirty[vt->cur.y] = 1;
+	if (vt->cur.x + 1 < vt->cols) {
+		++vt->cur.x;
+	} else {
+		vt->cur.wrapnext = vt->autowrap;
+	}
+}
+
+/* prints a run of printable ascii chars, returns the number used up */
+static size_t vt_print_ascii(struct vt *vt, const unsigned char *buf, size_t len)
+{
+	const unsigned char *ptr = buf, *end = buf + len;
+	while (ptr < end && (unsigned int) (*ptr - 0x20) < 0x5f) {
+		if (vt->cur.wrapnext) {
+			vt->cur.x = 0;
+			vt_linefeed(vt);
+			vt->cur.wrapnext = 0;
+		}
+		struct vt_cell pen = vt->cur.pen;
+		struct vt_cell *cell = &vt->line[vt->cur.y][vt->cur.x];
+		struct vt_cell *last = &vt->line[vt->cur.y][vt->cols - 1];
+		vt->dirty[vt->cur.y] = 1;
+		while (ptr < end && (unsigned int) (*ptr - 0x20) < 0x5f) {
+			pen.ch = *ptr++;
+			*cell = pen;
+			if (cell == last) {
+				vt->cur.wrapnext = vt->autowrap;
+				break;
+			}
+			++cell;
+		}
+		vt->cur.x = cell - vt->line[vt->cur.y];
+		if (!vt->autowrap) {
+			/* further chars overwrite the last column */
+			while (ptr < end && (unsigned int) (*ptr - 0x20) < 0x5f) {
+				last->ch = *ptr++;
+			}
+		}
+	}
+	return ptr - buf;
+}
+
+static void vt_execute(struct vt *vt, unsigned char c)
+{
+	switch (c) {
+		case '\b':
+			if (vt->cur.x > 0) { --vt->cur.x; }
+			vt->cur.wrapnext = 0;
+			break;
+		case '\t':
+			while (vt->cur.x + 1 < vt->cols && !vt->tabs[++vt->cur.x]);
+			vt->cur.wrapnext = 0;
+			break;
+		case '\n': case '\v': case '\f':
+			vt_linefeed(vt);
+			vt->cur.wrapnext = 0;
+			break;
+		case '\r':
+			vt->cur.x = 0;
+			vt->cur.wrapnext = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+static void vt_reply(struct vt *vt, const char *fmt, unsigned int a, unsigned int b)
+{
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), fmt, a, b);
+	if (vt->reply && len > 0) {
+		vt->reply(vt->ctx, buf, len);
+	}
+}
+
+static void vt_setaltscreen(struct vt *vt, int on)
+{
+	if (on == vt->altscreen) { return; }
+	struct vt_cell **line = vt->line;
+	vt->line = vt->altline;
+	vt->altline = line;
+	vt->altscreen = on;
+	if (on) { vt_erase_lines(vt, 0, vt->rows); }
+	memset(vt->dirty, 1, vt->rows);
+}
+
+static void vt_setmode(struct vt *vt, int on)
+{
+	unsigned int i;
+	for (i = 0; i < vt->nparams; ++i) {
+		if (vt->priv == '?') {
+			switch (vt->params[i]) {
+				case 6:
+					vt->cur.origin = on;
+					vt_goto(vt, 0, 0);
+					break;
+				case 7: vt->autowrap = on; break;
+				case 25: vt->cursorvisible = on; break;
+				case 47: case 1047:
+					vt_setaltscreen(vt, on);
+					break;
+				case 1049:
+					if (on) { vt->saved = vt->cur; }
+					vt_setaltscreen(vt, on);
+					if (!on) { vt->cur = vt->saved; }
+					break;
+				default: break;
+			}
+		} else if (vt->priv == 0 && vt->params[i] == 4) {
+			vt->insert = on;
+		}
+	}
+}
+
+/* 24 bit colors are mapped to the nearest entry of the color cube */
+static unsigned int vt_cube(unsigned int r, unsigned int g, unsigned int b)
+{
+	r = r < 48 ? 0 : r < 115 ? 1 : (r - 35) / 40;
+	g = g < 48 ? 0 : g < 115 ? 1 : (g - 35) / 40;
+	b = b < 48 ? 0 : b < 115 ? 1 : (b - 35) / 40;
+	return 16 + 36 * r + 6 * g + b;
+}
+
+static void vt_sgr(struct vt *vt)
+{
+	struct vt_cell *pen = &vt->cur.pen;
+	unsigned int i;
+	if (vt->nparams == 0) { vt->params[vt->nparams++] = 0; }
+	for (i = 0; i < vt->nparams; ++i) {
+		unsigned int p = vt->params[i];
+		if (p == 0) {
+			pen->fg = VT_DEFAULT_FG;
+			pen->bg = VT_DEFAULT_BG;
+			pen->attr = 0;
+		} else if (p == 1) { pen->attr |= VT_ATTR_BOLD;
+		} else if (p == 2) { pen->attr |= VT_ATTR_DIM;
+		} else if (p == 4) { pen->attr |= VT_ATTR_UNDERLINE;
+		} else if (p == 5) { pen->attr |= VT_ATTR_BLINK;
+		} else if (p == 7) { pen->attr |= VT_ATTR_REVERSE;
+		} else if (p == 8) { pen->attr |= VT_ATTR_INVISIBLE;
+		} else if (p == 22) { pen->attr &= ~(VT_ATTR_BOLD | VT_ATTR_DIM);
+		} else if (p == 24) { pen->attr &= ~VT_ATTR_UNDERLINE;
+		} else if (p == 25) { pen->attr &= ~VT_ATTR_BLINK;
+		} else if (p == 27) { pen->attr &= ~VT_ATTR_REVERSE;
+		} else if (p == 28) { pen->attr &= ~VT_ATTR_INVISIBLE;
+		} else if (p >= 30 && p <= 37) { pen->fg = p - 30;
+		} else if (p == 39) { pen->fg = VT_DEFAULT_FG;
+		} else if (p >= 40 && p <= 47) { pen->bg = p - 40;
+		} else if (p == 49) { pen->bg = VT_DEFAULT_BG;
+		} else if (p >= 90 && p <= 97) { pen->fg = p - 90 + 8;
+		} else if (p >= 100 && p <= 107) { pen->bg = p - 100 + 8;
+		} else if ((p == 38 || p == 48) && i + 1 < vt->nparams) {
+			unsigned int color = 0;
+			if (vt->params[i + 1] == 5 && i + 2 < vt->nparams) {
+				color = vt->params[i + 2] & 0xff;
+				i += 2;
+			} else if (vt->params[i + 1] == 2 && i + 4 < vt->nparams) {
+				color = vt_cube(vt->params[i + 2] & 0xff, vt->params[i + 3] & 0xff, vt->params[i + 4] & 0xff);
+				i += 4;
+			} else {
+				break;
+			}
+			if (p == 38) { pen->fg = color; } else { pen->bg = color; }
+		}
+	}
+}
+
+static void vt_csi_dispatch(struct vt *vt, unsigned char final)
+{
+	unsigned int p0 = vt->nparams > 0 ? vt->params[0] : 0;
+	unsigned int p1 = vt->nparams > 1 ? vt->params[1] : 0;
+	unsigned int n = p0 ? p0 : 1;
+	struct vt_cell *line = vt->line[vt->cur.y];
+	unsigned int x = vt->cur.x, y = vt->cur.y;
+
+	if (vt->intermediate) { return; }
+	if (vt->priv && final != 'h' && final != 'l') {
+		if (vt->priv == '>' && final == 'c') { vt_reply(vt, "\033[>0;0;0c", 0, 0); }
+		return;
+	}
+	switch (final) {
+		case '@':
+			if (n > vt->cols - x) { n = vt->cols - x; }
+			memmove(&line[x + n], &line[x], (vt->cols - x - n) * sizeof(struct vt_cell));
+			vt_erase(vt, y, x, x + n);
+			vt->cur.wrapnext = 0;
+			break;
+		case 'A': vt_move(vt, 0, -(int) n); break;
+		case 'B': case 'e': vt_move(vt, 0, n); break;
+		case 'C': case 'a': vt_move(vt, n, 0); break;
+		case 'D': vt_move(vt, -(int) n, 0); break;
+		case 'E': vt_move(vt, -(int) x, n); break;
+		case 'F': vt_move(vt, -(int) x, -(int) n); break;
+		case 'G': case '`': vt_goto(vt, n - 1, vt->cur.origin ? y - vt->top : y); break;
+		case 'H': case 'f': vt_goto(vt, (p1 ? p1 : 1) - 1, n - 1); break;
+		case 'I':
+			while (n-- > 0) { vt_execute(vt, '\t'); }
+			break;
+		case 'J':
+			if (p0 == 0) {
+				vt_erase(vt, y, x, vt->cols);
+				vt_erase_lines(vt, y + 1, vt->rows);
+			} else if (p0 == 1) {
+				vt_erase_lines(vt, 0, y);
+				vt_erase(vt, y, 0, x + 1);
+			} else if (p0 == 2 || p0 == 3) {
+				vt_erase_lines(vt, 0, vt->rows);
+			}
+			break;
+		case 'K':
+			if (p0 == 0) {
+				vt_erase(vt, y, x, vt->cols);
+			} else if (p0 == 1) {
+				vt_erase(vt, y, 0, x + 1);
+			} else if (p0 == 2) {
+				vt_erase(vt, y, 0, vt->cols);
+			}
+			break;
+		case 'L':
+			if (y >= vt->top && y <= vt->bottom) {
+				vt_scrolldown(vt, y, n);
+				vt->cur.x = 0;
+				vt->cur.wrapnext = 0;
+			}
+			break;
+		case 'M':
+			if (y >= vt->top && y <= vt->bottom) {
+				/* the deleted lines do not go to the scrollback */
+				void (*scrolled)(void*, const struct vt_cell*, unsigned int) = vt->scrolled;
+				vt->scrolled = 0;
+				vt_scrollup(vt, y, n);
+				vt->scrolled = scrolled;
+				vt->cur.x = 0;
+				vt->cur.wrapnext = 0;
+			}
+			break;
+		case 'P':
+			if (n > vt->cols - x) { n = vt->cols - x; }
+			memmove(&line[x], &line[x + n], (vt->cols - x - n) * sizeof(struct vt_cell));
+			vt_erase(vt, y, vt->cols - n, vt->cols);
+			vt->cur.wrapnext = 0;
+			break;
+		case 'S': vt_scrollup(vt, vt->top, n); break;
+		case 'T': vt_scrolldown(vt, vt->top, n); break;
+		case 'X':
+			vt_erase(vt, y, x, x + n);
+			vt->cur.wrapnext = 0;
+			break;
+		case 'Z':
+			while (n-- > 0 && vt->cur.x > 0) {
+				while (--vt->cur.x > 0 && !vt->tabs[vt->cur.x]);
+			}
+			vt->cur.wrapnext = 0;
+			break;
+		case 'c':
+			if (p0 == 0) { vt_reply(vt, "\033[?6c", 0, 0); }
+			break;
+		case 'd': vt_goto(vt, x, n - 1); break;
+		case 'g':
+			if (p0 == 0) {
+				vt->tabs[x] = 0;
+			} else if (p0 == 3) {
+				memset(vt->tabs, 0, vt->cols);
+			}
+			break;
+		case 'h': vt_setmode(vt, 1); break;
+		case 'l': vt_setmode(vt, 0); break;
+		case 'm': vt_sgr(vt); break;
+		case 'n':
+			if (p0 == 5) {
+				vt_reply(vt, "\033[0n", 0, 0);
+			} else if (p0 == 6) {
+				vt_reply(vt, "\033[%u;%uR", (vt->cur.origin ? y - vt->top : y) + 1, x + 1);
+			}
+			break;
+		case 'r': {
+			unsigned int top = n - 1, bottom = (p1 ? p1 : vt->rows) - 1;
+			if (bottom >= vt->rows) { bottom = vt->rows - 1; }
+			if (top < bottom) {
+				vt->top = top;
+				vt->bottom = bottom;
+				vt_goto(vt, 0, 0);
+			}
+			break;
+		}
+		case 's': vt->saved = vt->cur; break;
+		case 'u': vt->cur = vt->saved; break;
+		default: break;
+	}
+}
+
+static void vt_esc_dispatch(struct vt *vt, unsigned char final)
+{
+	unsigned int y;
+	if (vt->intermediate == '#' && final == '8') {
+		/* screen alignment test */
+		struct vt_cell e = vt_blank(vt);
+		e.ch = 'E';
+		for (y = 0; y < vt->rows; ++y) {
+			vt_fill(vt->line[y], vt->cols, e);
+			vt->dirty[y] = 1;
+		}
+		return;
+	}
+	if (vt->intermediate) { return; }
+	switch (final) {
+		case '7': vt->saved = vt->cur; break;
+		case '8': vt->cur = vt->saved; break;
+		case 'D': vt_linefeed(vt); break;
+		case 'E':
+			vt->cur.x = 0;
+			vt_linefeed(vt);
+			break;
+		case 'M': vt_reverse_linefeed(vt); break;
+		case 'H': vt->tabs[vt->cur.x] = 1; break;
+		case 'c': vt_reset(vt); break;
+		default: break;
+	}
+	vt->cur.wrapnext = 0;
+}
+
+/* feeds one byte of a utf8 sequence into the decoder */
+static void vt_utf8(struct vt *vt, unsigned char c)
+{
+	if (vt->utf8left > 0 && (c & 0xc0) == 0x80) {
+		vt->utf8 = (vt->utf8 << 6) | (c & 0x3f);
+		if (--vt->utf8left == 0) {
+			uint32_t cp = vt->utf8;
+			if (cp < vt->utf8min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) { cp = 0xfffd; }
+			vt_print(vt, cp);
+		}
+		return;
+	}
+	if (vt->utf8left > 0) {
+		/* truncated sequence */
+		vt->utf8left = 0;
+		vt_print(vt, 0xfffd);
+	}
+	if (c >= 0xc2 && c <= 0xdf) {
+		vt->utf8 = c & 0x1f;
+		vt->utf8left = 1;
+		vt->utf8min = 0x80;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		vt->utf8 = c & 0x0f;
+		vt->utf8left = 2;
+		vt->utf8min = 0x800;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		vt->utf8 = c & 0x07;
+		vt->utf8left = 3;
+		vt->utf8min = 0x10000;
+	} else {
+		vt_print(vt, 0xfffd);
+	}
+}
+
+void vt_write(struct vt *vt, const void *buf, size_t len)
+{
+	const unsigned char *ptr = buf, *end = ptr + len;
+	while (ptr < end) {
+		unsigned char c = *ptr;
+		if (vt->state == VT_GROUND && vt->utf8left == 0 && !vt->insert && c >= 0x20 && c < 0x7f) {
+			ptr += vt_print_ascii(vt, ptr, end - ptr);
+			continue;
+		}
+		++ptr;
+		if (vt->utf8left > 0 && (c & 0xc0) != 0x80) {
+			vt->utf8left = 0;
+			vt_print(vt, 0xfffd);
+		}
+		unsigned int entry = vt_table[vt->state][c];
+		vt->state = entry & 0x0f;
+		switch (entry >> 4) {
+			case VT_PRINT: vt_print(vt, c); break;
+			case VT_EXECUTE: vt_execute(vt, c); break;
+			case VT_CLEAR:
+				vt->nparams = 0;
+				vt->intermediate = 0;
+				vt->priv = 0;
+				break;
+			case VT_COLLECT: vt->intermediate = c; break;
+			case VT_PRIVATE: vt->priv = c; break;
+			case VT_PARAM:
+				if (vt->nparams == 0) { vt->params[vt->nparams++] = 0; }
+				if (c == ';') {
+					if (vt->nparams < VT_MAXPARAMS) { vt->params[vt->nparams++] = 0; }
+				} else {
+					unsigned int *p = &vt->params[vt->nparams - 1];
+					if (*p < 100000) { *p = *p * 10 + (c - '0'); }
+				}
+				break;
+			case VT_ESC_DISPATCH: vt_esc_dispatch(vt, c); break;
+			case VT_CSI_DISPATCH: vt_csi_dispatch(vt, c); break;
+			case VT_UTF8: vt_utf8(vt, c); break;
+			default: break;
+		}
+	}
+}
+
+int vt_dump(struct vt *vt, FILE *out)
+{
+	unsigned int x, y;
+	char buf[4];
+	for (y = 0; y < vt->rows; ++y) {
+		struct vt_cell *line = vt->line[y];
+		unsigned int len = vt->cols;
+		while (len > 0 && line[len - 1].ch == ' ') { --len; }
+		for (x = 0; x < len; ++x) {
+			int n = mini_utf8_encode(line[x].ch, buf, sizeof(buf));
+			if (n > 0) { fwrite(buf, 1, n, out); }
+		}
+		fputc('\n', out);
+	}
+	if (ferror(out)) {
+		perror(__func__);
+		return 0;
+	}
+	return 1;
+}
+
+uint32_t vt_palette(unsigned int idx)
+{
+	static const uint32_t ansi[16] = {
+		0x000000, 0xaa0000, 0x00aa00, 0xaa5500, 0x0000aa, 0xaa00aa, 0x00aaaa, 0xaaaaaa,
+		0x555555, 0xff5555, 0x55ff55, 0xffff55, 0x5555ff, 0xff55ff, 0x55ffff, 0xffffff
+	};
+	idx &= 0xff;
+	if (idx < 16) { return ansi[idx]; }
+	if (idx < 232) {
+		idx -= 16;
+		unsigned int r = idx / 36, g = idx / 6 % 6, b = idx % 6;
+		r = r ? r * 40 + 55 : 0;
+		g = g ? g * 40 + 55 : 0;
+		b = b ? b * 40 + 55 : 0;
+		return (r << 16) | (g << 8) | b;
+	}
+	unsigned int v = (idx - 232) * 10 + 8;
+	return (v << 16) | (v << 8) | v;
+}
+
+static void vt_render_cell(struct psf_fontset *set, struct cellcache *cache, struct psf_usage *usage, unsigned int width, unsigned int height, const struct vt_cell *cell, int cursor, unsigned char *dst, size_t stride)
+{
+	struct psf_font *font = 0;
+	int no = psf_fontset_lookup(set, cell->ch, &font);
+	if (no < 0) { no = psf_fontset_lookup(set, 0xfffd, &font); }
+	if (no < 0) { no = psf_fontset_lookup(set, '?', &font); }
+	const unsigned char *src = no >= 0 ? font->glyph[no].data : 0;
+	unsigned int fg = cell->fg, bg = cell->bg, x, y;
+	unsigned int rowbytes = (width + 7) / 8;
+
+	if ((cell->attr & VT_ATTR_BOLD) && fg < 8) { fg += 8; }
+	if (((cell->attr & VT_ATTR_REVERSE) != 0) != (cursor != 0)) {
+		unsigned int t = fg;
+		fg = bg;
+		bg = t;
+	}
+	if ((cell->attr & VT_ATTR_INVISIBLE) || cell->ch == ' ') { src = 0; }
+	if (usage && src) { psf_usage_count(usage, cell->ch, 1); }
+	unsigned int underline = (cell->attr & VT_ATTR_UNDERLINE) ? height - 1 : height;
+
+	if (cache) {
+		unsigned int attr = (underline < height ? CELLCACHE_UNDERLINE : 0) | ((cell->attr & VT_ATTR_BOLD) ? CELLCACHE_BOLD : 0);
+		const unsigned char *pixels = cellcache_get(cache, src, fg, bg, attr, CELLCACHE_INDEX8);
+		if (pixels) {
+			for (y = 0; y < height; ++y, dst += stride, pixels += width) {
+				memcpy(dst, pixels, width);
+			}
+			return;
+		}
+	}
+	for (y = 0; y < height; ++y, dst += stride) {
+		if (y == underline) {
+			memset(dst, fg, width);
+			continue;
+		} else if (!src) {
+			memset(dst, bg, width);
+			continue;
+		}
+		const unsigned char *row = src + y * rowbytes;
+		for (x = 0; x < width; ++x) {
+			dst[x] = (row[x >> 3] & (0x80 >> (x & 7))) ? fg : bg;
+		}
+	}
+}
+
+unsigned int vt_render(struct vt *vt, struct psf_fontset *set, unsigned char *fb, size_t stride)
+{
+	struct psf_font *first = psf_fontset_font(set, 0);
+	if (!first) { return 0; }
+	unsigned int width = psf_width(first), height = psf_height(first);
+	unsigned int x, y, drawn = 0;
+
+	/* the cursor cell is drawn reversed */
+	vt->dirty[vt->drawny < vt->rows ? vt->drawny : 0] = 1;
+	vt->dirty[vt->cur.y] = 1;
+	for (y = 0; y < vt->rows; ++y) {
+		if (!vt->dirty[y]) { continue; }
+		unsigned char *dst = fb + (size_t) y * height * stride;
+		for (x = 0; x < vt->cols; ++x, dst += width) {
+			int cursor = vt->cursorvisible && x == vt->cur.x && y == vt->cur.y;
+			vt_render_cell(set, vt->cache, vt->usage, width, height, &vt->line[y][x], cursor, dst, stride);
+		}
+		vt->dirty[y] = 0;
+		++drawn;
+	}
+	vt->drawnx = vt->cur.x;
+	vt->drawny = vt->cur.y;
+	return drawn;
+}
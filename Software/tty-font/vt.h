@@ -0,0 +1,191 @@
+/* vt.h
+ *
+ * a small vt100 / ansi terminal emulation on top of the psf library.
+ *
+ * Released under the terms of the MIT license. See file LICENSE for details.
+ *
+ * Escape sequences are parsed by the state machine from
+ * https://vt100.net/emu/dec_ansi_parser, input is utf8. Supported are the
+ * usual cursor movement, erase, insert and delete sequences, scroll regions,
+ * tab stops, SGR attributes with 16 and 256 colors, the alternate screen and
+ * the status reports programs ask for. Wide and combining characters take
+ * one cell each.
+ */
+
+#ifndef vt_h
+#define vt_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "psf.h"
+
+/* cell attributes */
+#define VT_ATTR_BOLD      0x01
+#define VT_ATTR_DIM       0x02
+#define VT_ATTR_UNDERLINE 0x04
+#define VT_ATTR_BLINK     0x08
+#define VT_ATTR_REVERSE   0x10
+#define VT_ATTR_INVISIBLE 0x20
+
+/* default colors, as indexes into the 256 color palette */
+#define VT_DEFAULT_FG 7
+#define VT_DEFAULT_BG 0
+
+/* maximum number of numeric parameters in a control sequence */
+#define VT_MAXPARAMS 16
+
+struct cellcache;
+
+/* one character cell of the screen */
+struct vt_cell {
+	uint32_t ch;		/* unicode codepoint */
+	uint8_t fg, bg;		/* palette indexes */
+	uint16_t attr;		/* VT_ATTR_* */
+};
+
+struct vt_cursor {
+	unsigned int x, y;
+	int wrapnext;		/* next printed char wraps to the next line first */
+	int origin;			/* cursor addressing is relative to scroll region */
+	struct vt_cell pen;	/* attributes for newly printed chars */
+};
+
+struct vt {
+	unsigned int cols, rows;
+	struct vt_cell **line;		/* rows lines, scrolled by rotating pointers */
+	struct vt_cell **altline;	/* the other screen */
+	struct vt_cell *cells, *altcells;
+	unsigned char *dirty;		/* one flag per line, set when it changed */
+	unsigned char *tabs;		/* one flag per column */
+	struct vt_cursor cur, saved;
+	unsigned int top, bottom;	/* scroll region, inclusive */
+	int autowrap, insert, cursorvisible, altscreen;
+
+	/* parser state */
+	unsigned int state;
+	unsigned int params[VT_MAXPARAMS], nparams;
+	unsigned char intermediate, priv;
+	uint32_t utf8, utf8min;
+	unsigned int utf8left;
+
+	/* where vt_render last drew the cursor */
+	unsigned int drawnx, drawny;
+
+	/* called with every line that scrolls off the top of the main screen,
+	 * before it is overwritten.
+	 */
+	void (*scrolled)(void *ctx, const struct vt_cell *line, unsigned int cols);
+	/* called with replies to status requests, which should be sent back to
+	 * the program the output came from.
+	 */
+	void (*reply)(void *ctx, const char *buf, size_t len);
+	void *ctx;
+
+	/* if set, vt_render copies cells from this cache, see cellcache.h */
+	struct cellcache *cache;
+	/* if set, vt_render counts every glyph it draws here, see psf_layout */
+	struct psf_usage *usage;
+};
+
+/* vt_new
+ *
+ * allocates a new terminal with an empty screen.
+ *
+ * Arguments:
+ *	cols	number of columns
+ *	rows	number of rows
+ *
+ * Returns:
+ *	a pointer to the new terminal, or 0 on error.
+ */
+struct vt *vt_new(unsigned int cols, unsigned int rows);
+
+/* vt_delete
+ *
+ * frees all memory used by a terminal.
+ *
+ * Arguments:
+ *	vt		the terminal
+ *
+ * Returns:
+ *	-
+ */
+void vt_delete(struct vt *vt);
+
+/* vt_reset
+ *
+ * resets a terminal to its initial state and clears the screen.
+ *
+ * Arguments:
+ *	vt		the terminal
+ *
+ * Returns:
+ *	-
+ */
+void vt_reset(struct vt *vt);
+
+/* vt_write
+ *
+ * feeds program output into the terminal. Data may be split anywhere, also
+ * within escape sequences or utf8 encoded chars. Runs of printable ascii
+ * chars are copied into the screen without going through the parser.
+ *
+ * Arguments:
+ *	vt		the terminal
+ *	buf		the output
+ *	len		number of bytes in buf
+ *
+ * Returns:
+ *	-
+ */
+void vt_write(struct vt *vt, const void *buf, size_t len);
+
+/* vt_dump
+ *
+ * writes the text on the screen to a file, utf8 encoded, one line per row
+ * without trailing blanks.
+ *
+ * Arguments:
+ *	vt		the terminal
+ *	out		the file to write to
+ *
+ * Returns:
+ *	1 on success, 0 on failure.
+ */
+int vt_dump(struct vt *vt, FILE *out);
+
+/* vt_palette
+ *
+ * returns the color for a palette index, as 0xRRGGBB. Indexes 0-15 are the
+ * ansi colors, 16-231 a 6x6x6 color cube and 232-255 a gray ramp.
+ *
+ * Arguments:
+ *	idx		the palette index
+ *
+ * Returns:
+ *	the color
+ */
+uint32_t vt_palette(unsigned int idx);
+
+/* vt_render
+ *
+ * draws all lines that changed since the last call into a framebuffer with
+ * one byte, a palette index, per pixel, and clears their dirty flags. Glyphs
+ * are taken from a font set, all fonts must have the same size. Codepoints
+ * without glyph are drawn as U+FFFD or '?', if the fonts have those. If the
+ * terminal has a cell cache, cells are drawn through that. If it has a usage
+ * histogram, every glyph drawn is counted in it.
+ *
+ * Arguments:
+ *	vt		the terminal
+ *	set		the fonts
+ *	fb		the framebuffer, at least cols * width by rows * height pixels
+ *	stride	bytes per framebuffer line
+ *
+ * Returns:
+ *	the number of lines drawn.
+ */
+unsigned int vt_render(struct vt *vt, struct psf_fontset *set, unsigned char *fb, size_t stride);
+
+#endif /* vt_h */